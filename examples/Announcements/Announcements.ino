@@ -0,0 +1,66 @@
+/** Demonstrate scheduling announcements over background music, so
+ *   that they don't cut each other off, and the important ones go first.
+ *
+ * @license MIT License
+ * @file
+ */
+
+// This example uses SoftwareSerial on pin 8 and 9
+#include <SoftwareSerial.h>
+SoftwareSerial mySoftwareSerial(8,9);
+
+// Create the mp3 connection itself, notice how we give it the
+//  serial object we want it to use to talk to the JQ8400 module.
+// For example you might use mp3(Serial2) instead of a SoftwareSerial
+#include <JQ8400_Serial.h>
+#include <JQ8400_Announcer.h>
+JQ8400_Serial    mp3(mySoftwareSerial);
+JQ8400_Announcer announcer(mp3);
+
+// Buttons to pin 2 and 3 (to ground)
+const uint8_t doorbellPin = 2;
+const uint8_t alarmPin    = 3;
+
+void setup()
+{
+  Serial.begin(9600);
+  mySoftwareSerial.begin(9600);
+  pinMode(doorbellPin, INPUT_PULLUP);
+  pinMode(alarmPin,    INPUT_PULLUP);
+
+  mp3.reset();
+  mp3.setVolume(20);
+
+  // The "background music" at position 1, announcements are files 2 and 3
+  mp3.setLoopMode(MP3_LOOP_ONE);
+  mp3.playFileByIndexNumber(1);
+
+  // A doorbell nobody heard for 10 seconds isn't worth announcing
+  announcer.setMaxWait(10000);
+}
+
+void loop()
+{
+  announcer.update();
+
+  if(digitalRead(doorbellPin) == LOW)
+  {
+    announcer.announce(2, 1);  // Waits for any other announcement
+    delay(200);
+  }
+
+  if(digitalRead(alarmPin) == LOW)
+  {
+    announcer.announce(3, 9);  // Cuts off the doorbell
+    delay(200);
+  }
+
+  static uint16_t reported = 0;
+  if(announcer.countStarted() != reported)
+  {
+    reported = announcer.countStarted();
+    Serial.print(F("Announcement out after "));
+    Serial.print(announcer.lastLatency());
+    Serial.println(F("us"));
+  }
+}
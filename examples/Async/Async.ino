@@ -0,0 +1,67 @@
+/** Demonstrate non blocking (asynchronous) operation.
+ *
+ *  Commands are queued and mp3.update() is called from loop() to 
+ *  send them and collect the responses, so nothing here ever waits
+ *  for the JQ8400 and you are free to do other things.
+ *
+ * @author James Sleeman,  http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+ 
+// This example uses SoftwareSerial on pin 8 and 9
+#include <SoftwareSerial.h>
+SoftwareSerial mySoftwareSerial(8,9);
+
+// Create the mp3 connection itself, notice how we give it the 
+//  serial object we want it to use to talk to the JQ8400 module.
+// For example you might use mp3(Serial2) instead of a SoftwareSerial
+#include <JQ8400_Serial.h>
+JQ8400_Serial mp3(mySoftwareSerial);
+
+// Called by mp3.update() when the status query completes
+void statusArrived(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length)
+{
+  if(result != MP3_REQUEST_DONE || !length) 
+  {
+    Serial.println(F("No response to status query."));
+    return;
+  }
+  
+  switch(data[0])
+  {
+    case MP3_STATUS_PLAYING: Serial.println(F("Playing")); break;
+    case MP3_STATUS_PAUSED:  Serial.println(F("Paused"));  break;
+    case MP3_STATUS_STOPPED: Serial.println(F("Stopped")); break;
+  }
+}
+
+void setup() 
+{  
+  Serial.begin(9600);
+  mySoftwareSerial.begin(9600);
+  mp3.reset();
+  
+  // From here on play(), setVolume() etc are queued rather than sent immediately
+  mp3.setAsync(true);
+  mp3.setVolume(20);
+  mp3.setLoopMode(MP3_LOOP_ALL);
+  mp3.play();
+}
+
+void loop() 
+{
+  static uint32_t lastQuery = 0;
+  
+  // This must be called frequently, it never blocks
+  mp3.update();
+  
+  // Ask for the status every 2 seconds
+  if(millis() - lastQuery > 2000)
+  {
+    lastQuery = millis();
+    mp3.queueCommand(JQ8400_Serial::MP3_CMD_STATUS, NULL, 0, true, statusArrived);
+  }
+  
+  // Do other things here, blinking LEDs, reading sensors...
+}
@@ -0,0 +1,256 @@
+/** Measure the protocol engine against a JQ8400_Mock, no module needed.
+ *
+ * Reports how many commands per second get through, how long queries
+ * take (min, average, max and a distribution), and how long reset()
+ * and a playlist keep us waiting, then the same again with faults
+ * injected so the retries are included.
+ *
+ * Use it to compare before and after a change to the library, with the
+ * same board, baud rate and latency the numbers are repeatable.
+ *
+ * Compile with MP3_STATS set to 1 to also get the library's own statistics,
+ * set for the whole build (-DMP3_STATS=1, or the default in JQ8400_Serial.h)
+ * not with a #define in this sketch, see MP3_LAYOUT.
+ *
+ * @license MIT License
+ * @file
+ */
+
+#include <JQ8400_Serial.h>
+#include <JQ8400_Mock.h>
+
+JQ8400_Mock   device(9600);
+JQ8400_Serial mp3(device);
+
+// Latency distribution, upper limits in ms, the last bucket is anything more
+const uint16_t bucketLimits[] = { 5, 10, 20, 50, 100, 200 };
+const uint8_t  bucketCount    = sizeof(bucketLimits) / sizeof(bucketLimits[0]) + 1;
+
+struct Measurement
+{
+  uint16_t calls;
+  uint16_t failed;
+  uint32_t minimum;
+  uint32_t maximum;
+  uint32_t total;
+  uint32_t polls;
+  uint16_t buckets[bucketCount];
+};
+
+Measurement m;
+
+void startMeasuring()
+{
+  memset(&m, 0, sizeof(m));
+  m.minimum = 0xFFFFFFFF;
+  device.resetCounters();
+}
+
+// Only a query has a result to check, commands go unanswered
+void measured(uint32_t startedAt, uint8_t query = true)
+{
+  uint32_t took = micros() - startedAt;
+  uint8_t  b    = 0;
+
+  while(b < bucketCount - 1 && took >= bucketLimits[b] * 1000UL) b++;
+
+  m.buckets[b]++;
+  m.calls++;
+  m.total += took;
+  if(took < m.minimum) m.minimum = took;
+  if(took > m.maximum) m.maximum = took;
+  if(query && mp3.lastResult() != MP3_REQUEST_DONE) m.failed++;
+}
+
+void report(const __FlashStringHelper *name)
+{
+  m.polls = device.polls();
+
+  Serial.println(name);
+  Serial.print(F("  calls "));     Serial.print(m.calls);
+  Serial.print(F(", failed "));    Serial.print(m.failed);
+  Serial.print(F(", min "));       Serial.print(m.minimum);
+  Serial.print(F("us, avg "));     Serial.print(m.calls ? m.total / m.calls : 0);
+  Serial.print(F("us, max "));     Serial.print(m.maximum);
+  Serial.print(F("us, per second ")); Serial.print(m.total ? 1000000.0 * m.calls / m.total : 0);
+  Serial.print(F(", polls/call ")); Serial.println(m.calls ? m.polls / m.calls : 0);
+
+  // All of the time is spent busy waiting in available(), at least we can see how much
+  Serial.print(F("  "));
+  for(uint8_t b = 0; b < bucketCount; b++)
+  {
+    if(b < bucketCount - 1) { Serial.print(F("<")); Serial.print(bucketLimits[b]); }
+    else                    { Serial.print(F(">=")); Serial.print(bucketLimits[b-1]); }
+    Serial.print(F("ms: "));
+    Serial.print(m.buckets[b]);
+    Serial.print(F("  "));
+  }
+  Serial.println();
+}
+
+void benchmarkCommands()
+{
+  startMeasuring();
+  for(uint8_t x = 0; x < 100; x++)
+  {
+    uint32_t startedAt = micros();
+    mp3.setVolume(x % 30);
+    measured(startedAt, false);
+  }
+  report(F("setVolume()"));
+}
+
+void benchmarkQueries()
+{
+  startMeasuring();
+  for(uint8_t x = 0; x < 100; x++)
+  {
+    // We want the round trip, not the shadow copy
+    mp3.invalidateShadow();
+
+    uint32_t startedAt = micros();
+    mp3.getStatus();
+    measured(startedAt);
+  }
+  report(F("getStatus()"));
+
+  startMeasuring();
+  for(uint8_t x = 0; x < 100; x++)
+  {
+    mp3.invalidateShadow();
+
+    uint32_t startedAt = micros();
+    mp3.countFiles();
+    measured(startedAt);
+  }
+  report(F("countFiles()"));
+
+  startMeasuring();
+  for(uint8_t x = 0; x < 20; x++)
+  {
+    char name[12];
+
+    // A different file each time, it must ask for the index and then the name
+    mp3.next();
+
+    uint32_t startedAt = micros();
+    mp3.currentFileName(name, sizeof(name));
+    measured(startedAt);
+  }
+  report(F("currentFileName(), not cached"));
+
+  startMeasuring();
+  for(uint8_t x = 0; x < 100; x++)
+  {
+    char name[12];
+
+    uint32_t startedAt = micros();
+    mp3.currentFileName(name, sizeof(name));
+    measured(startedAt, false);
+  }
+  report(F("currentFileName(), cached"));
+}
+
+void benchmarkAsync()
+{
+  // The same queries queued and left to update(), pipelined if we allow it
+  for(uint8_t depth = 1; depth <= MP3_ASYNC_QUEUE_LENGTH; depth *= 2)
+  {
+    mp3.setPipelineDepth(depth);
+    startMeasuring();
+
+    uint32_t startedAt = micros();
+    uint16_t queued    = 0;
+
+    while(queued < 100 || mp3.pendingRequests())
+    {
+      if(queued < 100 && mp3.queueCommand(JQ8400_Serial::MP3_CMD_STATUS, NULL, 0, true)) queued++;
+      mp3.update();
+    }
+
+    m.calls   = queued;
+    m.total   = micros() - startedAt;
+    m.minimum = m.maximum = m.total / queued;
+    Serial.print(F("Pipeline depth "));
+    Serial.println(depth);
+    report(F("queueCommand(MP3_CMD_STATUS) and update()"));
+  }
+
+  mp3.setPipelineDepth(1);
+}
+
+void benchmarkLongCalls()
+{
+  startMeasuring();
+  for(uint8_t x = 0; x < 5; x++)
+  {
+    uint32_t startedAt = micros();
+    mp3.reset();
+    measured(startedAt, false);
+  }
+  report(F("reset()"));
+
+  uint8_t playlist[64];
+  for(uint8_t x = 0; x < sizeof(playlist); x++) playlist[x] = x % 20 + 1;
+
+  startMeasuring();
+  for(uint8_t x = 0; x < 5; x++)
+  {
+    uint32_t startedAt = micros();
+    mp3.playSequenceByFileNumber(playlist, sizeof(playlist));
+    measured(startedAt, false);
+  }
+  report(F("playSequenceByFileNumber(64 files)"));
+}
+
+void benchmarkAll()
+{
+  benchmarkCommands();
+  benchmarkQueries();
+  benchmarkAsync();
+  benchmarkLongCalls();
+
+#if MP3_STATS
+  mp3.dumpStats(Serial);
+  mp3.resetStats();
+#endif
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  device.setLatency(3000);    // The real module answers in 2 to 5ms
+  device.setTrackLength(10);
+
+  mp3.reset();
+  mp3.playFileByIndexNumber(1);
+
+  // What the options chosen cost, see MP3_RAM_BUDGET
+  Serial.print(F("RAM used by JQ8400_Serial: "));
+  Serial.println(sizeof(JQ8400_Serial));
+  
+  Serial.println(F("== A perfect line =="));
+  benchmarkAll();
+
+  // The polls per call show how much less time is spent spinning
+  Serial.println(F("== Idle while waiting =="));
+  mp3.setWaitStrategy(JQ8400_Serial::waitIdle);
+  benchmarkQueries();
+  mp3.setWaitStrategy(NULL);
+
+  Serial.println(F("== Noise, corrupted and lost responses =="));
+  device.setSeed(42);
+  device.setNoise(10);
+  device.setChecksumErrors(10);
+  device.setDropRate(5);
+  benchmarkAll();
+
+  Serial.print(F("Bad frames seen by the device: "));
+  Serial.println(device.badFrames());
+}
+
+void loop()
+{
+
+}
@@ -0,0 +1,75 @@
+/** Demonstrate building an index of the folders and files on the
+ *   device in the background, and keeping it in EEPROM so that the
+ *   next boot (with the same media) has it straight away.
+ *
+ * @license MIT License
+ * @file
+ */
+
+// This example uses SoftwareSerial on pin 8 and 9
+#include <SoftwareSerial.h>
+SoftwareSerial mySoftwareSerial(8,9);
+
+// Create the mp3 connection itself, notice how we give it the
+//  serial object we want it to use to talk to the JQ8400 module.
+// For example you might use mp3(Serial2) instead of a SoftwareSerial
+#include <JQ8400_Serial.h>
+#include <JQ8400_Catalog.h>
+JQ8400_Serial  mp3(mySoftwareSerial);
+JQ8400_Catalog catalog(mp3);
+
+// Room for the names of the first 40 files, 11 bytes each
+char names[40 * MP3_CATALOG_NAME_LENGTH];
+
+void printCatalog()
+{
+  char name[MP3_CATALOG_NAME_LENGTH + 1];
+
+  for(uint8_t folder = 1; folder <= catalog.countFolders(); folder++)
+  {
+    Serial.print(F("Folder "));
+    Serial.println(folder);
+
+    uint16_t first = catalog.firstFileInFolder(folder);
+    for(uint16_t file = first; file < first + catalog.countFilesInFolder(folder); file++)
+    {
+      Serial.print(F("  "));
+      Serial.print(file);
+      Serial.print(F(" "));
+      if(catalog.fileName(file, name, sizeof(name))) Serial.print(name);
+      Serial.println();
+    }
+  }
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  mySoftwareSerial.begin(9600);
+  mp3.reset();
+
+  catalog.setNameStorage(names, sizeof(names) / MP3_CATALOG_NAME_LENGTH);
+
+  // If the media has changed (or nothing was saved) build it afresh
+  if(catalog.load(0))
+  {
+    Serial.println(F("Loaded from EEPROM"));
+    printCatalog();
+  }
+  else
+  {
+    Serial.println(F("Building..."));
+    catalog.build();
+  }
+}
+
+void loop()
+{
+  catalog.update();
+
+  if(catalog.ready() && !catalog.saved())
+  {
+    catalog.save(0);
+    printCatalog();
+  }
+}
@@ -0,0 +1,57 @@
+/** Demonstrate how to be told when a track finishes, without polling
+ *   the device for the status.
+ *
+ * @license MIT License
+ * @file
+ */
+ 
+// This example uses SoftwareSerial on pin 8 and 9
+#include <SoftwareSerial.h>
+SoftwareSerial mySoftwareSerial(8,9);
+
+// Create the mp3 connection itself, notice how we give it the 
+//  serial object we want it to use to talk to the JQ8400 module.
+// For example you might use mp3(Serial2) instead of a SoftwareSerial
+#include <JQ8400_Serial.h>
+JQ8400_Serial mp3(mySoftwareSerial);
+
+// Called when a track finishes by itself, we must not use anything which 
+//  waits for a response in here, but sending a command is fine.
+void trackEnded(JQ8400_Serial &device, uint16_t index)
+{
+  Serial.print(F("Finished track "));
+  Serial.println(index);
+  
+  device.playFileByIndexNumber(index % 3 + 1);
+}
+
+void positionReport(JQ8400_Serial &device, uint16_t seconds)
+{
+  Serial.print(F("At "));
+  Serial.print(seconds);
+  Serial.println(F("s"));
+}
+
+void setup() 
+{  
+  Serial.begin(9600);
+  mySoftwareSerial.begin(9600);
+  mp3.reset();
+  mp3.setVolume(20);
+  mp3.setLoopMode(MP3_LOOP_NONE);
+  
+  mp3.onTrackEnd(trackEnded);
+  mp3.onPosition(positionReport);
+  
+  // The device reports the position every second while playing, which is 
+  //  how we notice the end of a track without asking
+  mp3.setPositionStreaming(true);
+  
+  mp3.playFileByIndexNumber(1);
+}
+
+void loop() 
+{
+  // Reads whatever the device has sent and calls the callbacks
+  mp3.update();
+}
@@ -0,0 +1,58 @@
+/** Demonstrate starting the device without waiting for it, and carrying
+ *   on with whatever it was playing if only we (not it) were restarted,
+ *   for example by the watchdog.
+ *
+ * @license MIT License
+ * @file
+ */
+
+// This example uses SoftwareSerial on pin 8 and 9
+#include <SoftwareSerial.h>
+SoftwareSerial mySoftwareSerial(8,9);
+
+// Create the mp3 connection itself, notice how we give it the
+//  serial object we want it to use to talk to the JQ8400 module.
+// For example you might use mp3(Serial2) instead of a SoftwareSerial
+#include <JQ8400_Serial.h>
+JQ8400_Serial mp3(mySoftwareSerial);
+
+void ready(JQ8400_Serial &mp3, uint16_t state)
+{
+  if(state == MP3_STARTUP_READY)
+  {
+    Serial.print(F("Ready after "));
+    Serial.print(millis());
+    Serial.println(F("ms"));
+  }
+  else
+  {
+    Serial.println(F("No answer from the device"));
+  }
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  mySoftwareSerial.begin(9600);
+
+  mp3.onReady(ready);
+  mp3.startup(true);
+}
+
+void loop()
+{
+  static uint8_t started = false;
+
+  mp3.update();
+
+  // Everything else carries on while the device starts
+  if(started || mp3.startupState() != MP3_STARTUP_READY) return;
+  started = true;
+
+  // After a warm attach the device may already be playing, leave it be
+  if(mp3.shadowValid(MP3_SHADOW_STATUS) && mp3.shadowValue(MP3_SHADOW_STATUS) == MP3_STATUS_PLAYING) return;
+
+  mp3.setVolume(20);
+  mp3.setLoopMode(MP3_LOOP_ALL);
+  mp3.playFileByIndexNumber(1);
+}
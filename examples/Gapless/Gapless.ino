@@ -0,0 +1,52 @@
+/** Demonstrate playing a long sequence of files, in any order, one
+ *   straight after the other.
+ *
+ * @license MIT License
+ * @file
+ */
+
+// This example uses SoftwareSerial on pin 8 and 9
+#include <SoftwareSerial.h>
+SoftwareSerial mySoftwareSerial(8,9);
+
+// Create the mp3 connection itself, notice how we give it the
+//  serial object we want it to use to talk to the JQ8400 module.
+// For example you might use mp3(Serial2) instead of a SoftwareSerial
+#include <JQ8400_Serial.h>
+#include <JQ8400_Sequencer.h>
+JQ8400_Serial    mp3(mySoftwareSerial);
+JQ8400_Sequencer sequencer(mp3);
+
+// The files for a station announcement, by FAT index
+const uint16_t announcement[] PROGMEM = { 40, 3, 17, 52, 104, 9 };
+
+// Count down from 10, files 1 to 10 are the spoken numbers
+uint16_t countdown(JQ8400_Serial &mp3, uint16_t position)
+{
+  return position < 10 ? 10 - position : 0;
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  mySoftwareSerial.begin(9600);
+  mp3.reset();
+  mp3.setVolume(20);
+
+  sequencer.play_P(announcement, sizeof(announcement) / sizeof(announcement[0]));
+}
+
+void loop()
+{
+  sequencer.update();
+
+  // When the announcement is done, count down, forever
+  if(!sequencer.active())
+  {
+    Serial.print(F("Longest gap between files "));
+    Serial.print(sequencer.maxGap());
+    Serial.println(F("ms"));
+
+    sequencer.play(countdown);
+  }
+}
@@ -0,0 +1,70 @@
+/** Drive two JQ8400 modules together from an ESP32.
+ *
+ *  Both modules start the same file at the same time, and their status
+ *  is checked every second without either module holding up the other.
+ *
+ * | JQ8400 Module A | ESP32    |
+ * | --------------- | -------- |
+ * | RX              | GPIO17   |
+ * | TX              | GPIO16   |
+ * 
+ * | JQ8400 Module B | ESP32    |
+ * | --------------- | -------- |
+ * | RX              | GPIO4    |
+ * | TX              | GPIO5    |
+ * 
+ * (and GND, VCC of course)
+ *
+ * @author James Sleeman,  http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <JQ8400_Serial.h>
+#include <JQ8400_Group.h>
+
+JQ8400_Serial mp3a(Serial2);
+JQ8400_Serial mp3b(Serial1);
+JQ8400_Group  speakers;
+
+void statusArrived(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length)
+{
+  Serial.print(&mp3 == &mp3a ? "A: " : "B: ");
+  if(result != MP3_REQUEST_DONE || !length)
+  {
+    Serial.println("No response");
+  }
+  else
+  {
+    Serial.println(data[0] == MP3_STATUS_PLAYING ? "Playing" : "Not Playing");
+  }
+}
+
+void setup() 
+{  
+  Serial.begin(115200);
+  Serial2.begin(9600);
+  Serial1.begin(9600, SERIAL_8N1, 5, 4);
+  
+  mp3a.reset();
+  mp3b.reset();
+  
+  speakers.add(mp3a);
+  speakers.add(mp3b);
+  
+  speakers.setVolume(20);
+  speakers.playFileByIndexNumber(1);
+}
+
+void loop() 
+{
+  static uint32_t lastQuery = 0;
+  
+  speakers.update();
+  
+  if(millis() - lastQuery > 1000 && !speakers.pendingRequests())
+  {
+    lastQuery = millis();
+    speakers.queueCommand(JQ8400_Serial::MP3_CMD_STATUS, NULL, 0, true, statusArrived);
+  }
+}
@@ -0,0 +1,73 @@
+/** Control the MP3 player from several FreeRTOS tasks on an ESP32.
+ *
+ *  A JQ8400_ESP32 task owns the serial port, the other tasks just 
+ *  send it messages, which is safe from any task and never waits
+ *  for the JQ8400 (unless they choose to wait for an answer).
+ *
+ * | JQ8400 Module | ESP32    |
+ * | ------------- | -------- |
+ * | RX            | GPIO17   |
+ * | TX            | GPIO16   |
+ * | GND (any of)  | GND      |
+ * | VCC (any of)  | VCC      |
+ *
+ * @author James Sleeman,  http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <JQ8400_Serial.h>
+#include <JQ8400_ESP32.h>
+
+JQ8400_Serial mp3(Serial2);
+JQ8400_ESP32  player(mp3);
+
+// Skips to the next track every 10 seconds
+void skipTask(void *)
+{
+  for(;;)
+  {
+    vTaskDelay(pdMS_TO_TICKS(10000));
+    player.next();
+  }
+}
+
+// Reports the status every 2 seconds
+void statusTask(void *)
+{
+  for(;;)
+  {
+    vTaskDelay(pdMS_TO_TICKS(2000));
+    
+    switch(player.getStatus())
+    {
+      case MP3_STATUS_PLAYING: Serial.println("Playing"); break;
+      case MP3_STATUS_PAUSED:  Serial.println("Paused");  break;
+      case MP3_STATUS_STOPPED: Serial.println("Stopped"); break;
+      default:                 Serial.println("No answer"); break;
+    }
+  }
+}
+
+void setup() 
+{  
+  Serial.begin(115200);
+  Serial2.begin(9600);
+  
+  // Before begin() we may use mp3 directly, after it only through player
+  mp3.reset();
+  player.begin();
+  
+  player.setVolume(20);
+  player.run([](JQ8400_Serial &device, uint16_t arg) { device.setLoopMode(arg); }, MP3_LOOP_ALL);
+  player.play();
+  
+  xTaskCreate(skipTask,   "skip",   2048, NULL, 1, NULL);
+  xTaskCreate(statusTask, "status", 2048, NULL, 1, NULL);
+}
+
+void loop() 
+{
+  // Nothing to do here, it's all in the tasks
+  vTaskDelay(portMAX_DELAY);
+}
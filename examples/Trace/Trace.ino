@@ -0,0 +1,57 @@
+/** Demonstrate recording the frames to and from the module, with the time
+ *   between them, and printing them later, without the printing getting in 
+ *   the way of the timing.
+ *
+ * Compile with MP3_TRACE set to 1 (or MP3_DEBUG, which now means the same),
+ *   without it the recorder does not exist and the library carries no
+ *   tracing code at all.  Set it for the whole build, the library as well
+ *   as this sketch, with a build flag (-DMP3_TRACE=1) or by changing the
+ *   default in JQ8400_Serial.h, a #define here is not enough (see 
+ *   MP3_LAYOUT, it will fail to link).
+ *
+ * @license MIT License
+ * @file
+ */
+
+// This example uses SoftwareSerial on pin 8 and 9
+#include <SoftwareSerial.h>
+SoftwareSerial mySoftwareSerial(8,9);
+
+#include <JQ8400_Serial.h>
+#include <JQ8400_Trace.h>
+
+// Everything that used to be a #define can be set for this one module
+JQ8400_Config config;
+JQ8400_Serial mp3(mySoftwareSerial, config);
+
+#if MP3_TRACE
+JQ8400_Trace  trace;
+#endif
+
+void setup()
+{
+  Serial.begin(9600);
+  mySoftwareSerial.begin(9600);
+
+#if MP3_TRACE
+  trace.attach(mp3);
+#endif
+
+  mp3.reset();
+  mp3.setVolume(20);
+  mp3.playFileByIndexNumber(1);
+}
+
+void loop()
+{
+  mp3.getStatus();
+
+#if MP3_TRACE
+  // Print what happened since the last time, a line per frame, or
+  //  trace.save(file) to keep it on an SD card for JQ8400_Replay
+  trace.dump(Serial);
+  trace.clear();
+#endif
+
+  delay(2000);
+}
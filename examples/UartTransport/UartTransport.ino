@@ -0,0 +1,68 @@
+/** Demonstrate talking to the JQ8400 through the library's own UART 
+ *   transports, interrupt driven on AVR and event driven on ESP32, in
+ *   place of SoftwareSerial or HardwareSerial.
+ *
+ * On an AVR with more than one USART (eg Mega) the module is on USART1
+ *  (Serial1's pins), otherwise it is on USART0 and `Serial` can not be
+ *  used at the same time, the messages below are left out.
+ *
+ * On an ESP32 the module is on UART2, GPIO16 (RX) and GPIO17 (TX).
+ *
+ * @license MIT License
+ * @file
+ */
+
+#include <JQ8400_Serial.h>
+
+#if defined(ESP32)
+  #include <JQ8400_Esp32Uart.h>
+  JQ8400_Esp32Uart mp3Uart(UART_NUM_2);
+  #define HAS_MONITOR 1
+#elif defined(UBRR1H)
+  #include <JQ8400_AvrUart.h>
+  MP3_AVR_USART(mp3Uart, 1);
+  #define HAS_MONITOR 1
+#else
+  #include <JQ8400_AvrUart.h>
+  MP3_AVR_USART(mp3Uart, 0);
+  #define HAS_MONITOR 0
+#endif
+
+JQ8400_Serial mp3(mp3Uart);
+
+void setup()
+{
+#if HAS_MONITOR
+  Serial.begin(115200);
+#endif
+
+#if defined(ESP32)
+  mp3Uart.begin(9600, 16, 17);
+  mp3.setWaitStrategy(JQ8400_Esp32Uart::waitEvent);
+#else
+  mp3Uart.begin(9600);
+  mp3.setWaitStrategy(JQ8400_Serial::waitIdle);
+#endif
+
+  mp3.reset();
+  mp3.setVolume(20);
+  mp3.setLoopMode(MP3_LOOP_ALL);
+  mp3.play();
+}
+
+void loop()
+{
+  mp3.update();
+
+#if HAS_MONITOR
+  static uint32_t lastReport = 0;
+  if(millis() - lastReport >= 5000)
+  {
+    lastReport = millis();
+    Serial.print(F("Playing "));
+    Serial.print(mp3.currentFileIndexNumber());
+    Serial.print(F(", bytes lost "));
+    Serial.println(mp3Uart.overflows());
+  }
+#endif
+}
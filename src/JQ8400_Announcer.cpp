@@ -0,0 +1,231 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "JQ8400_Announcer.h"
+
+uint8_t JQ8400_Announcer::announce(uint16_t fileNumber, uint8_t priority)
+{
+  Announcement announcement = { fileNumber, priority, micros() };
+  
+  // Straight out if nothing is in the way, or cut off something less important
+  if(state == MP3_ANNOUNCER_IDLE || priority > current.priority)
+  {
+    if(state != MP3_ANNOUNCER_IDLE) dropped++;
+    this->start(announcement);
+    return MP3_ANNOUNCE_STARTED;
+  }
+  
+  // Make room by dropping the least important (the newest of those), if that's not us
+  if(waiting == MP3_ANNOUNCE_QUEUE)
+  {
+    dropped++;
+    if(priority <= queue[waiting - 1].priority) return MP3_ANNOUNCE_DROPPED;
+    waiting--;
+  }
+  
+  // Behind everything of the same or higher priority
+  uint8_t at = waiting++;
+  for(; at && queue[at - 1].priority < priority; at--) queue[at] = queue[at - 1];
+  queue[at] = announcement;
+  
+  return MP3_ANNOUNCE_QUEUED;
+}
+
+void JQ8400_Announcer::next()
+{
+  state = MP3_ANNOUNCER_IDLE;
+  
+  while(waiting)
+  {
+    Announcement announcement = queue[0];
+    
+    waiting--;
+    for(uint8_t x = 0; x < waiting; x++) queue[x] = queue[x + 1];
+    
+    if(maxWait && (micros() - announcement.triggeredAt) / 1000 > maxWait)
+    {
+      dropped++;
+      continue;
+    }
+    
+    this->start(announcement);
+    return;
+  }
+}
+
+void JQ8400_Announcer::start(const Announcement &announcement)
+{
+  // Anything we were still asking about the last one is left for the engine to reclaim
+  current  = announcement;
+  request  = 0;
+  confirms = 0;
+  
+  if(mp3.shadowValid(MP3_SHADOW_SOURCE)) this->send();
+  else                                   this->ask(MP3_ANNOUNCER_SOURCE);
+}
+
+void JQ8400_Announcer::send()
+{
+  uint8_t data[3] = { (uint8_t)mp3.shadowValue(MP3_SHADOW_SOURCE), (uint8_t)(current.fileNumber >> 8), (uint8_t)(current.fileNumber & 0xFF) };
+  
+  state   = MP3_ANNOUNCER_SENDING;
+  request = mp3.queueCommand(JQ8400_Serial::MP3_CMD_INSERT_IDX, data, sizeof(data));
+  if(!request) return;
+  
+  // As interjectFileByIndexNumber(), once done the device returns to what it was playing
+  mp3.invalidateShadow(MP3_SHADOW_STATUS);
+  mp3.invalidateShadow(MP3_SHADOW_INDEX);
+  mp3.invalidateShadow(MP3_SHADOW_POSITION);
+}
+
+void JQ8400_Announcer::ask(uint8_t step)
+{
+  uint8_t command;
+  
+  switch(step)
+  {
+    case MP3_ANNOUNCER_SOURCE:  command = JQ8400_Serial::MP3_CMD_GET_SOURCE;       break;
+    case MP3_ANNOUNCER_LENGTH:  command = JQ8400_Serial::MP3_CMD_CURRENT_FILE_LEN; break;
+    case MP3_ANNOUNCER_STOPPED: command = JQ8400_Serial::MP3_CMD_STATUS;           break;
+    default:                    command = JQ8400_Serial::MP3_CMD_CURRENT_FILE_IDX; break;
+  }
+  
+  state   = step;
+  request = mp3.queueCommand(command, NULL, 0, true);
+}
+
+void JQ8400_Announcer::update()
+{
+  mp3.update();
+  
+  switch(state)
+  {
+    case MP3_ANNOUNCER_IDLE:
+      this->next();
+      return;
+      
+    case MP3_ANNOUNCER_SENDING:
+      if(!request) 
+      {
+        this->send();
+        return;
+      }
+      
+      // It expects no response, so is finished with once written
+      mp3.collectRequest(request);
+      if(request) return;
+      
+      sentAt       = millis();
+      latencyLast  = micros() - current.triggeredAt;
+      latencyTotal += latencyLast;
+      if(latencyLast > latencyMax) latencyMax = latencyLast;
+      started++;
+      
+      this->ask(MP3_ANNOUNCER_CONFIRM);
+      return;
+      
+    case MP3_ANNOUNCER_WAIT:
+      if((int32_t)(millis() - checkAt) >= 0) this->ask(MP3_ANNOUNCER_POLL);
+      return;
+  }
+  
+  // The other steps each ask something, again if the queue was full
+  if(!request)
+  {
+    this->ask(state);
+    return;
+  }
+  
+  uint8_t data[3];
+  uint8_t length;
+  uint8_t result = mp3.collectRequest(request, data, sizeof(data), &length);
+  if(!request) this->answered(result, data, length);
+}
+
+void JQ8400_Announcer::answered(uint8_t result, const uint8_t *data, uint8_t length)
+{
+  uint8_t  done  = result == MP3_REQUEST_DONE;
+  uint16_t index = (done && length >= 2) ? (data[0] << 8) | data[1] : 0;
+  
+  switch(state)
+  {
+    case MP3_ANNOUNCER_SOURCE:
+      // The response set the source in the shadow, without it we can't interject
+      if(done) 
+      {
+        this->send();
+        return;
+      }
+      dropped++;
+      this->next();
+      return;
+      
+    case MP3_ANNOUNCER_CONFIRM:
+      // It may take the device a moment to start
+      if(index != current.fileNumber && ++confirms < MP3_ANNOUNCER_CONFIRMS)
+      {
+        this->ask(MP3_ANNOUNCER_CONFIRM);
+        return;
+      }
+      this->ask(MP3_ANNOUNCER_LENGTH);
+      return;
+      
+    case MP3_ANNOUNCER_LENGTH:
+      if(done && length >= 3) checkAt = sentAt + ((data[0] * 60UL * 60) + (data[1] * 60) + data[2]) * 1000;
+      else                    checkAt = millis() + MP3_ANNOUNCE_POLL;
+      state = MP3_ANNOUNCER_WAIT;
+      return;
+      
+    case MP3_ANNOUNCER_POLL:
+      if(done && index != current.fileNumber)
+      {
+        this->next();
+        return;
+      }
+      
+      // Still the same file, but with nothing to go back to it may have stopped on it
+      if(done)
+      {
+        this->ask(MP3_ANNOUNCER_STOPPED);
+        return;
+      }
+      break;
+      
+    case MP3_ANNOUNCER_STOPPED:
+      if(done && length && data[0] == MP3_STATUS_STOPPED)
+      {
+        this->next();
+        return;
+      }
+      break;
+  }
+  
+  checkAt = millis() + MP3_ANNOUNCE_POLL;
+  state   = MP3_ANNOUNCER_WAIT;
+}
@@ -0,0 +1,217 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Announcer_h
+#define JQ8400Announcer_h
+
+#include "JQ8400_Serial.h"
+
+// Most announcements which can be waiting their turn
+#ifndef MP3_ANNOUNCE_QUEUE
+#define MP3_ANNOUNCE_QUEUE 8
+#endif
+
+// ms between checks of whether an announcement has finished, once it's length says it should have
+#ifndef MP3_ANNOUNCE_POLL
+#define MP3_ANNOUNCE_POLL 250
+#endif
+
+// Results of JQ8400_Announcer::announce()
+#define MP3_ANNOUNCE_DROPPED  0  // Not played, the queue is full of more important announcements
+#define MP3_ANNOUNCE_QUEUED   1  // Waiting for the announcement before it to finish
+#define MP3_ANNOUNCE_STARTED  2  // Going out now (possibly cutting off a less important one)
+
+/** Schedule announcements, interjections over whatever is playing (see 
+ *  JQ8400_Serial::interjectFileByIndexNumber()), so that they don't cut
+ *  each other off.
+ * 
+ * An announcement goes out straight away if nothing else is being announced
+ *  or what is has a lower priority (that one is then cut off and dropped),
+ *  otherwise it waits in a queue, in order of priority and then of arrival,
+ *  until the ones before it have finished.  When the queue is full the least
+ *  important announcement is dropped.
+ * 
+ * Everything goes through the asynchronous engine, announce() never waits.
+ *  The end of an announcement is found from it's length and the device's 
+ *  current index (during an interjection the track end events of 
+ *  JQ8400_Serial can't be relied on, the position jumps backward as it
+ *  starts and forward as the music resumes).
+ * 
+ * **Example**
+ * 
+ *     JQ8400_Serial    mp3(Serial2);
+ *     JQ8400_Announcer announcer(mp3);
+ *     
+ *     void loop()
+ *     {
+ *       announcer.update();
+ *       if(doorbell())  announcer.announce(DOORBELL_FILE, 1);
+ *       if(fireAlarm()) announcer.announce(FIRE_FILE, 9);
+ *     }
+ */
+
+class JQ8400_Announcer
+{
+  public:
+    
+    /** Create a scheduler for announcements on the given device.
+     * 
+     * @param mp3 The device.
+     */
+    
+    JQ8400_Announcer(JQ8400_Serial &_mp3) : mp3(_mp3) { }
+    
+    /** Make an announcement.
+     * 
+     * @param fileNumber FAT index of the file to interject.
+     * @param priority   Higher is more important, a higher priority cuts off a lower.
+     * @return MP3_ANNOUNCE_STARTED, MP3_ANNOUNCE_QUEUED, or MP3_ANNOUNCE_DROPPED
+     */
+    
+    uint8_t announce(uint16_t fileNumber, uint8_t priority = 0);
+    
+    /** Drop announcements which have waited longer than this before their turn came.
+     * 
+     * @param ms Longest wait, 0 (default) to wait forever.
+     */
+    
+    void setMaxWait(uint16_t ms) { maxWait = ms; }
+    
+    /** Forget every waiting announcement (the one playing carries on). */
+    
+    void clear() { waiting = 0; }
+    
+    /** Advance the scheduler, and the device's asynchronous engine, call this 
+     *  frequently from your `loop()`.  Never waits.
+     */
+    
+    void update();
+    
+    /** @return FAT index of the announcement going out (or playing), 0 if none. */
+    
+    uint16_t playing() { return state == MP3_ANNOUNCER_IDLE ? 0 : current.fileNumber; }
+    
+    /** @return Number of announcements waiting. */
+    
+    uint8_t  queued()  { return waiting; }
+    
+    /** @name Statistics
+     * 
+     * The latency is from announce() to the interjection being written to the
+     *  device, including any time spent waiting in the queue (the device itself 
+     *  takes a few ms more to start playing).
+     */
+    ///@{
+    
+    uint32_t lastLatency()    { return latencyLast; }                                   ///< Latency (us) of the last announcement
+    uint32_t maxLatency()     { return latencyMax; }                                    ///< Worst latency (us)
+    uint32_t averageLatency() { return started ? latencyTotal / started : 0; }          ///< Average latency (us)
+    uint16_t countStarted()   { return started; }                                       ///< Announcements which went out
+    uint16_t countDropped()   { return dropped; }                                       ///< Announcements dropped, or cut off
+    
+    /** Zero the statistics. */
+    
+    void resetStats() { latencyLast = latencyMax = latencyTotal = 0; started = dropped = 0; }
+    
+    ///@}
+    
+  protected:
+    
+    static const uint8_t MP3_ANNOUNCER_IDLE    = 0;  ///< Nothing being announced
+    static const uint8_t MP3_ANNOUNCER_SOURCE  = 1;  ///< Asking for the source, the interjection needs it
+    static const uint8_t MP3_ANNOUNCER_SENDING = 2;  ///< Interjection queued, waiting for it to be sent
+    static const uint8_t MP3_ANNOUNCER_CONFIRM = 3;  ///< Asking the index, to see it started
+    static const uint8_t MP3_ANNOUNCER_LENGTH  = 4;  ///< Asking the length, to know when it will end
+    static const uint8_t MP3_ANNOUNCER_WAIT    = 5;  ///< Waiting until it should have ended
+    static const uint8_t MP3_ANNOUNCER_POLL    = 6;  ///< Asking the index, to see it ended
+    static const uint8_t MP3_ANNOUNCER_STOPPED = 7;  ///< Still the same index, asking the status in case it ended with nothing to return to
+    
+    static const uint8_t MP3_ANNOUNCER_CONFIRMS = 3; ///< Index checks for the start before going on regardless
+    
+    /** An announcement. */
+    
+    struct Announcement
+    {
+      uint16_t fileNumber;   ///< FAT index of the file
+      uint8_t  priority;     ///< Higher first
+      uint32_t triggeredAt;  ///< micros() announce() was called
+    };
+    
+    /** Start the next waiting announcement, if any. */
+    
+    void next();
+    
+    /** Start an announcement, now.
+     * 
+     * @param announcement What to announce.
+     */
+    
+    void start(const Announcement &announcement);
+    
+    /** Queue the interjection of the current announcement. */
+    
+    void send();
+    
+    /** Queue the query of a step, and move to that step.
+     * 
+     * If the queue is full, update() tries again.
+     * 
+     * @param step One of the MP3_ANNOUNCER_* which asks something
+     */
+    
+    void ask(uint8_t step);
+    
+    /** Take the answer to the step's query and move on.
+     * 
+     * @param result MP3_REQUEST_*
+     * @param data   Response data
+     * @param length Number of bytes
+     */
+    
+    void answered(uint8_t result, const uint8_t *data, uint8_t length);
+    
+    JQ8400_Serial &mp3;                             ///< The device
+    
+    Announcement queue[MP3_ANNOUNCE_QUEUE];         ///< Waiting announcements, most important (then oldest) first
+    uint8_t      waiting      = 0;                  ///< Number of announcements in the queue
+    Announcement current;                           ///< The announcement going out or playing
+    uint8_t      state        = MP3_ANNOUNCER_IDLE; ///< MP3_ANNOUNCER_*
+    uint8_t      request      = 0;                  ///< Handle of our request in the engine, 0 if none
+    uint8_t      confirms     = 0;                  ///< Index checks made for the start
+    uint32_t     sentAt       = 0;                  ///< millis() the interjection was sent
+    uint32_t     checkAt      = 0;                  ///< millis() to next check for the end
+    uint16_t     maxWait      = 0;                  ///< See setMaxWait()
+    
+    uint32_t     latencyLast  = 0;                  ///< See lastLatency()
+    uint32_t     latencyMax   = 0;                  ///< See maxLatency()
+    uint32_t     latencyTotal = 0;                  ///< Sum of the latencies, for averageLatency()
+    uint16_t     started      = 0;                  ///< See countStarted()
+    uint16_t     dropped      = 0;                  ///< See countDropped()
+};
+
+#endif
@@ -0,0 +1,149 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "JQ8400_AvrUart.h"
+
+#if defined(__AVR__)
+
+void JQ8400_AvrUart::begin(uint32_t baud)
+{
+  // As HardwareSerial, double speed unless the rate is too low for it
+  uint16_t setting = (F_CPU / 4 / baud - 1) / 2;
+  *ucsra = 1 << U2X0;
+  
+  if(setting > 4095)
+  {
+    *ucsra  = 0;
+    setting = (F_CPU / 8 / baud - 1) / 2;
+  }
+  
+  *ubrrh = setting >> 8;
+  *ubrrl = setting;
+  *ucsrc = (1 << UCSZ01) | (1 << UCSZ00);
+  
+  rxHead = rxTail = 0;
+  txHead = txTail = 0;
+  written = 0;
+  
+  *ucsrb = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
+}
+
+void JQ8400_AvrUart::end()
+{
+  this->flush();
+  *ucsrb &= ~((1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0) | (1 << UDRIE0));
+  rxHead = rxTail = 0;
+}
+
+int JQ8400_AvrUart::available()
+{
+  return (rxHead - rxTail) & (MP3_UART_RX_BUFFER - 1);
+}
+
+int JQ8400_AvrUart::peek()
+{
+  if(rxHead == rxTail) return -1;
+  return rxBuffer[rxTail];
+}
+
+int JQ8400_AvrUart::read()
+{
+  if(rxHead == rxTail) return -1;
+  
+  uint8_t c = rxBuffer[rxTail];
+  rxTail    = (rxTail + 1) & (MP3_UART_RX_BUFFER - 1);
+  return c;
+}
+
+int JQ8400_AvrUart::availableForWrite()
+{
+  return (MP3_UART_TX_BUFFER - 1) - ((txHead - txTail) & (MP3_UART_TX_BUFFER - 1));
+}
+
+size_t JQ8400_AvrUart::write(uint8_t c)
+{
+  written = 1;
+  
+  // Straight into the USART if nothing is waiting ahead of it
+  if(txHead == txTail && (*ucsra & (1 << UDRE0)))
+  {
+    *udr   = c;
+    *ucsra = (*ucsra & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+    return 1;
+  }
+  
+  uint8_t next = (txHead + 1) & (MP3_UART_TX_BUFFER - 1);
+  
+  // Full, wait for the interrupt to make room, or make it ourselves if interrupts are off
+  while(next == txTail)
+  {
+    if(!(SREG & (1 << SREG_I)) && (*ucsra & (1 << UDRE0))) this->transmit();
+  }
+  
+  txBuffer[txHead] = c;
+  txHead           = next;
+  *ucsrb |= 1 << UDRIE0;
+  
+  return 1;
+}
+
+size_t JQ8400_AvrUart::write(const uint8_t *buffer, size_t size)
+{
+  for(size_t x = 0; x < size; x++) this->write(buffer[x]);
+  return size;
+}
+
+void JQ8400_AvrUart::flush()
+{
+  if(!written) return;
+  
+  while((*ucsrb & (1 << UDRIE0)) || !(*ucsra & (1 << TXC0)))
+  {
+    if(!(SREG & (1 << SREG_I)) && (*ucsrb & (1 << UDRIE0)) && (*ucsra & (1 << UDRE0))) this->transmit();
+  }
+}
+
+uint16_t JQ8400_AvrUart::overflows()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t count = rxOverflows;
+  SREG = sreg;
+  return count;
+}
+
+uint16_t JQ8400_AvrUart::overruns()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t count = rxOverruns;
+  SREG = sreg;
+  return count;
+}
+
+#endif
@@ -0,0 +1,206 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400AvrUart_h
+#define JQ8400AvrUart_h
+
+#if defined(__AVR__)
+
+#include <Arduino.h>
+#include <avr/interrupt.h>
+
+// Bytes received and not yet read, must be a power of 2 (at most 128)
+#ifndef MP3_UART_RX_BUFFER
+#define MP3_UART_RX_BUFFER 64
+#endif
+
+// Bytes written and not yet sent, must be a power of 2 (at most 128)
+#ifndef MP3_UART_TX_BUFFER
+#define MP3_UART_TX_BUFFER 32
+#endif
+
+#if (MP3_UART_RX_BUFFER & (MP3_UART_RX_BUFFER - 1)) || MP3_UART_RX_BUFFER > 128
+#error MP3_UART_RX_BUFFER must be a power of 2, at most 128
+#endif
+
+#if (MP3_UART_TX_BUFFER & (MP3_UART_TX_BUFFER - 1)) || MP3_UART_TX_BUFFER > 128
+#error MP3_UART_TX_BUFFER must be a power of 2, at most 128
+#endif
+
+// The ATmega328P and friends have one USART and leave the number off it's vectors
+#if !defined(USART0_RX_vect) && defined(USART_RX_vect)
+#define USART0_RX_vect   USART_RX_vect
+#define USART0_UDRE_vect USART_UDRE_vect
+#endif
+
+/** Create a JQ8400_AvrUart on USART number n, and the interrupt handlers 
+ *  which feed it.  Use once, at file scope, in your sketch.
+ * 
+ *     MP3_AVR_USART(mp3Uart, 1);
+ * 
+ * The USART is then ours, `Serial` (or `Serial1`... whichever is USART n)
+ *  must not be used, or there will be two handlers for the same interrupt.
+ */
+
+#define MP3_AVR_USART(name, n) \
+  JQ8400_AvrUart name(&UBRR##n##H, &UBRR##n##L, &UCSR##n##A, &UCSR##n##B, &UCSR##n##C, &UDR##n); \
+  ISR(USART##n##_RX_vect)   { name.received(); } \
+  ISR(USART##n##_UDRE_vect) { name.transmit(); }
+
+/** A Stream on one of the AVR's USARTs, for JQ8400_Serial to use in place of 
+ *  HardwareSerial or SoftwareSerial.
+ * 
+ * The receive interrupt puts each byte in a ring (MP3_UART_RX_BUFFER), which
+ *  the frame parser reads, and the transmit interrupt sends from another 
+ *  (MP3_UART_TX_BUFFER).  Each ring has one writer and one reader, with 
+ *  8 bit indexes, so neither side ever disables interrupts.  Unlike 
+ *  SoftwareSerial nothing waits out the bits of a byte, receiving costs
+ *  a few us per byte in the interrupt.
+ * 
+ * Bytes which arrive while the ring is full are counted (see overflows()),
+ *  as are bytes the USART lost because we were too slow to take them 
+ *  from it (overruns()).
+ * 
+ * Create it with MP3_AVR_USART() which also creates the interrupt handlers.
+ * 
+ * **Example**
+ * 
+ *     #include <JQ8400_Serial.h>
+ *     #include <JQ8400_AvrUart.h>
+ *     
+ *     MP3_AVR_USART(mp3Uart, 1);
+ *     JQ8400_Serial mp3(mp3Uart);
+ *     
+ *     void setup()
+ *     {
+ *       mp3Uart.begin(9600);
+ *       mp3.reset();
+ *     }
+ */
+
+class JQ8400_AvrUart : public Stream
+{
+  public:
+    
+    /** Use MP3_AVR_USART() rather than this directly.
+     * 
+     * @param ubrrh, ubrrl, ucsra, ucsrb, ucsrc, udr The USART's registers
+     */
+    
+    JQ8400_AvrUart(volatile uint8_t *ubrrh, volatile uint8_t *ubrrl, volatile uint8_t *ucsra, volatile uint8_t *ucsrb, volatile uint8_t *ucsrc, volatile uint8_t *udr)
+      : ubrrh(ubrrh), ubrrl(ubrrl), ucsra(ucsra), ucsrb(ucsrb), ucsrc(ucsrc), udr(udr) { }
+    
+    /** Start the USART, 8 data bits, no parity, 1 stop bit.
+     * 
+     * @param baud Rate, 9600 for the JQ8400.
+     */
+    
+    void begin(uint32_t baud);
+    
+    /** Stop the USART, once everything written has gone. */
+    
+    void end();
+    
+    virtual int    available();
+    virtual int    peek();
+    virtual int    read();
+    virtual int    availableForWrite();
+    virtual void   flush();
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    
+    /** @return Bytes dropped because the receive ring was full. */
+    
+    uint16_t overflows();
+    
+    /** @return Bytes the USART lost before we took them (data overrun). */
+    
+    uint16_t overruns();
+    
+    /** Take a byte from the USART, called by the receive interrupt. */
+    
+    inline void received()
+    {
+      uint8_t status = *ucsra;
+      uint8_t c      = *udr;
+      uint8_t next   = (rxHead + 1) & (MP3_UART_RX_BUFFER - 1);
+      
+      if(status & (1 << DOR0)) rxOverruns++;
+      
+      if(next == rxTail)
+      {
+        rxOverflows++;
+        return;
+      }
+      
+      rxBuffer[rxHead] = c;
+      rxHead           = next;
+    }
+    
+    /** Give the USART a byte, called by the data register empty interrupt. */
+    
+    inline void transmit()
+    {
+      if(txHead == txTail)
+      {
+        *ucsrb &= ~(1 << UDRIE0);
+        return;
+      }
+      
+      *udr   = txBuffer[txTail];
+      txTail = (txTail + 1) & (MP3_UART_TX_BUFFER - 1);
+      
+      // Clear the transmit complete flag (by writing a 1 to it) for flush()
+      *ucsra = (*ucsra & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+    }
+    
+  protected:
+    
+    volatile uint8_t * const ubrrh;                       ///< Baud rate, high
+    volatile uint8_t * const ubrrl;                       ///< Baud rate, low
+    volatile uint8_t * const ucsra;                       ///< Control and status A
+    volatile uint8_t * const ucsrb;                       ///< Control and status B
+    volatile uint8_t * const ucsrc;                       ///< Control and status C
+    volatile uint8_t * const udr;                         ///< Data
+    
+    uint8_t           rxBuffer[MP3_UART_RX_BUFFER];       ///< Received bytes
+    volatile uint8_t  rxHead      = 0;                    ///< Where the interrupt puts the next byte
+    volatile uint8_t  rxTail      = 0;                    ///< Where read() takes the next byte
+    volatile uint16_t rxOverflows = 0;                    ///< See overflows()
+    volatile uint16_t rxOverruns  = 0;                    ///< See overruns()
+    
+    uint8_t           txBuffer[MP3_UART_TX_BUFFER];       ///< Bytes to send
+    volatile uint8_t  txHead      = 0;                    ///< Where write() puts the next byte
+    volatile uint8_t  txTail      = 0;                    ///< Where the interrupt takes the next byte
+    uint8_t           written     = 0;                    ///< Anything sent since begin(), for flush()
+};
+
+#endif
+
+#endif
@@ -0,0 +1,345 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "JQ8400_Catalog.h"
+
+void JQ8400_Catalog::build()
+{
+  if(state != MP3_CATALOG_EMPTY && state != MP3_CATALOG_FAILED) return;
+  
+  state      = MP3_CATALOG_COUNTING;
+  step       = 0;
+  failures   = 0;
+  seekedTo   = 0;
+  folders    = 0;
+  foldersEnd = 0;
+  namesKnown = 0;
+  isSaved    = false;
+}
+
+void JQ8400_Catalog::clear()
+{
+  // A query in flight is simply left to be reclaimed by the engine
+  request    = 0;
+  state      = MP3_CATALOG_EMPTY;
+  files      = 0;
+  folders    = 0;
+  foldersEnd = 0;
+  namesKnown = 0;
+  isSaved    = false;
+}
+
+void JQ8400_Catalog::update()
+{
+  mp3.update();
+  
+  if(state < MP3_CATALOG_COUNTING || state > MP3_CATALOG_NAME_WALK) return;
+  
+  if(request)
+  {
+    uint8_t result = mp3.requestState(request);
+    if(result != MP3_REQUEST_UNKNOWN && result < MP3_REQUEST_DONE) return;
+    
+    uint8_t data[MP3_CATALOG_NAME_LENGTH];
+    uint8_t length = mp3.requestResponse(request, data, sizeof(data));
+    request = 0;
+    
+    if(result != MP3_REQUEST_DONE)
+    {
+      // Ask again, unless it keeps happening
+      if(++failures >= MP3_CATALOG_ATTEMPTS) 
+      {
+        state = MP3_CATALOG_FAILED;
+        return;
+      }
+    }
+    else
+    {
+      failures = 0;
+      this->answered(data, length);
+    }
+  }
+  
+  if(state >= MP3_CATALOG_COUNTING && state <= MP3_CATALOG_NAME_WALK) this->ask();
+}
+
+uint8_t JQ8400_Catalog::ask()
+{
+  uint8_t command;
+  
+  switch(state)
+  {
+    case MP3_CATALOG_COUNTING:
+      command = step ? JQ8400_Serial::MP3_CMD_COUNT_FILES : JQ8400_Serial::MP3_CMD_GET_SOURCE;
+      break;
+      
+    case MP3_CATALOG_FOLDER_WALK:
+      // The device answers about the folder of the selected file
+      if(!this->seek(cursor)) return false;
+      command = step ? JQ8400_Serial::MP3_CMD_COUNT_IN_FOLDER : JQ8400_Serial::MP3_CMD_FIRST_FILE_IN_FOLDER_IDX;
+      break;
+      
+    default: // MP3_CATALOG_NAME_WALK
+      if(!this->seek(cursor)) return false;
+      command = JQ8400_Serial::MP3_CMD_CURRENT_FILE_NAME;
+      break;
+  }
+  
+  request = mp3.queueCommand(command, NULL, 0, true);
+  return request != 0;
+}
+
+uint8_t JQ8400_Catalog::seek(uint16_t fileNumber)
+{
+  if(seekedTo == fileNumber) return true;
+  
+  uint8_t data[2] = { (uint8_t)(fileNumber >> 8), (uint8_t)(fileNumber & 0xFF) };
+  if(!mp3.queueCommand(JQ8400_Serial::MP3_CMD_SEEK_IDX, data, sizeof(data))) return false;
+  
+  // As seekFileByIndexNumber() would, whatever was playing isn't any more
+  mp3.trackChanging();
+  seekedTo = fileNumber;
+  
+  return true;
+}
+
+void JQ8400_Catalog::answered(const uint8_t *data, uint8_t length)
+{
+  uint16_t number = length >= 2 ? (data[0] << 8) | data[1] : (length ? data[0] : 0);
+  
+  switch(state)
+  {
+    case MP3_CATALOG_COUNTING:
+      if(!step)
+      {
+        source = number;
+        step   = 1;
+        return;
+      }
+      
+      files  = number;
+      cursor = 1;
+      step   = 0;
+      state  = MP3_CATALOG_FOLDER_WALK;
+      
+      if(!files) this->foldersDone();
+      return;
+      
+    case MP3_CATALOG_FOLDER_WALK:
+      if(!step)
+      {
+        // Not a first file we can believe, take the one we asked about
+        pendingFirst = (number && number <= cursor) ? number : cursor;
+        step         = 1;
+        return;
+      }
+      
+      // An empty folder can't have a file of ours in it, count it as one so we move on
+      if(!number) number = 1;
+      
+      folderFirst[folders++] = pendingFirst;
+      foldersEnd = pendingFirst + number;
+      cursor     = foldersEnd;
+      step       = 0;
+      
+      if(cursor > files || folders >= MP3_CATALOG_FOLDERS) this->foldersDone();
+      return;
+      
+    case MP3_CATALOG_NAME_WALK:
+    {
+      char *name = names + (cursor - 1) * MP3_CATALOG_NAME_LENGTH;
+      
+      memset(name, ' ', MP3_CATALOG_NAME_LENGTH);
+      memcpy(name, data, length < MP3_CATALOG_NAME_LENGTH ? length : MP3_CATALOG_NAME_LENGTH);
+      
+      namesKnown = cursor++;
+      if(cursor > files || cursor > nameCapacity) state = MP3_CATALOG_READY;
+    }
+    return;
+  }
+}
+
+void JQ8400_Catalog::foldersDone()
+{
+  cursor = 1;
+  step   = 0;
+  state  = (files && nameCapacity) ? MP3_CATALOG_NAME_WALK : MP3_CATALOG_READY;
+}
+
+uint16_t JQ8400_Catalog::countFiles()
+{
+  this->build();
+  return state > MP3_CATALOG_COUNTING ? files : 0;
+}
+
+uint8_t JQ8400_Catalog::countFolders()
+{
+  this->build();
+  return folders;
+}
+
+uint16_t JQ8400_Catalog::firstFileInFolder(uint8_t folder)
+{
+  if(!folder || folder > this->countFolders()) return 0;
+  return folderFirst[folder - 1];
+}
+
+uint16_t JQ8400_Catalog::countFilesInFolder(uint8_t folder)
+{
+  if(!folder || folder > this->countFolders()) return 0;
+  return (folder < folders ? folderFirst[folder] : foldersEnd) - folderFirst[folder - 1];
+}
+
+uint8_t JQ8400_Catalog::folderOfFile(uint16_t fileNumber)
+{
+  if(!fileNumber || fileNumber >= foldersEnd || !this->countFolders()) return 0;
+  
+  // The folders are in order of their first file, find the last starting at or before
+  uint8_t low  = 0;
+  uint8_t high = folders;
+  
+  while(high - low > 1)
+  {
+    uint8_t middle = (low + high) / 2;
+    if(folderFirst[middle] <= fileNumber) low  = middle;
+    else                                  high = middle;
+  }
+  
+  return folderFirst[low] <= fileNumber ? low + 1 : 0;
+}
+
+uint8_t JQ8400_Catalog::fileName(uint16_t fileNumber, char *buffer, uint8_t bufferLength)
+{
+  if(!bufferLength) return false;
+  buffer[0] = 0;
+  
+  this->build();
+  if(!fileNumber || fileNumber > namesKnown) return false;
+  
+  uint8_t length = bufferLength - 1 < MP3_CATALOG_NAME_LENGTH ? bufferLength - 1 : MP3_CATALOG_NAME_LENGTH;
+  memcpy(buffer, names + (fileNumber - 1) * MP3_CATALOG_NAME_LENGTH, length);
+  buffer[length] = 0;
+  
+  return true;
+}
+
+uint16_t JQ8400_Catalog::storageSize()
+{
+  return MP3_CATALOG_HEADER + folders * 2 + namesKnown * MP3_CATALOG_NAME_LENGTH;
+}
+
+// EEPROM.update() is AVR only, and the ESP32's EEPROM needs committing after
+static void storeByte(uint16_t address, uint8_t value)
+{
+  if(EEPROM.read(address) != value) EEPROM.write(address, value);
+}
+
+static uint8_t reserveEeprom(uint16_t size)
+{
+#if defined(ESP32)
+  // Kept in NVS, and only as big as the sketch began it
+  if(EEPROM.length() < size) return EEPROM.begin(size);
+#endif
+  return EEPROM.length() >= size;
+}
+
+uint8_t JQ8400_Catalog::save(uint16_t address)
+{
+  if(!this->ready() || !reserveEeprom(address + this->storageSize())) return false;
+  
+  uint8_t header[MP3_CATALOG_HEADER] = {
+    MP3_CATALOG_MAGIC, MP3_CATALOG_VERSION, source,
+    (uint8_t)(files >> 8),      (uint8_t)(files & 0xFF),
+    folders,
+    (uint8_t)(foldersEnd >> 8), (uint8_t)(foldersEnd & 0xFF),
+    (uint8_t)(namesKnown >> 8), (uint8_t)(namesKnown & 0xFF)
+  };
+  
+  for(uint8_t x = 0; x < sizeof(header); x++) storeByte(address++, header[x]);
+  
+  for(uint8_t x = 0; x < folders; x++)
+  {
+    storeByte(address++, folderFirst[x] >> 8);
+    storeByte(address++, folderFirst[x] & 0xFF);
+  }
+  
+  for(uint16_t x = 0; x < namesKnown * MP3_CATALOG_NAME_LENGTH; x++) storeByte(address++, names[x]);
+  
+#if defined(ESP32)
+  EEPROM.commit();
+#endif
+  
+  isSaved = true;
+  return true;
+}
+
+uint8_t JQ8400_Catalog::load(uint16_t address)
+{
+  if(!reserveEeprom(address + MP3_CATALOG_HEADER)) return false;
+  
+  uint8_t header[MP3_CATALOG_HEADER];
+  for(uint8_t x = 0; x < sizeof(header); x++) header[x] = EEPROM.read(address + x);
+  
+  uint16_t savedFiles = (header[3] << 8) | header[4];
+  uint16_t savedNames = (header[8] << 8) | header[9];
+  
+  if(header[0] != MP3_CATALOG_MAGIC || header[1] != MP3_CATALOG_VERSION) return false;
+  if(header[5] > MP3_CATALOG_FOLDERS) return false;
+  
+  // Saved with fewer names than we could keep now, better to build it again, 
+  //  saved with more, we just take what we have room for
+  uint16_t wantNames = savedFiles < nameCapacity ? savedFiles : nameCapacity;
+  if(savedNames < wantNames) return false;
+  
+  if(!reserveEeprom(address + MP3_CATALOG_HEADER + header[5] * 2 + savedNames * MP3_CATALOG_NAME_LENGTH)) return false;
+  
+  // Is it the same media?
+  if(mp3.getSource() != header[2] || mp3.countFiles() != savedFiles) return false;
+  
+  request    = 0;
+  source     = header[2];
+  files      = savedFiles;
+  folders    = header[5];
+  foldersEnd = (header[6] << 8) | header[7];
+  namesKnown = wantNames;
+  address   += MP3_CATALOG_HEADER;
+  
+  for(uint8_t x = 0; x < folders; x++, address += 2)
+  {
+    folderFirst[x] = (EEPROM.read(address) << 8) | EEPROM.read(address + 1);
+  }
+  
+  for(uint16_t x = 0; x < namesKnown * MP3_CATALOG_NAME_LENGTH; x++) names[x] = EEPROM.read(address++);
+  
+  state   = MP3_CATALOG_READY;
+  isSaved = true;
+  
+  return true;
+}
@@ -0,0 +1,290 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Catalog_h
+#define JQ8400Catalog_h
+
+#include "JQ8400_Serial.h"
+
+// Most folders the catalog can hold, 2 bytes of RAM each
+#ifndef MP3_CATALOG_FOLDERS
+#define MP3_CATALOG_FOLDERS 32
+#endif
+
+// Bytes of each name kept
+#define MP3_CATALOG_NAME_LENGTH MP3_NAME_LENGTH
+
+/** An index of the media on a JQ8400: the folders (in FAT order) with the 
+ *  first file index and number of files of each, and optionally the name 
+ *  of every file.
+ * 
+ * Each of those facts is a round trip to the device, so a menu of folders
+ * and tracks takes a long time to build by asking as it's needed.  The 
+ * catalog instead builds the whole index in the background, through the 
+ * asynchronous engine, as `update()` is called, starting the first time 
+ * anything is asked of it (or `build()` is called).  Until then the answers
+ * are 0 (unknown), `ready()` says when it is complete.
+ * 
+ * The complete index can be saved to EEPROM (which on the ESP32 is kept
+ * in NVS) and loaded on the next boot, it is only used if the source and 
+ * number of files on the media are unchanged.
+ * 
+ * The device can only tell us about the folder of the selected file, so 
+ * building the index seeks from folder to folder (and file to file for the 
+ * names), which stops anything playing.  Build it at startup or while idle,
+ * and don't send other commands until it is ready.
+ * 
+ * **Example**
+ * 
+ *     JQ8400_Serial  mp3(Serial2);
+ *     JQ8400_Catalog catalog(mp3);
+ *     
+ *     void setup()
+ *     {
+ *       Serial2.begin(9600);
+ *       mp3.reset();
+ *       if(!catalog.load(0)) catalog.build();
+ *     }
+ *     
+ *     void loop()
+ *     {
+ *       catalog.update();
+ *       if(catalog.ready() && !catalog.saved()) catalog.save(0);
+ *     }
+ */
+
+class JQ8400_Catalog
+{
+  public:
+    
+    /** Create a catalog of the media in the given device.
+     * 
+     * @param mp3 The device.
+     */
+    
+    JQ8400_Catalog(JQ8400_Serial &_mp3) : mp3(_mp3) { }
+    
+    /** Give the catalog somewhere to keep the file names, without this only 
+     *  the folders are indexed.
+     * 
+     * Call before building (or loading) the catalog.
+     * 
+     * @param buffer   MP3_CATALOG_NAME_LENGTH bytes for each file
+     * @param files    Number of files the buffer can hold, names of files beyond this are not kept
+     */
+    
+    void setNameStorage(char *buffer, uint16_t files) { names = buffer; nameCapacity = buffer ? files : 0; }
+    
+    /** Start building the catalog, if it isn't already built or building.
+     * 
+     * The building happens in `update()`.
+     */
+    
+    void build();
+    
+    /** Forget the catalog, for example after changing the source.  It is
+     *  built again when next needed.
+     */
+    
+    void clear();
+    
+    /** Advance the build, and the device's asynchronous engine, call this 
+     *  frequently from your `loop()`.  Never waits.
+     */
+    
+    void update();
+    
+    /** Is the catalog complete?
+     * 
+     * @return bool
+     */
+    
+    uint8_t ready() { return state == MP3_CATALOG_READY; }
+    
+    /** Did the build give up because the device stopped answering?
+     * 
+     * @return bool, build() again to retry.
+     */
+    
+    uint8_t failed() { return state == MP3_CATALOG_FAILED; }
+    
+    /** Has the complete catalog been saved (or loaded) since it was built?
+     * 
+     * @return bool
+     */
+    
+    uint8_t saved()  { return isSaved; }
+    
+    /** @name Questions
+     * 
+     * These start the build if it hasn't started, and until it has got that
+     *  far, return 0.
+     */
+    ///@{
+    
+    /** @return Number of files on the media. */
+    
+    uint16_t countFiles();
+    
+    /** @return Number of folders known so far, at most MP3_CATALOG_FOLDERS. */
+    
+    uint8_t  countFolders();
+    
+    /** First file in a folder.
+     * 
+     * @param folder From 1, in FAT order
+     * @return FAT index of the first file in the folder
+     */
+    
+    uint16_t firstFileInFolder(uint8_t folder);
+    
+    /** Number of files in a folder. 
+     * 
+     * @param folder From 1, in FAT order
+     * @return Number of files
+     */
+    
+    uint16_t countFilesInFolder(uint8_t folder);
+    
+    /** Which folder a file is in. 
+     * 
+     * @param fileNumber FAT index of the file
+     * @return Folder from 1, in FAT order
+     */
+    
+    uint8_t  folderOfFile(uint16_t fileNumber);
+    
+    /** Get the name of a file, as currentFileName() would when it plays.
+     * 
+     * @param fileNumber   FAT index of the file
+     * @param buffer       Where to put the (NUL terminated) name
+     * @param bufferLength Size of the buffer, MP3_CATALOG_NAME_LENGTH + 1 for the whole name
+     * @return False if the name is not (yet) known, the buffer is then an empty string.
+     */
+    
+    uint8_t  fileName(uint16_t fileNumber, char *buffer, uint8_t bufferLength);
+    
+    ///@}
+    
+    /** @name Persistence
+     * 
+     */
+    ///@{
+    
+    /** Bytes of EEPROM save() needs.
+     * 
+     * @return 10 bytes, plus 2 for each folder, plus MP3_CATALOG_NAME_LENGTH for each name kept.
+     */
+    
+    uint16_t storageSize();
+    
+    /** Save the complete catalog to EEPROM.
+     * 
+     * Only bytes which differ are written.
+     * 
+     * @param address First byte of EEPROM to use.
+     * @return False if the catalog isn't ready or the EEPROM is too small.
+     */
+    
+    uint8_t save(uint16_t address);
+    
+    /** Load a saved catalog from EEPROM, if it is for the media in the device.
+     * 
+     * Asks the device for it's source and number of files (blocking) to compare.
+     * 
+     * @param address First byte of EEPROM used by save()
+     * @return True if the catalog was loaded and is ready.
+     */
+    
+    uint8_t load(uint16_t address);
+    
+    ///@}
+    
+  protected:
+    
+    static const uint8_t MP3_CATALOG_EMPTY       = 0;  ///< Nothing known, nor asked
+    static const uint8_t MP3_CATALOG_COUNTING    = 1;  ///< Asking for the source and number of files
+    static const uint8_t MP3_CATALOG_FOLDER_WALK = 2;  ///< Seeking from folder to folder
+    static const uint8_t MP3_CATALOG_NAME_WALK   = 3;  ///< Seeking from file to file for their names
+    static const uint8_t MP3_CATALOG_READY       = 4;  ///< Complete
+    static const uint8_t MP3_CATALOG_FAILED      = 5;  ///< The device stopped answering
+    
+    static const uint8_t MP3_CATALOG_MAGIC    = 0xC7;  ///< First byte of a saved catalog
+    static const uint8_t MP3_CATALOG_VERSION  = 1;     ///< Second byte, the layout
+    static const uint8_t MP3_CATALOG_HEADER   = 10;    ///< Bytes before the folders
+    static const uint8_t MP3_CATALOG_ATTEMPTS = 3;     ///< Failed queries in a row (each already retried by the engine) before giving up
+    
+    /** Queue the query (and seek) for the current step.
+     * 
+     * @return False if the queue was full, try again next update().
+     */
+    
+    uint8_t ask();
+    
+    /** Take the answer to the current step and move on.
+     * 
+     * @param data   Response data
+     * @param length Number of bytes
+     */
+    
+    void answered(const uint8_t *data, uint8_t length);
+    
+    /** Move to the names, or finish, once the folders are known. */
+    
+    void foldersDone();
+    
+    /** Queue a seek to a file, so the device can tell us about it.
+     * 
+     * @return False if the queue was full.
+     */
+    
+    uint8_t seek(uint16_t fileNumber);
+    
+    JQ8400_Serial &mp3;                                ///< The device
+    
+    uint8_t   state        = MP3_CATALOG_EMPTY;        ///< MP3_CATALOG_*
+    uint8_t   isSaved      = false;                    ///< See saved()
+    uint8_t   request      = 0;                        ///< Handle of the query in flight, 0 if none
+    uint8_t   step         = 0;                        ///< Which query of the state we are on
+    uint8_t   failures     = 0;                        ///< Consecutive failed queries
+    uint16_t  cursor       = 0;                        ///< File the current step is about
+    uint16_t  seekedTo     = 0;                        ///< File the device was last seeked to by us, 0 if none
+    
+    uint8_t   source       = 0;                        ///< Source the catalog is of
+    uint16_t  files        = 0;                        ///< Number of files on the media
+    uint8_t   folders      = 0;                        ///< Number of folders known
+    uint16_t  folderFirst[MP3_CATALOG_FOLDERS];        ///< First file index of each folder, the count is up to the next one
+    uint16_t  foldersEnd   = 0;                        ///< File just after the last known folder
+    uint16_t  pendingFirst = 0;                        ///< First file of the folder being asked about
+    
+    char     *names        = NULL;                     ///< See setNameStorage()
+    uint16_t  nameCapacity = 0;                        ///< Files names has room for
+    uint16_t  namesKnown   = 0;                        ///< Names 1 to this have been filled in
+};
+
+#endif
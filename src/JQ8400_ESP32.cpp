@@ -0,0 +1,227 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#include <Arduino.h>
+#include "JQ8400_ESP32.h"
+
+#if defined(ESP32)
+
+bool JQ8400_ESP32::begin(uint32_t stackSize, UBaseType_t priority, BaseType_t core)
+{
+  if(messages) return true;
+  
+  memset(futureRequest, 0, sizeof(futureRequest));
+  
+  messages = xQueueCreate(MP3_TASK_QUEUE_LENGTH, sizeof(Message));
+  if(!messages) return false;
+  
+  // From here on only our task touches the device, commands that need no
+  //  response are queued so the task never blocks in them
+  mp3.setUserData(this);
+  mp3.setAsync(true);
+  
+  if(xTaskCreatePinnedToCore(task, "JQ8400", stackSize, this, priority, &taskHandle, core) != pdPASS)
+  {
+    vQueueDelete(messages);
+    messages = NULL;
+    return false;
+  }
+  
+  return true;
+}
+
+bool JQ8400_ESP32::run(JQ8400_TaskFunction function, uint16_t arg, TickType_t wait)
+{
+  if(!messages) return false;
+  
+  Message message;
+  message.type     = MP3_TASK_RUN;
+  message.function = function;
+  message.arg      = arg;
+  
+  return xQueueSend(messages, &message, wait) == pdTRUE;
+}
+
+bool JQ8400_ESP32::command(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, TickType_t wait)
+{
+  if(!messages || requestLength > MP3_FRAME_DATA_LENGTH) return false;
+  
+  Message message;
+  message.type    = MP3_TASK_COMMAND;
+  message.command = command;
+  message.length  = requestLength;
+  if(requestLength) memcpy(message.data, requestBuffer, requestLength);
+  
+  return xQueueSend(messages, &message, wait) == pdTRUE;
+}
+
+bool JQ8400_ESP32::queue(uint8_t command, JQ8400_Future &future, const uint8_t *requestBuffer, uint8_t requestLength, TickType_t wait)
+{
+  if(!messages || requestLength > MP3_FRAME_DATA_LENGTH) return false;
+  
+  future.result = MP3_REQUEST_QUEUED;
+  future.length = 0;
+  future.waiter = xTaskGetCurrentTaskHandle();
+  
+  Message message;
+  message.type    = MP3_TASK_QUERY;
+  message.command = command;
+  message.length  = requestLength;
+  message.future  = &future;
+  if(requestLength) memcpy(message.data, requestBuffer, requestLength);
+  
+  if(xQueueSend(messages, &message, wait) != pdTRUE)
+  {
+    future.result = MP3_REQUEST_UNKNOWN;
+    return false;
+  }
+  
+  return true;
+}
+
+uint8_t JQ8400_ESP32::wait(JQ8400_Future &future, TickType_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+  while(!future.ready())
+  {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if(timeout != portMAX_DELAY && waited >= timeout) break;
+    
+    ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ? portMAX_DELAY : timeout - waited);
+  }
+  
+  return future.result;
+}
+
+uint8_t JQ8400_ESP32::query(uint8_t command, uint8_t *buffer, uint8_t bufferLength, TickType_t timeout)
+{
+  // The future must outlive the request, so having queued it we wait 
+  //  for it regardless, the response policy limits how long that is
+  JQ8400_Future future;
+  if(!this->queue(command, future, NULL, 0, timeout)) return MP3_REQUEST_QUEUED;
+  
+  uint8_t result = this->wait(future, portMAX_DELAY);
+  
+  if(result == MP3_REQUEST_DONE && buffer)
+  {
+    memcpy(buffer, future.data, future.length < bufferLength ? future.length : bufferLength);
+  }
+  
+  return result;
+}
+
+uint8_t JQ8400_ESP32::getStatus()
+{
+  uint8_t status = 0xFF;
+  if(this->query(JQ8400_Serial::MP3_CMD_STATUS, &status, 1) != MP3_REQUEST_DONE) return 0xFF;
+  return status;
+}
+
+void JQ8400_ESP32::task(void *self)
+{
+  JQ8400_ESP32 &driver = *(JQ8400_ESP32 *)self;
+  Message       message;
+  
+  for(;;)
+  {
+    // While something is in progress come back next tick to advance it, 
+    //  otherwise sleep until a message arrives (or the idle time passes)
+    TickType_t ticks = driver.mp3.pendingRequests() ? 1 : driver.idleTicks;
+    
+    while(xQueueReceive(driver.messages, &message, ticks) == pdTRUE)
+    {
+      driver.handle(message);
+      ticks = 0;
+    }
+    
+    driver.mp3.update();
+  }
+}
+
+void JQ8400_ESP32::handle(Message &message)
+{
+  switch(message.type)
+  {
+    case MP3_TASK_RUN:
+      message.function(mp3, message.arg);
+      break;
+      
+    case MP3_TASK_COMMAND:
+      while(!mp3.queueCommand(message.command, message.data, message.length)) 
+      {
+        mp3.update();
+        vTaskDelay(1);
+      }
+      break;
+      
+    case MP3_TASK_QUERY:
+    {
+      uint8_t request;
+      while(!(request = mp3.queueCommand(message.command, message.data, message.length, true, requestComplete)))
+      {
+        mp3.update();
+        vTaskDelay(1);
+      }
+      
+      // There is always room, we hold at most one future per request slot
+      for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+      {
+        if(!futureRequest[x])
+        {
+          futureRequest[x] = request;
+          futures[x]       = message.future;
+          break;
+        }
+      }
+    }
+    break;
+  }
+}
+
+void JQ8400_ESP32::requestComplete(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length)
+{
+  JQ8400_ESP32 &driver = *(JQ8400_ESP32 *)mp3.getUserData();
+  
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    if(driver.futureRequest[x] != request) continue;
+    
+    JQ8400_Future &future = *driver.futures[x];
+    driver.futureRequest[x] = 0;
+    
+    future.length = length < sizeof(future.data) ? length : sizeof(future.data);
+    memcpy(future.data, data, future.length);
+    future.result = result;
+    
+    if(future.waiter) xTaskNotifyGive(future.waiter);
+    break;
+  }
+}
+
+#endif
@@ -0,0 +1,265 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#ifndef JQ8400ESP32_h
+#define JQ8400ESP32_h
+
+#if defined(ESP32)
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "JQ8400_Serial.h"
+
+// Number of messages which can be waiting for the JQ8400_ESP32 task
+#ifndef MP3_TASK_QUEUE_LENGTH
+#define MP3_TASK_QUEUE_LENGTH 8
+#endif
+
+/** The result of a query made through JQ8400_ESP32, filled in by it's task.
+ * 
+ * The future must remain in existence until it is ready (eg, not a local 
+ * variable of a function which returns before waiting on it).
+ */
+
+struct JQ8400_Future
+{
+  volatile uint8_t result = MP3_REQUEST_UNKNOWN;  ///< MP3_REQUEST_QUEUED until ready, then DONE, TIMEOUT or CHECKSUM_FAILED
+  uint8_t          length = 0;                    ///< Number of bytes in data
+  uint8_t          data[MP3_FRAME_DATA_LENGTH];   ///< Response data
+  TaskHandle_t     waiter = NULL;                 ///< Task to notify when ready
+  
+  /** Has the query completed (successfully or not)?
+   * 
+   * @return bool
+   */
+  
+  bool ready() { return result >= MP3_REQUEST_DONE; }
+};
+
+/** A function run by the JQ8400_ESP32 task, see `JQ8400_ESP32::run()`
+ * 
+ * @param mp3 The JQ8400_Serial owned by the task
+ * @param arg Argument given to run()
+ */
+
+typedef void (*JQ8400_TaskFunction)(JQ8400_Serial &mp3, uint16_t arg);
+
+class JQ8400_ESP32
+{
+  public:
+    
+    /** Create a FreeRTOS task based driver for the given JQ8400_Serial.
+     * 
+     * Once `begin()` has been called the task owns the JQ8400_Serial (and it's 
+     *  serial port), you must not call it's methods directly any more, instead
+     *  use the methods here, which are safe to call from any task and cost 
+     *  only the time to put a message on a queue.
+     * 
+     * **Example**
+     * 
+     *     JQ8400_Serial mp3(Serial2);
+     *     JQ8400_ESP32  player(mp3);
+     *     
+     *     void setup()
+     *     {
+     *       Serial2.begin(9600);
+     *       mp3.reset();
+     *       player.begin();
+     *     }
+     *     
+     *     void someTask(void *)
+     *     {
+     *       player.setVolume(20);
+     *       player.playFileByIndexNumber(1);
+     *       
+     *       uint8_t status;
+     *       if(player.query(JQ8400_Serial::MP3_CMD_STATUS, &status, 1) == MP3_REQUEST_DONE) { ... }
+     *     }
+     * 
+     * @param mp3 The JQ8400_Serial to drive.
+     */
+    
+    JQ8400_ESP32(JQ8400_Serial &_mp3) : mp3(_mp3) { }
+    
+    /** Start the task.
+     * 
+     * @param stackSize Stack for the task (bytes)
+     * @param priority  FreeRTOS priority of the task
+     * @param core      Core to pin the task to, or tskNO_AFFINITY
+     * @return False if the task or it's queue could not be created.
+     */
+    
+    bool begin(uint32_t stackSize = 4096, UBaseType_t priority = 2, BaseType_t core = tskNO_AFFINITY);
+    
+    /** Run a function in the task, with the JQ8400_Serial, the function can call any
+     *  JQ8400_Serial method that needs no response (they are queued in the task).
+     * 
+     * **Example**
+     * 
+     *     player.run([](JQ8400_Serial &device, uint16_t arg) { device.setEqualizer(arg); }, MP3_EQ_ROCK);
+     * 
+     * @param function Function to run (a lambda without captures will do)
+     * @param arg      Passed to the function
+     * @param wait     How long to wait for room in the queue
+     * @return False if the queue stayed full.
+     */
+    
+    bool run(JQ8400_TaskFunction function, uint16_t arg = 0, TickType_t wait = portMAX_DELAY);
+    
+    /** Send a command which has no response.
+     * 
+     * @param command        Byte value of to send as from the datasheet (see MP3_CMD_*)
+     * @param requestBuffer  Data bytes for the command (copied, may be NULL)
+     * @param requestLength  Number of data bytes, at most MP3_FRAME_DATA_LENGTH
+     * @param wait           How long to wait for room in the queue
+     * @return False if the queue stayed full or the data is too long.
+     */
+    
+    bool command(uint8_t command, const uint8_t *requestBuffer = NULL, uint8_t requestLength = 0, TickType_t wait = portMAX_DELAY);
+    
+    /** Queue a query, the result is filled into the future later.
+     * 
+     * Poll `future.ready()`, or block on it with `wait()`.
+     * 
+     * @param command        Byte value of to send as from the datasheet (see MP3_CMD_*)
+     * @param future         Where to put the result
+     * @param requestBuffer  Data bytes for the command (copied, may be NULL)
+     * @param requestLength  Number of data bytes, at most MP3_FRAME_DATA_LENGTH
+     * @param wait           How long to wait for room in the queue
+     * @return False if the queue stayed full or the data is too long.
+     */
+    
+    bool queue(uint8_t command, JQ8400_Future &future, const uint8_t *requestBuffer = NULL, uint8_t requestLength = 0, TickType_t wait = portMAX_DELAY);
+    
+    /** Block the calling task (on a task notification, not polling) until the future is ready.
+     * 
+     * Only the task which queued the future may wait on it.
+     * 
+     * @param future  As given to queue()
+     * @param timeout Longest to wait
+     * @return The future's result, MP3_REQUEST_QUEUED if it timed out.
+     */
+    
+    uint8_t wait(JQ8400_Future &future, TickType_t timeout = portMAX_DELAY);
+    
+    /** Make a query and block the calling task until it's answered.
+     * 
+     * @param command      Byte value of to send as from the datasheet (see MP3_CMD_*)
+     * @param buffer       Buffer for the response data
+     * @param bufferLength Length of the buffer
+     * @param timeout      Longest to wait for room in the queue, once queued the answer 
+     *                     (or a failure) always comes, see JQ8400_Serial::setResponsePolicy()
+     * @return MP3_REQUEST_DONE, MP3_REQUEST_TIMEOUT, MP3_REQUEST_CHECKSUM_FAILED, MP3_REQUEST_UNEXPECTED, or MP3_REQUEST_QUEUED if the queue stayed full
+     */
+    
+    uint8_t query(uint8_t command, uint8_t *buffer, uint8_t bufferLength, TickType_t timeout = portMAX_DELAY);
+    
+    /** Set how long the task sleeps when it has nothing to do before it looks at the 
+     *  serial port again (for unsolicited frames, eg position reports).
+     * 
+     * @param ticks Default 20ms worth, portMAX_DELAY to only wake for commands
+     */
+    
+    void setIdleTicks(TickType_t ticks) { idleTicks = ticks; }
+    
+    /** @name Common Operations 
+     * 
+     * Equivalents of the JQ8400_Serial methods, run in the task.
+     */
+    ///@{
+    
+    bool play()                                  { return run([](JQ8400_Serial &device, uint16_t)     { device.play();  }); }
+    bool pause()                                 { return run([](JQ8400_Serial &device, uint16_t)     { device.pause(); }); }
+    bool stop()                                  { return run([](JQ8400_Serial &device, uint16_t)     { device.stop();  }); }
+    bool next()                                  { return run([](JQ8400_Serial &device, uint16_t)     { device.next();  }); }
+    bool prev()                                  { return run([](JQ8400_Serial &device, uint16_t)     { device.prev();  }); }
+    bool setVolume(uint8_t volumeFrom0To30)      { return run([](JQ8400_Serial &device, uint16_t arg) { device.setVolume(arg); }, volumeFrom0To30); }
+    bool playFileByIndexNumber(uint16_t fileNumber) { return run([](JQ8400_Serial &device, uint16_t arg) { device.playFileByIndexNumber(arg); }, fileNumber); }
+    bool interjectFileByIndexNumber(uint16_t fileNumber) { return run([](JQ8400_Serial &device, uint16_t arg) { device.interjectFileByIndexNumber(arg); }, fileNumber); }
+    
+    /** Get the status, blocking the calling task until answered.
+     * 
+     * @return One of MP3_STATUS_*, or 0xFF if there was no answer
+     */
+    
+    uint8_t getStatus();
+    
+    ///@}
+    
+  protected:
+    
+    static const uint8_t MP3_TASK_RUN     = 0;
+    static const uint8_t MP3_TASK_COMMAND = 1;
+    static const uint8_t MP3_TASK_QUERY   = 2;
+    
+    /** A message to the task. */
+    
+    struct Message
+    {
+      uint8_t             type;     ///< MP3_TASK_*
+      uint8_t             command;  ///< Command byte (COMMAND, QUERY)
+      uint8_t             length;   ///< Number of data bytes (COMMAND, QUERY)
+      uint8_t             data[MP3_FRAME_DATA_LENGTH]; ///< Data bytes (COMMAND, QUERY)
+      uint16_t            arg;      ///< Argument (RUN)
+      JQ8400_TaskFunction function; ///< Function (RUN)
+      JQ8400_Future      *future;   ///< Where the result goes (QUERY)
+    };
+    
+    /** The task itself.
+     * 
+     * @param self The JQ8400_ESP32
+     */
+    
+    static void task(void *self);
+    
+    /** Act on a message from the queue (in the task). 
+     * 
+     * @param message The message
+     */
+    
+    void handle(Message &message);
+    
+    /** JQ8400_RequestCallback which fills in the future belonging to the request. */
+    
+    static void requestComplete(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length);
+    
+    JQ8400_Serial &mp3;                              ///< The device, owned by the task after begin()
+    QueueHandle_t  messages    = NULL;               ///< Messages to the task
+    TaskHandle_t   taskHandle  = NULL;               ///< The task
+    TickType_t     idleTicks   = pdMS_TO_TICKS(20);  ///< See setIdleTicks()
+    
+    uint8_t        futureRequest[MP3_ASYNC_QUEUE_LENGTH];  ///< Request handles with a future waiting
+    JQ8400_Future *futures[MP3_ASYNC_QUEUE_LENGTH];        ///< The futures for those requests
+};
+
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "JQ8400_Esp32Uart.h"
+
+#if defined(ESP32)
+
+bool JQ8400_Esp32Uart::begin(uint32_t baud, int8_t rxPin, int8_t txPin)
+{
+  if(events) this->end();
+  
+  uart_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.baud_rate = baud;
+  config.data_bits = UART_DATA_8_BITS;
+  config.parity    = UART_PARITY_DISABLE;
+  config.stop_bits = UART_STOP_BITS_1;
+  config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  
+  // No transmit buffer, a frame fits in the FIFO so writes don't wait anyway
+  if(uart_driver_install(port, MP3_ESP32_UART_RX_BUFFER, 0, MP3_ESP32_UART_EVENTS, &events, 0) != ESP_OK)
+  {
+    events = NULL;
+    return false;
+  }
+  
+  uart_param_config(port, &config);
+  uart_set_pin(port, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+  uart_set_rx_timeout(port, MP3_ESP32_UART_RX_TIMEOUT);
+  
+  peeked = -1;
+  return true;
+}
+
+void JQ8400_Esp32Uart::end()
+{
+  if(!events) return;
+  
+  uart_driver_delete(port);
+  events = NULL;
+}
+
+int JQ8400_Esp32Uart::available()
+{
+  size_t length = 0;
+  if(events) uart_get_buffered_data_len(port, &length);
+  return length + (peeked >= 0);
+}
+
+int JQ8400_Esp32Uart::peek()
+{
+  if(peeked < 0)
+  {
+    uint8_t c;
+    if(!events || uart_read_bytes(port, &c, 1, 0) != 1) return -1;
+    peeked = c;
+  }
+  
+  return peeked;
+}
+
+int JQ8400_Esp32Uart::read()
+{
+  int c = this->peek();
+  peeked = -1;
+  return c;
+}
+
+void JQ8400_Esp32Uart::flush()
+{
+  if(events) uart_wait_tx_done(port, portMAX_DELAY);
+}
+
+size_t JQ8400_Esp32Uart::write(const uint8_t *buffer, size_t size)
+{
+  if(!events) return 0;
+  
+  int written = uart_write_bytes(port, (const char *)buffer, size);
+  return written < 0 ? 0 : written;
+}
+
+bool JQ8400_Esp32Uart::waitForData(TickType_t ticks)
+{
+  if(!events)     return false;
+  if(available()) return true;
+  
+  // Events queue up while nobody is waiting, so one may be for bytes already read
+  uart_event_t event;
+  TickType_t   start = xTaskGetTickCount();
+  TickType_t   waited;
+  
+  while((waited = xTaskGetTickCount() - start) <= ticks && xQueueReceive(events, &event, ticks - waited) == pdTRUE)
+  {
+    if(event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) rxOverflows++;
+    if(available()) return true;
+  }
+  
+  return available();
+}
+
+void JQ8400_Esp32Uart::waitEvent(JQ8400_Serial &mp3, uint32_t maxMicros)
+{
+  TickType_t ticks = maxMicros / (portTICK_PERIOD_MS * 1000UL);
+  
+  // Less than a tick, we can't block for that and be sure to wake in time
+  if(!ticks)
+  {
+    yield();
+    return;
+  }
+  
+  ((JQ8400_Esp32Uart *)mp3._Serial)->waitForData(ticks);
+}
+
+#endif
@@ -0,0 +1,147 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Esp32Uart_h
+#define JQ8400Esp32Uart_h
+
+#if defined(ESP32)
+
+#include <Arduino.h>
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "JQ8400_Serial.h"
+
+// Bytes the UART driver holds for us, it must be more than the 128 byte FIFO
+#ifndef MP3_ESP32_UART_RX_BUFFER
+#define MP3_ESP32_UART_RX_BUFFER 256
+#endif
+
+// UART events which can be waiting for us
+#ifndef MP3_ESP32_UART_EVENTS
+#define MP3_ESP32_UART_EVENTS 8
+#endif
+
+// Byte times of silence before received bytes are handed over, the driver's default is 10
+#ifndef MP3_ESP32_UART_RX_TIMEOUT
+#define MP3_ESP32_UART_RX_TIMEOUT 2
+#endif
+
+/** A Stream on one of the ESP32's UARTs through the ESP-IDF UART driver, for
+ *  JQ8400_Serial to use in place of HardwareSerial.
+ * 
+ * The driver's event queue tells us when bytes arrive, so with the 
+ *  waitEvent() wait strategy a task waiting for a response blocks until 
+ *  the response comes, rather than waking every tick to look (or spinning).
+ *  Received bytes are handed over after MP3_ESP32_UART_RX_TIMEOUT byte 
+ *  times of silence, rather than the driver's default of 10, so a response
+ *  is seen about 8ms sooner at 9600 baud.
+ * 
+ * The UART is then ours, don't also begin() the HardwareSerial of the
+ *  same number.
+ * 
+ * **Example**
+ * 
+ *     #include <JQ8400_Serial.h>
+ *     #include <JQ8400_Esp32Uart.h>
+ *     
+ *     JQ8400_Esp32Uart mp3Uart(UART_NUM_2);
+ *     JQ8400_Serial    mp3(mp3Uart);
+ *     
+ *     void setup()
+ *     {
+ *       mp3Uart.begin(9600, 16, 17);
+ *       mp3.setWaitStrategy(JQ8400_Esp32Uart::waitEvent);
+ *       mp3.reset();
+ *     }
+ */
+
+class JQ8400_Esp32Uart : public Stream
+{
+  public:
+    
+    /** Create a stream on the given UART.
+     * 
+     * @param port UART_NUM_1 or UART_NUM_2 (UART_NUM_0 is usually `Serial`)
+     */
+    
+    JQ8400_Esp32Uart(uart_port_t port) : port(port) { }
+    
+    /** Install the UART driver, 8 data bits, no parity, 1 stop bit.
+     * 
+     * @param baud  Rate, 9600 for the JQ8400.
+     * @param rxPin GPIO connected to the TX of the JQ8400
+     * @param txPin GPIO connected to the RX of the JQ8400
+     * @return False if the driver could not be installed.
+     */
+    
+    bool begin(uint32_t baud, int8_t rxPin, int8_t txPin);
+    
+    /** Remove the UART driver. */
+    
+    void end();
+    
+    virtual int    available();
+    virtual int    peek();
+    virtual int    read();
+    virtual void   flush();
+    virtual size_t write(uint8_t c) { return this->write(&c, 1); }
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    
+    /** Block until bytes are available, or the time passes.
+     * 
+     * @param ticks Longest to wait.
+     * @return True if bytes are available.
+     */
+    
+    bool waitForData(TickType_t ticks);
+    
+    /** @return Times the driver lost bytes because it's FIFO or buffer was full. */
+    
+    uint16_t overflows() { return rxOverflows; }
+    
+    /** Wait strategy which blocks the task until the UART receives something
+     *  (see JQ8400_Serial::setWaitStrategy()), for a JQ8400_Serial created on 
+     *  a JQ8400_Esp32Uart only.
+     */
+    
+    static void waitEvent(JQ8400_Serial &mp3, uint32_t maxMicros);
+    
+  protected:
+    
+    uart_port_t   port;                  ///< The UART
+    QueueHandle_t events      = NULL;    ///< The driver's event queue, NULL until begin()
+    int16_t       peeked      = -1;      ///< Byte taken from the driver by peek(), or -1
+    uint16_t      rxOverflows = 0;       ///< See overflows()
+};
+
+#endif
+
+#endif
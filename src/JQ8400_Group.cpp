@@ -0,0 +1,199 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "JQ8400_Group.h"
+
+uint8_t JQ8400_Group::add(JQ8400_Serial &mp3, uint8_t sharesTxWithPrevious)
+{
+  if(deviceCount >= MP3_GROUP_MAX_DEVICES) return false;
+  
+  devices[deviceCount]  = &mp3;
+  sharesTx[deviceCount] = deviceCount && sharesTxWithPrevious;
+  deviceCount++;
+  
+  return true;
+}
+
+void JQ8400_Group::update()
+{
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->update();
+  }
+}
+
+uint8_t JQ8400_Group::queueCommand(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, uint8_t expectResponse, JQ8400_RequestCallback callback)
+{
+  uint8_t queued = 0;
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    if(devices[x]->queueCommand(command, requestBuffer, requestLength, expectResponse, callback)) queued++;
+  }
+  return queued;
+}
+
+uint8_t JQ8400_Group::pendingRequests()
+{
+  uint8_t count = 0;
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    count += devices[x]->pendingRequests();
+  }
+  return count;
+}
+
+void JQ8400_Group::flushQueue()
+{
+  while(this->pendingRequests()) this->update();
+}
+
+void JQ8400_Group::prepareToSend()
+{
+  // Nothing may overtake what is queued on any module, nor be sent to one 
+  //  while it's response is on the way
+  this->flushQueue();
+  
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->drain();
+  }
+  
+  // Once it has passed a module's gap stays passed, so one wait each
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    while(!devices[x]->txReady()) devices[x]->idle(devices[x]->txReadyAt - micros());
+  }
+}
+
+void JQ8400_Group::broadcast(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength)
+{  
+  this->prepareToSend();
+  
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    // The module before already put this on the shared line, so the gap
+    //  after it is this module's too
+    if(sharesTx[x])
+    {
+      devices[x]->txReadyAt = devices[x-1]->txReadyAt;
+      continue;
+    }
+    
+    devices[x]->writeFrame(command, requestBuffer, requestLength);
+  }
+}
+
+void JQ8400_Group::broadcast(const uint8_t *frame)
+{  
+  this->prepareToSend();
+  
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    if(sharesTx[x])
+    {
+      devices[x]->txReadyAt = devices[x-1]->txReadyAt;
+      continue;
+    }
+    
+    devices[x]->writeFrame(frame);
+  }
+}
+
+void JQ8400_Group::play()
+{
+  this->prepareToSend();
+  
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->invalidateShadow(MP3_SHADOW_STATUS);
+  }
+  this->broadcast(JQ8400_Frame<JQ8400_Serial::MP3_CMD_PLAY>::bytes);
+}
+
+void JQ8400_Group::pause()
+{
+  this->prepareToSend();
+  
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->invalidateShadow(MP3_SHADOW_STATUS);
+  }
+  this->broadcast(JQ8400_Frame<JQ8400_Serial::MP3_CMD_PAUSE>::bytes);
+}
+
+void JQ8400_Group::stop()
+{
+  this->prepareToSend();
+  
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->stopping();
+  }
+  this->broadcast(JQ8400_Frame<JQ8400_Serial::MP3_CMD_STOP>::bytes);
+}
+
+void JQ8400_Group::setVolume(byte volumeFrom0To30)
+{
+  this->prepareToSend();
+  
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->currentVolume = volumeFrom0To30;
+    devices[x]->markShadow(MP3_SHADOW_VOLUME);
+  }
+  this->broadcast(JQ8400_Serial::MP3_CMD_VOL_SET, &volumeFrom0To30, 1);
+}
+
+void JQ8400_Group::playFileByIndexNumber(uint16_t fileNumber)
+{
+  uint8_t buf[2] = { (uint8_t)((fileNumber>>8)&0xFF), (uint8_t)(fileNumber & 0xFF) };
+  
+  this->prepareToSend();
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->trackChanging();
+    devices[x]->currentIndex = fileNumber;
+    devices[x]->markShadow(MP3_SHADOW_INDEX);
+  }
+  this->broadcast(JQ8400_Serial::MP3_CMD_PLAY_IDX, buf, sizeof(buf));
+}
+
+void JQ8400_Group::seekFileByIndexNumber(uint16_t fileNumber)
+{
+  uint8_t buf[2] = { (uint8_t)((fileNumber>>8)&0xFF), (uint8_t)(fileNumber & 0xFF) };
+  
+  this->prepareToSend();
+  for(uint8_t x = 0; x < deviceCount; x++)
+  {
+    devices[x]->trackChanging();
+    devices[x]->currentIndex = fileNumber;
+    devices[x]->markShadow(MP3_SHADOW_INDEX);
+  }
+  this->broadcast(JQ8400_Serial::MP3_CMD_SEEK_IDX, buf, sizeof(buf));
+}
@@ -0,0 +1,204 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Group_h
+#define JQ8400Group_h
+
+#include "JQ8400_Serial.h"
+
+// Most modules a JQ8400_Group can hold
+#ifndef MP3_GROUP_MAX_DEVICES
+#define MP3_GROUP_MAX_DEVICES 8
+#endif
+
+class JQ8400_Group
+{
+  public:
+    
+    /** Create an empty group of JQ8400 modules, add them with `add()`
+     * 
+     * **Example**
+     * 
+     *     JQ8400_Serial mp3a(Serial1);
+     *     JQ8400_Serial mp3b(Serial2);
+     *     JQ8400_Group  speakers;
+     *     
+     *     void setup()
+     *     {
+     *       Serial1.begin(9600);
+     *       Serial2.begin(9600);
+     *       speakers.add(mp3a);
+     *       speakers.add(mp3b);
+     *       speakers.setVolume(20);
+     *       speakers.playFileByIndexNumber(1); // Both start together
+     *     }
+     *     
+     *     void loop()
+     *     {
+     *       speakers.update();
+     *     }
+     * 
+     */
+    
+    JQ8400_Group() { }
+    
+    /** Add a module to the group.
+     * 
+     * @param mp3 The module
+     * @param sharesTxWithPrevious True if this module's RX is wired to the same TX line 
+     *   as the module added before it (with a separate line back), commands sent to 
+     *   the whole group are then only written once for both.
+     * @return False if the group is full (see MP3_GROUP_MAX_DEVICES)
+     */
+    
+    uint8_t add(JQ8400_Serial &mp3, uint8_t sharesTxWithPrevious = false);
+    
+    /** Number of modules in the group. 
+     * 
+     * @return Count of modules
+     */
+    
+    uint8_t count() { return deviceCount; }
+    
+    /** Get a module in the group.
+     * 
+     * @param index 0 to count()-1
+     * @return The module
+     */
+    
+    JQ8400_Serial &operator[](uint8_t index) { return *devices[index]; }
+    
+    /** Advance every module's asynchronous engine, call this frequently from your `loop()`.
+     * 
+     *  Each module has it's own request in flight so queries to all of them 
+     *  proceed at the same time rather than one after the other.
+     */
+    
+    void update();
+    
+    /** Queue the same command on every module, see JQ8400_Serial::queueCommand()
+     * 
+     * The callback is given the module each response came from.
+     * 
+     * **Example**
+     * 
+     *     speakers.queueCommand(JQ8400_Serial::MP3_CMD_STATUS, NULL, 0, true, statusArrived);
+     * 
+     * @return Number of modules which had room to queue the command.
+     */
+    
+    uint8_t queueCommand(uint8_t command, const uint8_t *requestBuffer = NULL, uint8_t requestLength = 0, uint8_t expectResponse = 0, JQ8400_RequestCallback callback = NULL);
+    
+    /** Total requests queued or in flight over all modules.
+     * 
+     * @return Number of requests still to be completed.
+     */
+    
+    uint8_t pendingRequests();
+    
+    /** Block until every module's queue is empty.
+     */
+    
+    void flushQueue();
+    
+    /** @name Synchronised Group Operations
+     * 
+     * These are written to every module back to back, with the frame prepared
+     * before the first write so that the modules start as near together as 
+     * the UARTs allow.  As a module's own commands do, they first wait for 
+     * anything queued on the modules to be answered, and for each module's 
+     * inter frame gap (see JQ8400_Serial::setInterFrameGap()) to pass.
+     */
+    ///@{
+    
+    /** Start (or resume) playing on all modules. */
+    
+    void play();
+    
+    /** Pause all modules. */
+    
+    void pause();
+    
+    /** Stop all modules. */
+    
+    void stop();
+    
+    /** Set the volume of all modules.
+     * 
+     * @param volumeFrom0To30 Level of volume to set from 0 to 30
+     */
+    
+    void setVolume(byte volumeFrom0To30);
+    
+    /** Play the same FAT index number on all modules. 
+     * 
+     * @param fileNumber FAT index of the file to play.
+     */
+    
+    void playFileByIndexNumber(uint16_t fileNumber);
+    
+    /** Seek all modules to the same FAT index number (without playing), 
+     *  a following `play()` then starts them with the least delay.
+     * 
+     * @param fileNumber FAT index of the file.
+     */
+    
+    void seekFileByIndexNumber(uint16_t fileNumber);
+    
+    /** Write one frame to every module, back to back.
+     * 
+     * @param command        Byte value of to send as from the datasheet.
+     * @param requestBuffer  Pointer to (or NULL) request data bytes.
+     * @param requestLength  Number of bytes in the request buffer.
+     */
+    
+    void broadcast(uint8_t command, const uint8_t *requestBuffer = NULL, uint8_t requestLength = 0);
+    
+    /** Write one constant frame to every module, back to back.
+     * 
+     * @param frame A JQ8400_Frame<...>::bytes (PROGMEM)
+     */
+    
+    void broadcast(const uint8_t *frame);
+    
+    ///@}
+    
+  protected:
+    
+    /** Wait until every module may be sent a frame, as 
+     *  JQ8400_Serial::prepareToSend() does for one.
+     */
+    
+    void prepareToSend();
+    
+    JQ8400_Serial *devices[MP3_GROUP_MAX_DEVICES];   ///< Modules in the group
+    uint8_t        sharesTx[MP3_GROUP_MAX_DEVICES];  ///< True if the module hears the previous module's TX
+    uint8_t        deviceCount = 0;                  ///< Number of modules in the group
+};
+
+#endif
@@ -0,0 +1,458 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "JQ8400_Mock.h"
+
+int JQ8400_Mock::available()
+{
+  pollCount++;
+  this->advance();
+  
+  // The bytes are in order of their due time, count those which have arrived
+  uint32_t now   = micros();
+  uint8_t  ready = 0;
+  
+  while(ready < txCount && (int32_t)(now - txDue[(txHead + ready) % MP3_MOCK_BUFFER]) >= 0) ready++;
+  
+  return ready;
+}
+
+int JQ8400_Mock::read()
+{
+  if(!this->available()) return -1;
+  
+  uint8_t b = txBytes[txHead];
+  txHead = (txHead + 1) % MP3_MOCK_BUFFER;
+  txCount--;
+  
+  return b;
+}
+
+int JQ8400_Mock::peek()
+{
+  if(!this->available()) return -1;
+  return txBytes[txHead];
+}
+
+size_t JQ8400_Mock::write(const uint8_t *buffer, size_t size)
+{
+  for(size_t x = 0; x < size; x++) this->write(buffer[x]);
+  return size;
+}
+
+size_t JQ8400_Mock::write(uint8_t b)
+{
+  // The byte has arrived once it has crossed the wire, behind any others
+  uint32_t now = micros();
+  if((int32_t)(now - lineFreeAt) > 0) lineFreeAt = now;
+  lineFreeAt += byteTime;
+  
+  // Between frames the device waits for a start byte, anything else is ignored
+  if(!frameFill && b != JQ8400_Serial::MP3_CMD_BEGIN) return 1;
+  
+  if(!frameFill)
+  {
+    // The start byte began to arrive a byte time ago
+    frameEarly = frameGap && frameEnded && lineFreeAt - byteTime - frameEndAt < frameGap;
+  }
+  
+  if(frameFill < 3 || frameFill < 3 + frameLength)
+  {
+    if(frameFill < sizeof(frame)) frame[frameFill] = b;
+    if(frameFill == 2)            frameLength      = b;
+    
+    frameSum += b;
+    frameFill++;
+    return 1;
+  }
+  
+  // This is the checksum
+  frameEndAt = lineFreeAt;
+  frameEnded = true;
+  
+  if(b != frameSum)
+  {
+    rxBad++;
+  }
+  else if(frameEarly)
+  {
+    rxIgnored++;
+  }
+  else
+  {
+    rxFrames++;
+    this->advance();
+    this->handleFrame();
+  }
+  
+  frameFill = 0;
+  frameSum  = 0;
+  
+  return 1;
+}
+
+uint16_t JQ8400_Mock::position()
+{
+  this->advance();
+  
+  switch(playStatus)
+  {
+    case MP3_STATUS_PLAYING: return (millis() - startedAt) / 1000;
+    case MP3_STATUS_PAUSED:  return (pausedAt - startedAt) / 1000;
+  }
+  
+  return 0;
+}
+
+void JQ8400_Mock::advance()
+{
+  // A long wait might have covered more than one file
+  while(playStatus == MP3_STATUS_PLAYING && trackLength && millis() - startedAt >= trackLength * 1000UL) 
+  {
+    this->endTrack();
+  }
+  
+  if(positionReports && (int32_t)(millis() - nextReportAt) >= 0)
+  {
+    // Once a second from when it was asked, without catching up if we fell behind
+    nextReportAt += 1000;
+    if((int32_t)(millis() - nextReportAt) >= 0) nextReportAt = millis() + 1000;
+    
+    if(playStatus == MP3_STATUS_PLAYING) this->respondPosition(true);
+  }
+}
+
+void JQ8400_Mock::startTrack(uint16_t index, uint32_t startAt)
+{
+  currentIndex = index;
+  startedAt    = startAt;
+  playStatus   = MP3_STATUS_PLAYING;
+}
+
+void JQ8400_Mock::endTrack()
+{
+  uint32_t endedAt = startedAt + trackLength * 1000UL;
+  
+  trackEnds++;
+  
+  // An interjection goes back to where it interrupted
+  if(resumeIndex)
+  {
+    this->startTrack(resumeIndex, endedAt - resumeOffset);
+    resumeIndex = 0;
+    return;
+  }
+  
+  // A playlist plays through then stops
+  if(playlistLength)
+  {
+    if(playlistNext < playlistLength)
+    {
+      this->startTrack(playlist[playlistNext++], endedAt);
+      return;
+    }
+    
+    playlistLength = 0;
+    playStatus     = MP3_STATUS_STOPPED;
+    return;
+  }
+  
+  switch(loopMode)
+  {
+    case MP3_LOOP_ALL:
+    case MP3_LOOP_FOLDER:
+      this->startTrack(currentIndex < fileCount ? currentIndex + 1 : 1, endedAt);
+      break;
+      
+    case MP3_LOOP_ALL_RANDOM:
+    case MP3_LOOP_FOLDER_RANDOM:
+      this->chance(0); // Just to step the generator
+      this->startTrack(1 + (randomState % fileCount), endedAt);
+      break;
+      
+    case MP3_LOOP_ONE:
+      this->startTrack(currentIndex, endedAt);
+      break;
+      
+    case MP3_LOOP_ALL_STOP:
+    case MP3_LOOP_FOLDER_STOP:
+      if(currentIndex < fileCount) 
+      {
+        this->startTrack(currentIndex + 1, endedAt);
+        break;
+      }
+      playStatus = MP3_STATUS_STOPPED;
+      break;
+      
+    default: // MP3_LOOP_ONE_STOP
+      playStatus = MP3_STATUS_STOPPED;
+      break;
+  }
+}
+
+void JQ8400_Mock::handleFrame()
+{
+  const uint8_t *data   = frame + 3;
+  uint8_t        length = frameLength < MP3_MOCK_FRAME_DATA ? frameLength : MP3_MOCK_FRAME_DATA;
+  uint16_t       number = length >= 2 ? (data[0] << 8) | data[1] : 0;
+  uint8_t        reply[11];
+  
+  switch(frame[1])
+  {
+    case JQ8400_Serial::MP3_CMD_PLAY:
+      if(playStatus == MP3_STATUS_PAUSED)
+      {
+        startedAt += millis() - pausedAt;
+        playStatus = MP3_STATUS_PLAYING;
+      }
+      else if(playStatus == MP3_STATUS_STOPPED)
+      {
+        this->startTrack(currentIndex, millis());
+      }
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_PAUSE:
+      if(playStatus != MP3_STATUS_PLAYING) break;
+      pausedAt   = millis();
+      playStatus = MP3_STATUS_PAUSED;
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_STOP:
+      playStatus     = MP3_STATUS_STOPPED;
+      playlistLength = 0;
+      resumeIndex    = 0;
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_NEXT:
+    case JQ8400_Serial::MP3_CMD_NEXT_FOLDER:
+      playlistLength = 0;
+      this->startTrack(currentIndex < fileCount ? currentIndex + 1 : 1, millis());
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_PREV:
+    case JQ8400_Serial::MP3_CMD_PREV_FOLDER:
+      playlistLength = 0;
+      this->startTrack(currentIndex > 1 ? currentIndex - 1 : fileCount, millis());
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_PLAY_IDX:
+      if(!number || number > fileCount) break;
+      playlistLength = 0;
+      this->startTrack(number, millis());
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_SEEK_IDX:
+      if(!number || number > fileCount) break;
+      playlistLength = 0;
+      currentIndex   = number;
+      playStatus     = MP3_STATUS_STOPPED;
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_INSERT_IDX:
+      // The source comes first
+      number = length >= 3 ? (data[1] << 8) | data[2] : 0;
+      if(!number || number > fileCount) break;
+      if(playStatus == MP3_STATUS_PLAYING && !resumeIndex)
+      {
+        resumeIndex  = currentIndex;
+        resumeOffset = millis() - startedAt;
+      }
+      this->startTrack(number, millis());
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_PLAY_FILE_FOLDER:
+      // There is no file system here, any path plays the first file
+      playlistLength = 0;
+      this->startTrack(1, millis());
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_FFWD:
+      if(playStatus != MP3_STATUS_STOPPED) startedAt -= number * 1000UL;
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_RWND:
+      if(playStatus == MP3_STATUS_STOPPED) break;
+      if(this->position() < number) number = this->position();
+      startedAt += number * 1000UL;
+      break;
+    
+    case JQ8400_Serial::MP3_CMD_VOL_UP:     if(currentVolume < 30) currentVolume++; break;
+    case JQ8400_Serial::MP3_CMD_VOL_DN:     if(currentVolume > 0)  currentVolume--; break;
+    case JQ8400_Serial::MP3_CMD_VOL_SET:    if(length) currentVolume = data[0] > 30 ? 30 : data[0]; break;
+    case JQ8400_Serial::MP3_CMD_EQ_SET:     if(length) currentEq     = data[0]; break;
+    case JQ8400_Serial::MP3_CMD_LOOP_SET:   if(length) loopMode      = data[0]; break;
+    case JQ8400_Serial::MP3_CMD_SOURCE_SET: if(length) source        = data[0]; break;
+      
+    case JQ8400_Serial::MP3_CMD_RESET: // Also MP3_CMD_SLEEP
+      playStatus      = MP3_STATUS_STOPPED;
+      playlistLength  = 0;
+      resumeIndex     = 0;
+      positionReports = false;
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_PLAYLIST:
+      // We keep the names as numbers, "07" is the 7th file
+      playlistLength = 0;
+      for(uint8_t x = 0; x + 1 < length; x += 2)
+      {
+        playlist[playlistLength++] = (data[x] - '0') * 10 + (data[x+1] - '0');
+      }
+      if(!playlistLength) break;
+      playlistNext = 1;
+      resumeIndex  = 0;
+      this->startTrack(playlist[0], millis());
+      break;
+    
+    case JQ8400_Serial::MP3_CMD_STATUS:
+      reply[0] = playStatus;
+      this->respond(frame[1], reply, 1);
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_GET_SOURCES:
+      reply[0] = 1 << source;
+      this->respond(frame[1], reply, 1);
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_GET_SOURCE:
+      reply[0] = source;
+      this->respond(frame[1], reply, 1);
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_COUNT_FILES:
+    case JQ8400_Serial::MP3_CMD_COUNT_IN_FOLDER:
+    case JQ8400_Serial::MP3_CMD_CURRENT_FILE_IDX:
+    case JQ8400_Serial::MP3_CMD_FIRST_FILE_IN_FOLDER_IDX:
+    {
+      // The folder questions are about the folder of the current file
+      uint16_t first = folderSize ? ((currentIndex - 1) / folderSize) * folderSize + 1 : 1;
+      uint16_t count = folderSize && fileCount - first + 1 > folderSize ? folderSize : fileCount - first + 1;
+      
+      switch(frame[1])
+      {
+        case JQ8400_Serial::MP3_CMD_COUNT_FILES:              number = fileCount;    break;
+        case JQ8400_Serial::MP3_CMD_COUNT_IN_FOLDER:          number = count;        break;
+        case JQ8400_Serial::MP3_CMD_CURRENT_FILE_IDX:         number = currentIndex; break;
+        case JQ8400_Serial::MP3_CMD_FIRST_FILE_IN_FOLDER_IDX: number = first;        break;
+      }
+      
+      reply[0] = number >> 8;
+      reply[1] = number & 0xFF;
+      this->respond(frame[1], reply, 2);
+    }
+    break;
+      
+    case JQ8400_Serial::MP3_CMD_CURRENT_FILE_LEN:
+      reply[0] = trackLength / 3600;
+      reply[1] = (trackLength / 60) % 60;
+      reply[2] = trackLength % 60;
+      this->respond(frame[1], reply, 3);
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_CURRENT_FILE_POS:
+      positionReports = true;
+      nextReportAt    = millis() + 1000;
+      this->respondPosition(false);
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_CURRENT_FILE_POS_STOP:
+      positionReports = false;
+      break;
+      
+    case JQ8400_Serial::MP3_CMD_CURRENT_FILE_NAME:
+      // 8.3 without the dot, the files are called 00001.MP3 and so on
+      JQ8400_Serial::fixedDecimal((char *)reply, currentIndex, 5);
+      memcpy(reply + 5, "   MP3", 6);
+      this->respond(frame[1], reply, 11);
+      break;
+  }
+}
+
+void JQ8400_Mock::respondPosition(uint8_t unsolicited)
+{
+  uint16_t seconds = this->position();
+  uint8_t  reply[3];
+  
+  reply[0] = seconds / 3600;
+  reply[1] = (seconds / 60) % 60;
+  reply[2] = seconds % 60;
+  
+  this->respond(JQ8400_Serial::MP3_CMD_CURRENT_FILE_POS, reply, 3, unsolicited);
+}
+
+void JQ8400_Mock::respond(uint8_t command, const uint8_t *data, uint8_t length, uint8_t unsolicited)
+{
+  if(!unsolicited && this->chance(dropRate)) return;
+  
+  // An answer starts once the device has thought about the command, a report
+  //  can go straight away, either way behind what's already on the wire
+  uint32_t at = unsolicited ? micros() : lineFreeAt + latency;
+  if((int32_t)(txFreeAt - at) > 0) at = txFreeAt;
+  
+  if(this->chance(noiseRate)) 
+  {
+    this->transmit(randomState >> 8, at += byteTime);
+  }
+  
+  uint8_t head[3] = { JQ8400_Serial::MP3_CMD_BEGIN, command, length };
+  uint8_t sum     = 0;
+  
+  for(uint8_t x = 0; x < 3; x++)      { sum += head[x]; this->transmit(head[x], at += byteTime); }
+  for(uint8_t x = 0; x < length; x++) { sum += data[x]; this->transmit(data[x], at += byteTime); }
+  
+  if(!unsolicited && this->chance(corruptRate)) sum ^= 0x5A;
+  
+  this->transmit(sum, at += byteTime);
+  
+  txFreeAt = at;
+}
+
+void JQ8400_Mock::transmit(uint8_t b, uint32_t due)
+{
+  if(txCount >= MP3_MOCK_BUFFER)
+  {
+    lostBytes++;
+    return;
+  }
+  
+  uint8_t slot = (txHead + txCount) % MP3_MOCK_BUFFER;
+  
+  txBytes[slot] = b;
+  txDue[slot]   = due;
+  txCount++;
+}
+
+uint8_t JQ8400_Mock::chance(uint8_t per256)
+{
+  // xorshift32, it is always stepped so that the faults follow the seed
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  
+  return (randomState & 0xFF) < per256;
+}
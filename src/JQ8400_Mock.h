@@ -0,0 +1,322 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Mock_h
+#define JQ8400Mock_h
+
+#include "JQ8400_Serial.h"
+
+// Bytes of response the mock can have "on the wire" at once, a name 
+//  response is 15 bytes, so this allows a few pipelined requests
+#ifndef MP3_MOCK_BUFFER
+#define MP3_MOCK_BUFFER 64
+#endif
+
+// Most data bytes of an incoming frame the mock keeps (enough for a full
+//  MP3_PLAYLIST_SEGMENT of 2 byte names), longer frames are still checked
+#ifndef MP3_MOCK_FRAME_DATA
+#define MP3_MOCK_FRAME_DATA 64
+#endif
+
+/** A software stand-in for a JQ8400 module, it is a Stream which you give to
+ *  JQ8400_Serial instead of the real serial port.
+ * 
+ * The mock emulates the device well enough to exercise the protocol engine 
+ * without hardware: it answers the queries, keeps a simple model of playback
+ * (status, index, position, loop mode, playlists) and, while position reporting 
+ * is on, sends unsolicited position frames every second like the real module.
+ * 
+ * Response bytes become available at the pace of the configured baud rate, 
+ * after a configurable processing latency, and faults can be injected so
+ * the timeouts and retries can be exercised too. 
+ * 
+ * It only uses the Arduino core, so it runs on a board (see the Benchmark
+ * example) as well as on a host build with an Arduino compatibility layer.
+ * 
+ * **Example**
+ * 
+ *     JQ8400_Mock   device;
+ *     JQ8400_Serial mp3(device);
+ *     
+ *     void setup()
+ *     {
+ *       device.setLatency(4000);      // 4ms to think about each command
+ *       device.setChecksumErrors(8);  // Corrupt 8 in 256 responses
+ *       mp3.reset();
+ *       mp3.playFileByIndexNumber(3);
+ *     }
+ */
+
+class JQ8400_Mock : public Stream
+{
+  public:
+    
+    /** Create a mock device.
+     * 
+     * @param baudRate The baud rate to emulate, it sets the pace of the bytes.
+     */
+    
+    JQ8400_Mock(uint32_t baudRate = 9600) { setBaudRate(baudRate); }
+    
+    /** @name Configuration
+     * 
+     */
+    ///@{
+    
+    /** Set the emulated baud rate, 10 bits per byte.
+     * 
+     * @param baudRate Bits per second, 0 makes the wire infinitely fast.
+     */
+    
+    void setBaudRate(uint32_t baudRate) { byteTime = baudRate ? 10000000UL / baudRate : 0; }
+    
+    /** Set how long the device "thinks" after a command has arrived before
+     *  the first byte of the response starts to go out.
+     * 
+     * @param microseconds Processing latency.
+     */
+    
+    void setLatency(uint32_t microseconds) { latency = microseconds; }
+    
+    /** Set the chance of a random byte being inserted on the line before a response.
+     * 
+     * @param per256 Probability out of 256.
+     */
+    
+    void setNoise(uint8_t per256) { noiseRate = per256; }
+    
+    /** Set the chance of a response being sent with a bad checksum.
+     * 
+     * @param per256 Probability out of 256.
+     */
+    
+    void setChecksumErrors(uint8_t per256) { corruptRate = per256; }
+    
+    /** Set the chance of the device never answering a query.
+     * 
+     * @param per256 Probability out of 256.
+     */
+    
+    void setDropRate(uint8_t per256) { dropRate = per256; }
+    
+    /** Ignore a frame which starts less than this long after the one before
+     *  it ended, as the real module seems to (see setInterFrameGap() in 
+     *  JQ8400_Serial), so that timing can be reproduced.
+     * 
+     * @param microseconds Shortest gap, 0 (the default) takes frames back to back.
+     */
+    
+    void setFrameGap(uint32_t microseconds) { frameGap = microseconds; }
+    
+    /** Seed the generator behind the faults, the same seed gives the same faults.
+     * 
+     * @param seed Anything but 0.
+     */
+    
+    void setSeed(uint32_t seed) { randomState = seed ? seed : 1; }
+    
+    /** Set the number of files on the (single, emulated) source.
+     * 
+     * @param files Files, numbered from 1.
+     */
+    
+    void setFileCount(uint16_t files) { fileCount = files ? files : 1; }
+    
+    /** Set the length of every track.
+     * 
+     * @param seconds Length, 0 makes tracks play forever.
+     */
+    
+    void setTrackLength(uint16_t seconds) { trackLength = seconds; }
+    
+    /** Set how many files are in each folder, the files are divided into
+     *  folders of this many, in order.
+     * 
+     * @param files Files in a folder, 0 for all in one.
+     */
+    
+    void setFolderSize(uint16_t files) { folderSize = files; }
+    
+    ///@}
+    
+    /** @name Emulated State
+     * 
+     */
+    ///@{
+    
+    /** @return MP3_STATUS_STOPPED, MP3_STATUS_PLAYING or MP3_STATUS_PAUSED */
+    
+    uint8_t  status()         { advance(); return playStatus; }
+    
+    /** @return The index number of the current file. */
+    
+    uint16_t index()          { advance(); return currentIndex; }
+    
+    /** @return Seconds into the current file. */
+    
+    uint16_t position();
+    
+    /** @return Current volume, 0 to 30. */
+    
+    uint8_t  volume()         { return currentVolume; }
+    
+    ///@}
+    
+    /** @name Counters
+     * 
+     */
+    ///@{
+    
+    uint32_t framesReceived() { return rxFrames;   } ///< Good frames which arrived from the library
+    uint32_t badFrames()      { return rxBad;      } ///< Frames from the library with a bad checksum
+    uint32_t tracksEnded()    { return trackEnds;  } ///< Tracks which played to the end
+    uint32_t polls()          { return pollCount;  } ///< Calls to available(), the busy waiting done on the mock
+    uint32_t overflows()      { return lostBytes;  } ///< Response bytes dropped because MP3_MOCK_BUFFER was full
+    uint32_t framesIgnored()  { return rxIgnored;  } ///< Good frames which came too soon after another, see setFrameGap()
+    
+    /** Zero the counters. */
+    
+    void resetCounters() { rxFrames = rxBad = trackEnds = pollCount = lostBytes = rxIgnored = 0; }
+    
+    ///@}
+    
+    /** @name Stream
+     * 
+     */
+    ///@{
+    
+    virtual int    available();
+    virtual int    read();
+    virtual int    peek();
+    virtual size_t write(uint8_t b);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    virtual void   flush() { }
+    
+    using Print::write;
+    
+    ///@}
+    
+  protected:
+    
+    /** Run the emulation up to now: track ends and unsolicited position frames. */
+    
+    void advance();
+    
+    /** Act on a complete, good frame from the library. */
+    
+    void handleFrame();
+    
+    /** Queue a response frame behind whatever is already on the wire. 
+     * 
+     * @param unsolicited True if the frame isn't an answer, faults are not applied to these.
+     */
+    
+    void respond(uint8_t command, const uint8_t *data, uint8_t length, uint8_t unsolicited = false);
+    
+    /** Put one byte on the wire, it becomes readable once the time has come. */
+    
+    void transmit(uint8_t b, uint32_t due);
+    
+    /** Start a file playing from the beginning.
+     * 
+     * @param index   The file.
+     * @param startAt millis() it started, when a file follows another it starts as that one ended.
+     */
+    
+    void startTrack(uint16_t index, uint32_t startAt);
+    
+    /** The current file has finished, do as the loop mode (or playlist) says. */
+    
+    void endTrack();
+    
+    /** Answer the position query, or send the periodic report. */
+    
+    void respondPosition(uint8_t unsolicited);
+    
+    /** @return True with a probability of per256 out of 256. */
+    
+    uint8_t chance(uint8_t per256);
+    
+    // Configuration
+    uint32_t byteTime;
+    uint32_t latency      = 2000;
+    uint32_t frameGap     = 0;
+    uint32_t randomState  = 0x2545F491;
+    uint16_t fileCount    = 20;
+    uint16_t trackLength  = 30;
+    uint16_t folderSize   = 0;
+    uint8_t  noiseRate    = 0;
+    uint8_t  corruptRate  = 0;
+    uint8_t  dropRate     = 0;
+    
+    // Emulated device
+    uint8_t  playStatus    = MP3_STATUS_STOPPED;
+    uint8_t  currentVolume = 20;
+    uint8_t  currentEq     = MP3_EQ_NORMAL;
+    uint8_t  loopMode      = MP3_LOOP_ONE_STOP;
+    uint8_t  source        = MP3_SRC_SDCARD;
+    uint16_t currentIndex  = 1;
+    uint32_t startedAt     = 0;  // millis() the current file would have started, had it played without pause
+    uint32_t pausedAt      = 0;  // millis() it was paused at (when paused)
+    uint16_t resumeIndex   = 0;  // File an interjection returns to, 0 if none
+    uint32_t resumeOffset  = 0;  // And how far into it, in ms
+    
+    uint8_t  positionReports = false;
+    uint32_t nextReportAt    = 0;
+    
+    uint8_t  playlist[MP3_MOCK_FRAME_DATA / 2];
+    uint8_t  playlistLength = 0;
+    uint8_t  playlistNext   = 0;
+    
+    // Frame coming from the library
+    uint8_t  frame[3 + MP3_MOCK_FRAME_DATA];
+    uint16_t frameFill   = 0;
+    uint8_t  frameLength = 0;
+    uint8_t  frameSum    = 0;
+    uint32_t lineFreeAt  = 0;   // micros() when the last byte from the library has fully arrived
+    uint32_t frameEndAt  = 0;   // micros() the last frame from the library ended
+    uint8_t  frameEnded  = false;
+    uint8_t  frameEarly  = false; // This frame started too soon after that, see setFrameGap()
+    
+    // Response bytes on the wire, a ring
+    uint8_t  txBytes[MP3_MOCK_BUFFER];
+    uint32_t txDue[MP3_MOCK_BUFFER];
+    uint8_t  txHead  = 0;
+    uint8_t  txCount = 0;
+    uint32_t txFreeAt = 0;      // micros() when the last byte we queued will have been sent
+    
+    // Counters
+    uint32_t rxFrames  = 0;
+    uint32_t rxBad     = 0;
+    uint32_t trackEnds = 0;
+    uint32_t pollCount = 0;
+    uint32_t lostBytes = 0;
+    uint32_t rxIgnored = 0;
+};
+
+#endif
@@ -0,0 +1,178 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "JQ8400_Replay.h"
+
+#if MP3_TRACE
+
+void JQ8400_Replay::start(JQ8400_Trace &recorded, JQ8400_Trace *observed)
+{
+  this->recorded = &recorded;
+  this->observed = observed;
+  if(observed) observed->clear();
+  
+  sendNext   = expectNext = 0;
+  sendTime   = expectTime = 0;
+  frameFill  = 0;
+  frameSum   = 0;
+  
+  countSent  = countMatched = countDiffered = countMissing = countUnexpected = 0;
+  
+  // The oldest frame is sent at once, whatever came before it
+  lastTime = 0;
+  for(uint8_t x = 1; x < recorded.count; x++) lastTime += at(x).delta;
+  
+  this->nextExpected();
+  
+  startedAt = micros();
+}
+
+const JQ8400_Trace::Record &JQ8400_Replay::at(uint8_t position)
+{
+  return recorded->records[(recorded->oldest() + position) % MP3_TRACE_RECORDS];
+}
+
+uint8_t JQ8400_Replay::update()
+{
+  if(!recorded) return false;
+  
+  uint32_t now = micros() - startedAt;
+  
+  while(sendNext < recorded->count && (int32_t)(now - sendTime) >= 0)
+  {
+    if((at(sendNext).event & 0x7F) == MP3_TRACE_TX) this->send();
+    if(++sendNext < recorded->count) sendTime += at(sendNext).delta;
+  }
+  
+  while(device.available())
+  {
+    uint8_t b = device.read();
+    
+    // Between frames anything but a start byte is noise
+    if(!frameFill && b != JQ8400_Serial::MP3_CMD_BEGIN) continue;
+    
+    if(frameFill < 3 || frameFill < 3 + frame[2])
+    {
+      if(frameFill < sizeof(frame)) frame[frameFill] = b;
+      frameSum += b;
+      frameFill++;
+      continue;
+    }
+    
+    // This is the checksum
+    this->received(b == frameSum);
+    frameFill = 0;
+    frameSum  = 0;
+  }
+  
+  // A response that hasn't come by now isn't coming
+  now = micros() - startedAt;
+  while(expectNext < recorded->count && (int32_t)(now - expectTime) > MP3_REPLAY_SLACK)
+  {
+    countMissing++;
+    if(++expectNext < recorded->count) expectTime += at(expectNext).delta;
+    this->nextExpected();
+  }
+  
+  // Done once everything is sent, and anything not recorded has had time to show up
+  if(sendNext >= recorded->count && expectNext >= recorded->count && (int32_t)(now - lastTime) > MP3_REPLAY_SLACK)
+  {
+    recorded = NULL;
+    return false;
+  }
+  
+  return true;
+}
+
+void JQ8400_Replay::send()
+{
+  const JQ8400_Trace::Record &r = at(sendNext);
+  
+  // What wasn't kept goes as zeros, so it takes as long to send
+  uint8_t kept = (r.event & 0x80) ? 0 : (r.length < MP3_TRACE_DATA ? r.length : MP3_TRACE_DATA);
+  uint8_t sum  = JQ8400_Serial::MP3_CMD_BEGIN + r.command + r.length;
+  
+  device.write(JQ8400_Serial::MP3_CMD_BEGIN);
+  device.write(r.command);
+  device.write(r.length);
+  for(uint8_t x = 0; x < r.length; x++)
+  {
+    uint8_t b = x < kept ? r.data[x] : 0;
+    sum += b;
+    device.write(b);
+  }
+  device.write(sum);
+  
+  if(observed) observed->add(MP3_TRACE_TX, r.command, kept ? r.data : NULL, r.length);
+  countSent++;
+}
+
+void JQ8400_Replay::nextExpected()
+{
+  while(expectNext < recorded->count)
+  {
+    uint8_t event = at(expectNext).event & 0x7F;
+    if(event == MP3_TRACE_RX || event == MP3_TRACE_RX_BAD) return;
+    
+    if(++expectNext < recorded->count) expectTime += at(expectNext).delta;
+  }
+}
+
+void JQ8400_Replay::received(uint8_t good)
+{
+  uint8_t  length = frame[2];
+  uint8_t  kept   = length < MP3_TRACE_DATA ? length : MP3_TRACE_DATA;
+  uint32_t now    = micros() - startedAt;
+  
+  if(observed) observed->add(good ? MP3_TRACE_RX : MP3_TRACE_RX_BAD, frame[1], frame + 3, length);
+  
+  // Too early to be the next one recorded, or there are no more
+  if(expectNext >= recorded->count || (int32_t)(expectTime - now) > MP3_REPLAY_SLACK)
+  {
+    countUnexpected++;
+    return;
+  }
+  
+  const JQ8400_Trace::Record &r = at(expectNext);
+  
+  if((r.event & 0x7F) == MP3_TRACE_RX_BAD
+  || (good && r.command == frame[1] && r.length == length && !memcmp(r.data, frame + 3, (r.event & 0x80) ? 0 : kept)))
+  {
+    countMatched++;
+  }
+  else
+  {
+    countDiffered++;
+  }
+  
+  if(++expectNext < recorded->count) expectTime += at(expectNext).delta;
+  this->nextExpected();
+}
+
+#endif
@@ -0,0 +1,172 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Replay_h
+#define JQ8400Replay_h
+
+#include "JQ8400_Trace.h"
+
+#if MP3_TRACE
+
+// us either side of its recorded time that a response can arrive and still
+//  be taken as the one recorded
+#ifndef MP3_REPLAY_SLACK
+#define MP3_REPLAY_SLACK 20000
+#endif
+
+/** Play a recorded JQ8400_Trace against a device, usually a JQ8400_Mock, 
+ *  to reproduce what happened in the field, only when MP3_TRACE is set to 1.
+ * 
+ * The frames that were sent are sent again at the same intervals, and what 
+ *  comes back is compared with what was received: a response that differs,
+ *  one which was received but doesn't come now (within MP3_REPLAY_SLACK of 
+ *  when it was), and one which comes now but wasn't received, are counted.
+ * 
+ * Played against the mock on a host build with a simulated clock the 
+ *  outcome is the same every time, so a timing problem seen once can be
+ *  stepped through.  For example, the device ignores a frame which comes 
+ *  too soon after another, which is why reset() needs a gap between its
+ *  frames, with JQ8400_Mock::setFrameGap() a trace from a module which
+ *  didn't answer after a reset shows the same missing responses.
+ * 
+ * Only the first MP3_TRACE_DATA bytes of each frame are recorded, the 
+ *  rest of a longer frame (a path, a playlist) are sent as zeros, so the 
+ *  frame takes the same time on the wire, but may not do the same thing.
+ * 
+ * **Example**
+ * 
+ *     JQ8400_Mock   device;
+ *     JQ8400_Trace  recorded;
+ *     JQ8400_Trace  observed;
+ *     JQ8400_Replay replay(device);
+ *     
+ *     recorded.load(file);           // What JQ8400_Trace::save() wrote
+ *     device.setFrameGap(1000);
+ *     
+ *     replay.start(recorded, &observed);
+ *     while(replay.update());
+ *     
+ *     observed.dump(Serial);         // What the mock did with it
+ */
+
+class JQ8400_Replay
+{
+  public:
+    
+    /** @param device The stream to replay to. */
+    
+    JQ8400_Replay(Stream &device) : device(device) { }
+    
+    /** Begin replaying, from the oldest recorded frame, which is sent at once.
+     * 
+     * @param recorded What to replay, it must not be changed until done.
+     * @param observed If given, it is cleared and the frames sent and received now are recorded in it.
+     */
+    
+    void start(JQ8400_Trace &recorded, JQ8400_Trace *observed = NULL);
+    
+    /** Stop replaying. */
+    
+    void stop() { recorded = NULL; }
+    
+    /** Send the frames whose time has come, and read the responses.
+     * 
+     * @return True while replaying, false once all has been sent and the 
+     *  last response has had time to arrive.
+     */
+    
+    uint8_t update();
+    
+    /** @return True while replaying. */
+    
+    uint8_t active() { return recorded != NULL; }
+    
+    /** @name Outcome
+     * 
+     */
+    ///@{
+    
+    uint16_t sent()       { return countSent;       } ///< Frames sent
+    uint16_t matched()    { return countMatched;    } ///< Responses the same as recorded (a corrupted one matches any)
+    uint16_t differed()   { return countDiffered;   } ///< Responses which came when they should, but were not the same
+    uint16_t missing()    { return countMissing;    } ///< Responses recorded which did not come
+    uint16_t unexpected() { return countUnexpected; } ///< Responses which came but were not recorded
+    
+    /** @return True if every response was as recorded. */
+    
+    uint8_t  reproduced() { return !countDiffered && !countMissing && !countUnexpected; }
+    
+    ///@}
+    
+  protected:
+    
+    /** @return The recorded frame at a position, 0 is the oldest. */
+    
+    const JQ8400_Trace::Record &at(uint8_t position);
+    
+    /** Send the recorded frame at sendNext. */
+    
+    void send();
+    
+    /** Move expectNext on to the next response at or after it. */
+    
+    void nextExpected();
+    
+    /** A whole frame has come from the device, see if it is the one expected.
+     * 
+     * @param good False if it's checksum was wrong.
+     */
+    
+    void received(uint8_t good);
+    
+    Stream       &device;
+    JQ8400_Trace *recorded = NULL;  ///< What is replayed, NULL when not
+    JQ8400_Trace *observed = NULL;  ///< See start()
+    
+    uint32_t startedAt  = 0;        ///< micros() replay started
+    uint8_t  sendNext   = 0;        ///< Position of the next frame to send
+    uint32_t sendTime   = 0;        ///< It's time, in us from the start
+    uint8_t  expectNext = 0;        ///< Position of the next response expected
+    uint32_t expectTime = 0;        ///< It's time, in us from the start
+    uint32_t lastTime   = 0;        ///< Time of the last record
+    
+    // Frame coming from the device
+    uint8_t  frame[3 + MP3_TRACE_DATA];
+    uint16_t frameFill = 0;
+    uint8_t  frameSum  = 0;
+    
+    uint16_t countSent       = 0;
+    uint16_t countMatched    = 0;
+    uint16_t countDiffered   = 0;
+    uint16_t countMissing    = 0;
+    uint16_t countUnexpected = 0;
+};
+
+#endif
+
+#endif
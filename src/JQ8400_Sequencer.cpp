@@ -0,0 +1,226 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "JQ8400_Sequencer.h"
+
+void JQ8400_Sequencer::start(uint8_t kind, const uint16_t *list, uint16_t length)
+{
+  // A query still out about the last sequence is dropped, it's slot is reclaimed once done
+  this->kind   = kind;
+  this->list   = list;
+  this->length = length;
+  state        = MP3_SEQUENCER_IDLE;
+  request      = 0;
+  at           = 0;
+  playingAt    = 0;
+  
+  // Each file must stop at it's end, rather than carry on to the next index
+  mp3.setLoopMode(MP3_LOOP_ONE_STOP);
+  
+  current = this->fileAt(0);
+  if(current) this->send();
+}
+
+void JQ8400_Sequencer::stop()
+{
+  state   = MP3_SEQUENCER_IDLE;
+  request = 0;
+  mp3.stop();
+}
+
+uint16_t JQ8400_Sequencer::fileAt(uint16_t position)
+{
+  switch(kind)
+  {
+    case MP3_SEQUENCER_NUMBERS:   return position < length ? list[position] : 0;
+    case MP3_SEQUENCER_NUMBERS_P: return position < length ? pgm_read_word(&list[position]) : 0;
+    default:                      return generator(mp3, position);
+  }
+}
+
+void JQ8400_Sequencer::send()
+{
+  uint8_t data[2] = { (uint8_t)(current >> 8), (uint8_t)(current & 0xFF) };
+  
+  state   = MP3_SEQUENCER_SENDING;
+  request = mp3.queueCommand(JQ8400_Serial::MP3_CMD_PLAY_IDX, data, sizeof(data));
+  if(!request) return;
+  
+  confirms = 0;
+  mp3.invalidateShadow(MP3_SHADOW_STATUS);
+  mp3.invalidateShadow(MP3_SHADOW_INDEX);
+  mp3.invalidateShadow(MP3_SHADOW_POSITION);
+}
+
+void JQ8400_Sequencer::ask(uint8_t step)
+{
+  uint8_t command;
+  
+  switch(step)
+  {
+    case MP3_SEQUENCER_LENGTH: command = JQ8400_Serial::MP3_CMD_CURRENT_FILE_LEN; break;
+    case MP3_SEQUENCER_POLL:   command = JQ8400_Serial::MP3_CMD_STATUS; polls++;   break;
+    default:                   command = JQ8400_Serial::MP3_CMD_CURRENT_FILE_IDX; break;
+  }
+  
+  state   = step;
+  request = mp3.queueCommand(command, NULL, 0, true);
+}
+
+void JQ8400_Sequencer::ended()
+{
+  at++;
+  current = staged;
+  request = 0;
+  
+  if(current) this->send();
+  else        state = MP3_SEQUENCER_IDLE;
+}
+
+void JQ8400_Sequencer::update()
+{
+  mp3.update();
+  
+  switch(state)
+  {
+    case MP3_SEQUENCER_IDLE:
+      return;
+      
+    case MP3_SEQUENCER_SENDING:
+      if(!request) 
+      {
+        this->send();
+        return;
+      }
+      
+      // Sent is as far as the play goes, it has no response
+      mp3.collectRequest(request);
+      if(request) return;
+      
+      sentAt  = millis();
+      
+      if(playingAt)
+      {
+        gapLast   = sentAt - playingAt;
+        gapTotal += gapLast;
+        gaps++;
+        if(gapLast > gapMax) gapMax = gapLast;
+        playingAt = 0;
+      }
+      
+      this->ask(MP3_SEQUENCER_CONFIRM);
+      return;
+      
+    case MP3_SEQUENCER_WAIT:
+      if((int32_t)(millis() - checkAt) >= 0) this->ask(MP3_SEQUENCER_POLL);
+      return;
+      
+    case MP3_SEQUENCER_POLL:
+      // Something else (status tracking say) may have seen the stop before us
+      if(mp3.shadowValid(MP3_SHADOW_STATUS) && mp3.shadowValue(MP3_SHADOW_STATUS) == MP3_STATUS_STOPPED)
+      {
+        this->ended();
+        return;
+      }
+      break;
+  }
+  
+  // Whatever is left is waiting on a query, which may not have found room
+  if(!request)
+  {
+    this->ask(state);
+    return;
+  }
+  
+  uint8_t data[3];
+  uint8_t length;
+  uint8_t result = mp3.collectRequest(request, data, sizeof(data), &length);
+  if(!request) this->answered(result, data, length);
+}
+
+void JQ8400_Sequencer::answered(uint8_t result, const uint8_t *data, uint8_t length)
+{
+  uint8_t  done  = result == MP3_REQUEST_DONE;
+  uint16_t index = (done && length >= 2) ? (data[0] << 8) | data[1] : 0;
+  
+  switch(state)
+  {
+    case MP3_SEQUENCER_CONFIRM:
+      // It may take the device a moment to start, and until then the length would be of the last file
+      if(index != current && ++confirms < MP3_SEQUENCER_CONFIRMS)
+      {
+        this->ask(MP3_SEQUENCER_CONFIRM);
+        return;
+      }
+      this->ask(MP3_SEQUENCER_LENGTH);
+      return;
+      
+    case MP3_SEQUENCER_LENGTH:
+      // Stage the next file now, so there's nothing to do at the end but send it
+      staged = this->fileAt(at + 1);
+      
+      // The length is in whole seconds, the end is somewhere in the second after it
+      if(done && length >= 3)
+      {
+        uint32_t ms = ((data[0] * 60UL * 60) + (data[1] * 60) + data[2]) * 1000;
+        checkAt = sentAt + (ms > MP3_SEQUENCE_LEAD ? ms - MP3_SEQUENCE_LEAD : 0);
+        lateAt  = sentAt + ms + 1000 + MP3_SEQUENCE_LEAD;
+      }
+      else
+      {
+        checkAt = lateAt = millis() + MP3_SEQUENCE_POLL;
+      }
+      state = MP3_SEQUENCER_WAIT;
+      return;
+      
+    case MP3_SEQUENCER_POLL:
+    {
+      uint8_t status = (done && length) ? data[0] : 0xFF;
+      
+      if(status == MP3_STATUS_STOPPED)
+      {
+        this->ended();
+        return;
+      }
+      
+      if(status == MP3_STATUS_PLAYING) playingAt = millis();
+      
+      // Back to back until it should have ended, then (or while paused) slower
+      if(status != MP3_STATUS_PAUSED && (int32_t)(millis() - lateAt) < 0)
+      {
+        this->ask(MP3_SEQUENCER_POLL);
+        return;
+      }
+    }
+      break;
+  }
+  
+  checkAt = millis() + MP3_SEQUENCE_POLL;
+  state   = MP3_SEQUENCER_WAIT;
+}
@@ -0,0 +1,250 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Sequencer_h
+#define JQ8400Sequencer_h
+
+#include "JQ8400_Serial.h"
+
+// ms before a track's predicted end to start watching for it to stop
+#ifndef MP3_SEQUENCE_LEAD
+#define MP3_SEQUENCE_LEAD 100
+#endif
+
+// ms between status checks while paused, or when the length isn't known
+#ifndef MP3_SEQUENCE_POLL
+#define MP3_SEQUENCE_POLL 250
+#endif
+
+/** Give the FAT index of the file at a position in a sequence.
+ * 
+ * @param mp3      The device.
+ * @param position 0 for the first file of the sequence, then 1, 2...
+ * @return FAT index of the file to play there, 0 to end the sequence.
+ */
+
+typedef uint16_t (*JQ8400_IndexGenerator)(JQ8400_Serial &mp3, uint16_t position);
+
+/** Play a sequence of files, one after the other, with as short a gap 
+ *  between them as the device allows.
+ * 
+ * Waiting for busy() and then playFileByIndexNumber() leaves several 
+ *  hundred ms of silence, the polling interval, plus the time for the 
+ *  query, plus the command.  Instead the sequencer asks the length of 
+ *  each file as it starts and sleeps until just before it should end
+ *  (MP3_SEQUENCE_LEAD), only then does it ask the status, back to back 
+ *  through the asynchronous engine, so that the stop is seen within a 
+ *  single round trip.  The next file is found (and it's command built) 
+ *  while the current one is still playing, so it goes out right behind 
+ *  the status response that saw the stop.  If something else keeps the 
+ *  status up to date (see JQ8400_Serial::setStatusTracking()) a stop it 
+ *  sees is used straight away.
+ * 
+ * The sequence is played file by file, so unlike 
+ *  JQ8400_Serial::playSequenceByFileNumber() it can have any length
+ *  and any FAT index, generated as it goes if you like.
+ * 
+ * Note that the device's seek (JQ8400_Serial::seekFileByIndexNumber()) 
+ *  stops whatever is playing, so the next file can't be staged on the
+ *  device itself, and a seek and a play after the stop would be two
+ *  commands where a play by index is one.
+ * 
+ * **Example**
+ * 
+ *     const uint16_t tracks[] = { 7, 3, 300, 12 };
+ *     
+ *     JQ8400_Serial    mp3(Serial2);
+ *     JQ8400_Sequencer sequencer(mp3);
+ *     
+ *     void setup()
+ *     {
+ *       sequencer.play(tracks, 4);
+ *     }
+ *     
+ *     void loop()
+ *     {
+ *       sequencer.update();
+ *     }
+ */
+
+class JQ8400_Sequencer
+{
+  public:
+    
+    /** Create a sequencer for the given device.
+     * 
+     * @param mp3 The device.
+     */
+    
+    JQ8400_Sequencer(JQ8400_Serial &_mp3) : mp3(_mp3) { }
+    
+    /** Play a sequence of files held in RAM (it must stay put until done).
+     * 
+     * @param fileNumbers FAT index of each file.
+     * @param length      Number of files.
+     */
+    
+    void play(const uint16_t *fileNumbers, uint16_t length) { this->start(MP3_SEQUENCER_NUMBERS, fileNumbers, length); }
+    
+    /** Play a sequence of files held in PROGMEM.
+     * 
+     * @param fileNumbers FAT index of each file.
+     * @param length      Number of files.
+     */
+    
+    void play_P(const uint16_t *fileNumbers, uint16_t length) { this->start(MP3_SEQUENCER_NUMBERS_P, fileNumbers, length); }
+    
+    /** Play the files a generator gives, until it gives 0.
+     * 
+     * @param generator Gives the file for each position.
+     */
+    
+    void play(JQ8400_IndexGenerator generator) { this->generator = generator; this->start(MP3_SEQUENCER_GENERATOR, NULL, 0xFFFF); }
+    
+    /** Stop the sequence (and the device). */
+    
+    void stop();
+    
+    /** Advance the sequence, and the device's asynchronous engine, call this 
+     *  frequently from your `loop()`.  Never waits.
+     */
+    
+    void update();
+    
+    /** @return True while a sequence is being played. */
+    
+    uint8_t  active()   { return state != MP3_SEQUENCER_IDLE; }
+    
+    /** @return Position in the sequence of the file playing (0 is the first). */
+    
+    uint16_t position() { return at; }
+    
+    /** @return FAT index of the file playing, 0 if none. */
+    
+    uint16_t playing()  { return active() ? current : 0; }
+    
+    /** @name Statistics
+     * 
+     * The gap is from the last status which said the file was still playing,
+     *  to the next file's command being written, so it's an upper limit of 
+     *  how long we took to notice the end and act on it (the device itself
+     *  takes a few ms more to start playing).
+     */
+    ///@{
+    
+    uint16_t lastGap()     { return gapLast; }                              ///< Gap (ms) before the last file
+    uint16_t maxGap()      { return gapMax; }                               ///< Worst gap (ms)
+    uint16_t averageGap()  { return gaps ? gapTotal / gaps : 0; }           ///< Average gap (ms)
+    uint16_t countPolls()  { return polls; }                                ///< Status queries made
+    
+    /** Zero the statistics. */
+    
+    void resetStats() { gapLast = gapMax = gaps = polls = 0; gapTotal = 0; }
+    
+    ///@}
+    
+  protected:
+    
+    static const uint8_t MP3_SEQUENCER_IDLE    = 0;  ///< No sequence
+    static const uint8_t MP3_SEQUENCER_SENDING = 1;  ///< Play queued, waiting for it to be sent
+    static const uint8_t MP3_SEQUENCER_CONFIRM = 2;  ///< Asking the index, to see it started
+    static const uint8_t MP3_SEQUENCER_LENGTH  = 3;  ///< Asking the length, to know when it will end
+    static const uint8_t MP3_SEQUENCER_WAIT    = 4;  ///< Waiting until it's nearly ended
+    static const uint8_t MP3_SEQUENCER_POLL    = 5;  ///< Asking the status, to see it ended
+    
+    static const uint8_t MP3_SEQUENCER_CONFIRMS = 3; ///< Index checks for the start before going on regardless
+    
+    static const uint8_t MP3_SEQUENCER_NUMBERS   = 0;
+    static const uint8_t MP3_SEQUENCER_NUMBERS_P = 1;
+    static const uint8_t MP3_SEQUENCER_GENERATOR = 2;
+    
+    /** Begin a sequence.
+     * 
+     * @param kind   One of MP3_SEQUENCER_NUMBERS, MP3_SEQUENCER_NUMBERS_P, MP3_SEQUENCER_GENERATOR
+     * @param list   The list, or NULL for a generator
+     * @param length Number of files (0xFFFF for a generator, it says when to end)
+     */
+    
+    void start(uint8_t kind, const uint16_t *list, uint16_t length);
+    
+    /** @return FAT index of the file at the given position, 0 if past the end. */
+    
+    uint16_t fileAt(uint16_t position);
+    
+    /** Queue the play of the staged file, or end the sequence if there is none. */
+    
+    void send();
+    
+    /** Queue the query of a step, and move to that step.
+     * 
+     * If the queue is full, update() tries again.
+     * 
+     * @param step One of the MP3_SEQUENCER_* which asks something
+     */
+    
+    void ask(uint8_t step);
+    
+    /** Take the answer to the step's query and move on.
+     * 
+     * @param result MP3_REQUEST_*
+     * @param data   Response data
+     * @param length Number of bytes
+     */
+    
+    void answered(uint8_t result, const uint8_t *data, uint8_t length);
+    
+    /** The current file has ended, go to the next. */
+    
+    void ended();
+    
+    JQ8400_Serial        &mp3;                                    ///< The device
+    
+    uint8_t               kind         = MP3_SEQUENCER_NUMBERS;  ///< What list is
+    const uint16_t       *list         = NULL;                  ///< The files, if not generated
+    JQ8400_IndexGenerator generator    = NULL;                  ///< Gives the files, if generated
+    uint16_t              length       = 0;                     ///< Number of files in list
+    
+    uint8_t               state        = MP3_SEQUENCER_IDLE;    ///< MP3_SEQUENCER_*
+    uint8_t               request      = 0;                     ///< Handle of our request in the engine, 0 if none
+    uint8_t               confirms     = 0;                     ///< Index checks made for the start
+    uint16_t              at           = 0;                     ///< Position in the sequence of the current file
+    uint16_t              current      = 0;                     ///< FAT index of the current file
+    uint16_t              staged       = 0;                     ///< FAT index of the next file, 0 for the end
+    uint32_t              sentAt       = 0;                     ///< millis() the current file was sent
+    uint32_t              checkAt      = 0;                     ///< millis() to start checking for the end
+    uint32_t              lateAt       = 0;                     ///< millis() by which it should certainly have ended
+    uint32_t              playingAt    = 0;                     ///< millis() a status last said it was playing, 0 if not seen
+    
+    uint16_t              gapLast      = 0;                     ///< See lastGap()
+    uint16_t              gapMax       = 0;                     ///< See maxGap()
+    uint32_t              gapTotal     = 0;                     ///< Sum of the gaps, for averageGap()
+    uint16_t              gaps         = 0;                     ///< Number of gaps measured
+    uint16_t              polls        = 0;                     ///< See countPolls()
+};
+
+#endif
@@ -29,51 +29,78 @@
 #include <Arduino.h>
 #include "JQ8400_Serial.h"
 
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#endif
+
+// See MP3_LAYOUT, the value doesn't matter, only the name
+extern const volatile uint8_t MP3_LAYOUT = 1;
+
+#if MP3_RAM_BUDGET
+static_assert(sizeof(JQ8400_Serial) <= MP3_RAM_BUDGET, "JQ8400_Serial uses more RAM than MP3_RAM_BUDGET, see there for what can be reduced");
+#endif
+
 void  JQ8400_Serial::play()
 {
-  this->sendCommand(MP3_CMD_PLAY);
+  invalidateShadow(MP3_SHADOW_STATUS);
+  this->sendFrame(JQ8400_Frame<MP3_CMD_PLAY>::bytes);
 }
 
 void  JQ8400_Serial::restart()
 {
-  this->sendCommand(MP3_CMD_STOP); // Make sure really will restart
-  this->sendCommand(MP3_CMD_PLAY);
+  invalidateShadow(MP3_SHADOW_STATUS);
+  this->sendFrame(JQ8400_Frame<MP3_CMD_STOP>::bytes); // Make sure really will restart
+  this->sendFrame(JQ8400_Frame<MP3_CMD_PLAY>::bytes);
 }
 
 void  JQ8400_Serial::pause()
 {
-  this->sendCommand(MP3_CMD_PAUSE);
+  invalidateShadow(MP3_SHADOW_STATUS);
+  this->sendFrame(JQ8400_Frame<MP3_CMD_PAUSE>::bytes);
 }
 
 void  JQ8400_Serial::stop()
 {
-  this->sendCommand(MP3_CMD_STOP);
+  this->stopping();
+  this->sendFrame(JQ8400_Frame<MP3_CMD_STOP>::bytes);
 }
 
 void  JQ8400_Serial::next()
 {
-  this->sendCommand(MP3_CMD_NEXT);
+  this->trackChanging();
+  this->sendFrame(JQ8400_Frame<MP3_CMD_NEXT>::bytes);
 }
 
 void  JQ8400_Serial::prev()
 {
-  this->sendCommand(MP3_CMD_PREV);
+  this->trackChanging();
+  this->sendFrame(JQ8400_Frame<MP3_CMD_PREV>::bytes);
 }
 
 void  JQ8400_Serial::playFileByIndexNumber(uint16_t fileNumber)
 {  
+  this->trackChanging();
+  currentIndex = fileNumber;
+  markShadow(MP3_SHADOW_INDEX);
   // this->sendCommand(MP3_CMD_PLAY_IDX, (fileNumber>>8) & 0xFF, fileNumber & (byte)0xFF);
   this->sendCommand(MP3_CMD_PLAY_IDX, fileNumber);
 }
 
 void  JQ8400_Serial::interjectFileByIndexNumber(uint16_t fileNumber)
 {  
+  // Not trackChanging(), once done the device returns to what it was playing
+  invalidateShadow(MP3_SHADOW_STATUS);
+  invalidateShadow(MP3_SHADOW_INDEX);
+  invalidateShadow(MP3_SHADOW_POSITION);
   uint8_t buf[3] = { getSource(), (uint8_t)((fileNumber>>8)&0xFF), (uint8_t)(fileNumber & (byte)0xFF) };
   this->sendCommandData(MP3_CMD_INSERT_IDX, buf, 3, 0, 0);
 }
 
 void  JQ8400_Serial::seekFileByIndexNumber(uint16_t fileNumber)
 {  
+  this->trackChanging();
+  currentIndex = fileNumber;
+  markShadow(MP3_SHADOW_INDEX);
   // this->sendCommand(MP3_CMD_SEEK_IDX, (fileNumber>>8) & 0xFF, fileNumber & (byte)0xFF);
   this->sendCommand(MP3_CMD_SEEK_IDX, fileNumber);
 }
@@ -86,7 +113,7 @@ void JQ8400_Serial::abLoopPlay(uint16_t secondsStart, uint16_t secondsEnd)
 
 void JQ8400_Serial::abLoopClear()
 {
-  this->sendCommand(MP3_CMD_AB_PLAY_STOP);
+  this->sendFrame(JQ8400_Frame<MP3_CMD_AB_PLAY_STOP>::bytes);
 }
 
 void JQ8400_Serial::fastForward(uint16_t seconds)
@@ -103,12 +130,14 @@ void JQ8400_Serial::rewind(uint16_t seconds)
 
 void  JQ8400_Serial::nextFolder()
 {
-  this->sendCommand(MP3_CMD_NEXT_FOLDER);
+  this->trackChanging();
+  this->sendFrame(JQ8400_Frame<MP3_CMD_NEXT_FOLDER>::bytes);
 }
 
 void  JQ8400_Serial::prevFolder()
 {
-  this->sendCommand(MP3_CMD_PREV_FOLDER);
+  this->trackChanging();
+  this->sendFrame(JQ8400_Frame<MP3_CMD_PREV_FOLDER>::bytes);
 }
 
 void  JQ8400_Serial::playFileNumberInFolderNumber(uint16_t folderNumber, uint16_t fileNumber)
@@ -120,136 +149,470 @@ void  JQ8400_Serial::playFileNumberInFolderNumber(uint16_t folderNumber, uint16_
   //  then slash separated path components, with a trailing wildcard fvor each one REQUIRED
   //  the basename of the file must have the wildcard also and the extention must be the 
   //  3 question mark character wildcards, you can't even match on ".mp3", damn this is weird
+  //
+  //  [source] /42*/032*???
+  
+  this->trackChanging();
+  
+  char  buf[13];
+  char *p = buf;
+  
+  *p++ = this->getSource();
+  *p++ = '/';
+  p    = fixedDecimal(p, folderNumber, 2);
+  *p++ = '*';
+  *p++ = '/';
+  p    = fixedDecimal(p, fileNumber, 3);
+  *p++ = '*';
+  *p++ = '?';
+  *p++ = '?';
+  *p++ = '?';
+  
+  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (uint8_t*)buf, p - buf, 0, 0);
+}
+
+void  JQ8400_Serial::playInFolderNumber(uint16_t folderNumber)
+{
+  //  [source] /42*/*???
+  
+  this->trackChanging();
+  
+  char  buf[10];
+  char *p = buf;
   
-  char buf[] = " /42*/032*???";
+  *p++ = this->getSource();
+  *p++ = '/';
+  p    = fixedDecimal(p, folderNumber, 2);
+  *p++ = '*';
+  *p++ = '/';
+  *p++ = '*';
+  *p++ = '?';
+  *p++ = '?';
+  *p++ = '?';
   
-  buf[0] = this->getSource();
+  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (uint8_t*)buf, p - buf, 0, 0);
+}
+
+uint8_t JQ8400_Serial::playFileByPath(const char *path)
+{
+  return this->writePath(path, false);
+}
+
+uint8_t JQ8400_Serial::playFileByPath_P(const char *path)
+{
+  return this->writePath(path, true);
+}
+
+char *JQ8400_Serial::fixedDecimal(char *out, uint16_t value, uint8_t width)
+{
+  static const uint16_t powers[5] PROGMEM = { 10000, 1000, 100, 10, 1 };
+  
+  // Each digit by repeated subtraction, at most 9 of each, digits beyond
+  //  the width are taken off but not written
+  for(uint8_t x = 0; x < 5; x++)
+  {
+    uint16_t power = pgm_read_word(&powers[x]);
+    char     digit = '0';
+    while(value >= power)
+    {
+      value -= power;
+      digit++;
+    }
+    
+    if(x >= 5 - width) *out++ = digit;
+  }
   
-  uint8_t i = 2; // 1st digit folder component
-  if(folderNumber<10)
+  return out;
+}
+
+uint8_t JQ8400_Serial::writePath(const char *path, uint8_t progmem)
+{
+  // What we will send is the source, the path (which must start with a 
+  //  slash) with a wildcard after each component (each slash starts one), 
+  //  and the extension wildcard
+  uint8_t  leading = (progmem ? pgm_read_byte(path) : *path) != '/';
+  uint16_t length  = 1 + leading * 2 + 3;
+  for(const char *c = path; ; c++)
   {
-    buf[i] = '0';
-    i++;
+    char ch = progmem ? pgm_read_byte(c) : *c;
+    if(!ch) break;
+    
+    length += (ch == '/') ? 2 : 1;
   }
-  itoa(folderNumber,&buf[i], 10);
   
-  i = 4;
-  buf[i] = '*'; // itoa clobbered this with it's null
+  // The length is a single byte
+  if(length > 255) return false;
+  
+  this->trackChanging();
   
-  i = 6; // 1st digit filename component
-  if(fileNumber < 100)
+  uint8_t frame[MP3_FRAME_DATA_LENGTH + 4] = { MP3_CMD_BEGIN, MP3_CMD_PLAY_FILE_FOLDER, (uint8_t)length, (uint8_t)this->getSource(), '/' };
+  uint8_t checksum = frame[0] + frame[1] + frame[2] + frame[3] + (leading ? frame[4] : 0);
+  uint8_t i        = leading ? 5 : 4;
+  
+  // Streamed, so like a query it must wait for the queue
+  this->prepareToSend();
+  
+  // Assembled as it is read, and written in buffer sized pieces
+  for(const char *c = path; ; c++)
   {
-    buf[i] = '0';
-    i++;
+    uint8_t ch = progmem ? pgm_read_byte(c) : *c;
+    
+    // Room for a wildcard and the character
+    if(i > sizeof(frame) - 2)
+    {
+      this->_Serial->write(frame, i);
+      i = 0;
+    }
+    
+    // End of a component
+    if((ch == '/' && c != path) || !ch)
+    {
+      frame[i++]  = '*';
+      checksum   += '*';
+    }
+    
+    if(!ch) break;
+    
+    frame[i++]  = ch;
+    checksum   += ch;
   }
   
-  if(fileNumber < 10)
+  // Room for the extension wildcard and the checksum
+  if(i > sizeof(frame) - 4)
   {
-      buf[i] = '0';
-      i++;
+    this->_Serial->write(frame, i);
+    i = 0;
   }
-  itoa(fileNumber, &buf[i], 10);
   
-  buf[9] = '*'; // itoa clobbered this with it's null
+  frame[i++] = '?';
+  frame[i++] = '?';
+  frame[i++] = '?';
+  frame[i++] = checksum + '?' * 3;
+  
+  this->_Serial->write(frame, i);
+  
+#if MP3_TRACE
+  this->trace(MP3_TRACE_TX, MP3_CMD_PLAY_FILE_FOLDER, NULL, length);
+#endif
   
-  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (uint8_t*)buf, sizeof(buf)-1, 0, 0);
+  this->frameWritten(length + 4);
+  return true;
 }
 
-void  JQ8400_Serial::playInFolderNumber(uint16_t folderNumber)
+uint8_t JQ8400_Serial::playSequenceByFileNumber(uint8_t playList[], uint16_t listLength)
 {
-  char buf[] = " /42*/*???";
+  if(!sequenceNumbersValid(playList, listLength, false)) return false;
   
-  buf[0] = this->getSource();
+  this->startSequence(MP3_PLAYLIST_NUMBERS, playList, NULL, listLength);
+  return true;
+}
+
+uint8_t JQ8400_Serial::playSequenceByFileNumber_P(const uint8_t *playList, uint16_t listLength)
+{
+  if(!sequenceNumbersValid(playList, listLength, true)) return false;
   
-  uint8_t i = 2; // 1st digit folder component
-  if(folderNumber<10)
+  this->startSequence(MP3_PLAYLIST_NUMBERS_P, playList, NULL, listLength);
+  return true;
+}
+
+uint8_t JQ8400_Serial::sequenceNumbersValid(const uint8_t *list, uint16_t length, uint8_t progmem)
+{
+  // Checked before anything is sent, a sequence longer than a segment would
+  //  otherwise find out part way through
+  for(uint16_t x = 0; x < length; x++)
   {
-    buf[i] = '0';
-    i++;
+    if((progmem ? pgm_read_byte(list + x) : list[x]) > 99) return false;
   }
-  itoa(folderNumber,&buf[i], 10);
   
-  i = 4;
-  buf[i] = '*'; // itoa clobbered this with it's null
+  return true;
+}
+
+void JQ8400_Serial::playSequenceByFileName(const char * playList[], uint16_t listLength)
+{
+  this->startSequence(MP3_PLAYLIST_NAMES, playList, NULL, listLength);
+}
+
+void JQ8400_Serial::playSequenceByFileName_P(const char *playList, uint16_t listLength)
+{
+  this->startSequence(MP3_PLAYLIST_NAMES_P, playList, NULL, listLength);
+}
+
+void JQ8400_Serial::playSequence(JQ8400_PlaylistGenerator generator, uint16_t listLength)
+{
+  this->startSequence(MP3_PLAYLIST_GENERATOR, NULL, generator, listLength);
+}
+
+void JQ8400_Serial::startSequence(uint8_t kind, const void *list, JQ8400_PlaylistGenerator generator, uint16_t length)
+{
+  this->trackChanging();
+  if(!length) return;
+  
+  playlistKind      = kind;
+  playlist          = list;
+  playlistGenerator = generator;
+  playlistLength    = length;
   
-  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (uint8_t*)buf, sizeof(buf)-1, 0, 0);
+  // Streamed straight to the line, so it can't go through the queue, but 
+  //  must not overtake anything in it
+  this->prepareToSend();
+  this->writePlaylist();
 }
 
-void JQ8400_Serial::playSequenceByFileNumber(uint8_t playList[], uint8_t listLength)
+void JQ8400_Serial::playlistEntry(uint16_t position, uint8_t name[2])
 {
-  char buf[listLength*2+1]; // itoa will need an extra null
+  uint8_t number = 0;
   
-  uint8_t i = 0;
-  for(uint8_t x = 0; x < listLength; x++)
+  switch(playlistKind)
   {
-    if(playList[x]<10)
-    {
-      buf[i++] = '0';
-    }
-    itoa(playList[x], &buf[i++], 10);
+    case MP3_PLAYLIST_NUMBERS:
+      number = ((const uint8_t *)playlist)[position];
+      break;
+      
+    case MP3_PLAYLIST_NUMBERS_P:
+      number = pgm_read_byte(((const uint8_t *)playlist) + position);
+      break;
+      
+    case MP3_PLAYLIST_NAMES:
+      name[0] = ((const char **)playlist)[position][0];
+      name[1] = ((const char **)playlist)[position][1];
+      return;
+      
+    case MP3_PLAYLIST_NAMES_P:
+      name[0] = pgm_read_byte(((const char *)playlist) + position * 2);
+      name[1] = pgm_read_byte(((const char *)playlist) + position * 2 + 1);
+      return;
+      
+    case MP3_PLAYLIST_GENERATOR:
+      playlistGenerator(*this, position, (char *)name);
+      return;
   }
   
-  this->sendCommandData(MP3_CMD_PLAYLIST, (uint8_t *)buf, sizeof(buf)-1, 0, 0);
+  // Numbers are always 2 digits, 00 to 99 (see sequenceNumbersValid())
+  name[0] = '0' + number / 10;
+  name[1] = '0' + number % 10;
 }
 
-void JQ8400_Serial::playSequenceByFileName(const char * playList[], uint8_t listLength)
+void JQ8400_Serial::writePlaylist()
 {
-  char buf[listLength*2];
+  uint16_t count = playlistLength - playlistSent;
+  if(count > MP3_PLAYLIST_SEGMENT) count = MP3_PLAYLIST_SEGMENT;
+  
+  uint8_t head[3]  = { MP3_CMD_BEGIN, MP3_CMD_PLAYLIST, (uint8_t)(count * 2) };
+  uint8_t checksum = head[0] + head[1] + head[2];
   
-  uint8_t i = 0;
-  for(uint8_t x = 0; x < listLength; x++)
+  this->_Serial->write(head, sizeof(head));
+  
+  for(uint16_t x = 0; x < count; x++)
   {
-    buf[i++] = playList[x][0];
-    buf[i++] = playList[x][1];
+    uint8_t name[2];
+    this->playlistEntry(playlistSent + x, name);
+    
+    this->_Serial->write(name, sizeof(name));
+    checksum += name[0] + name[1];
   }
   
-  this->sendCommandData(MP3_CMD_PLAYLIST, (uint8_t *)buf, sizeof(buf), 0, 0);
+  this->_Serial->write(checksum);
+  
+#if MP3_TRACE
+  this->trace(MP3_TRACE_TX, MP3_CMD_PLAYLIST, NULL, count * 2);
+#endif
+  
+  this->frameWritten(count * 2 + 4);
+  
+  playlistSent        += count;
+  playlistSegmentLeft  = count;
+  
+  // A segment at a time, we're done with the list once all is sent
+  if(playlistSent == playlistLength) this->cancelSequence();
+}
+
+void JQ8400_Serial::stopping()
+{
+  this->cancelSequence();
+  currentStatus = MP3_STATUS_STOPPED;
+  markShadow(MP3_SHADOW_STATUS);
+  seedStatusVote(MP3_STATUS_STOPPED);
+  invalidateShadow(MP3_SHADOW_POSITION);
+}
+
+void JQ8400_Serial::trackChanging()
+{
+  this->cancelSequence();
+  
+  invalidateShadow(MP3_SHADOW_STATUS);
+  invalidateShadow(MP3_SHADOW_INDEX);
+  invalidateShadow(MP3_SHADOW_POSITION);
 }
 
 void  JQ8400_Serial::volumeUp()
 {
+  setFlag(MP3_FLAG_FADE_ACTIVE, false);
+  if(isRedundant(MP3_SHADOW_VOLUME, 30)) return;
+  
   if(currentVolume < 30) currentVolume++;
-  this->sendCommand(MP3_CMD_VOL_UP); // We still send the command just in case we got out of sync somehow
+  this->sendFrame(JQ8400_Frame<MP3_CMD_VOL_UP>::bytes); // We still send the command just in case we got out of sync somehow
 }
 
 void  JQ8400_Serial::volumeDn()
 {
+  setFlag(MP3_FLAG_FADE_ACTIVE, false);
+  if(isRedundant(MP3_SHADOW_VOLUME, 0)) return;
+  
   if(currentVolume > 0 ) currentVolume--;
-  this->sendCommand(MP3_CMD_VOL_DN); // We still send the command just in case we got out of sync somehow
+  this->sendFrame(JQ8400_Frame<MP3_CMD_VOL_DN>::bytes); // We still send the command just in case we got out of sync somehow
 }
 
 void  JQ8400_Serial::setVolume(byte volumeFrom0To30)
 {
+  setFlag(MP3_FLAG_FADE_ACTIVE, false);
+  
+  if(isRedundant(MP3_SHADOW_VOLUME, volumeFrom0To30)) return;
+  
   currentVolume = volumeFrom0To30;
+  markShadow(MP3_SHADOW_VOLUME);
   this->sendCommand(MP3_CMD_VOL_SET, volumeFrom0To30);
 }
 
+void  JQ8400_Serial::fadeTo(uint8_t volumeFrom0To30, uint16_t ms)
+{
+  if(volumeFrom0To30 > 30) volumeFrom0To30 = 30;
+  
+  if(!ms)
+  {
+    this->setVolume(volumeFrom0To30);
+    return;
+  }
+  
+  fadeFrom     = currentVolume;
+  fadeTarget   = volumeFrom0To30;
+  fadeDuration = ms;
+  fadeStartAt  = millis();
+  setFlag(MP3_FLAG_FADE_STOPS, false);
+  setFlag(MP3_FLAG_FADE_ACTIVE, true);
+}
+
+void  JQ8400_Serial::fadeOut(uint16_t ms)
+{
+  uint8_t restore = flag(MP3_FLAG_DUCKED) ? duckRestore : currentVolume;
+  
+  // Fading out one fade out, put back what it would have
+  if(flag(MP3_FLAG_FADE_ACTIVE) && flag(MP3_FLAG_FADE_STOPS)) restore = fadeRestore;
+  if(flag(MP3_FLAG_FADE_ACTIVE) && !fadeDuration)              restore = fadeTarget; // That one has stopped, and is putting it back
+  
+  setFlag(MP3_FLAG_DUCKED, false);
+  
+  if(!ms)
+  {
+    // Nothing to fade, stop and put it back now
+    this->stop();
+    this->setVolume(restore);
+    return;
+  }
+  
+  this->fadeTo(0, ms);
+  
+  fadeRestore = restore;
+  setFlag(MP3_FLAG_FADE_STOPS, true);
+  setFlag(MP3_FLAG_FADE_ACTIVE, true);
+}
+
+void  JQ8400_Serial::duck(uint8_t volumeFrom0To30, uint16_t ms)
+{
+  if(!flag(MP3_FLAG_DUCKED)) duckRestore = currentVolume;
+  setFlag(MP3_FLAG_DUCKED, true);
+  this->fadeTo(volumeFrom0To30, ms);
+}
+
+void  JQ8400_Serial::unduck(uint16_t ms)
+{
+  if(!flag(MP3_FLAG_DUCKED)) return;
+  setFlag(MP3_FLAG_DUCKED, false);
+  this->fadeTo(duckRestore, ms);
+}
+
+void  JQ8400_Serial::advanceFade()
+{
+  // The last step is still to go, when it has the next is whatever is due by then
+  if(this->commandPending(MP3_CMD_VOL_SET)) return;
+  
+  uint32_t elapsed = millis() - fadeStartAt;
+  uint8_t  level   = fadeTarget;
+  
+  if(elapsed < fadeDuration) level = fadeFrom + ((int16_t)fadeTarget - fadeFrom) * (int32_t)elapsed / fadeDuration;
+  
+  if(level != currentVolume || !shadowValid(MP3_SHADOW_VOLUME))
+  {
+    if(!this->queueCommand(MP3_CMD_VOL_SET, &level, 1)) return;
+    currentVolume = level;
+    markShadow(MP3_SHADOW_VOLUME);
+  }
+  
+  if(level != fadeTarget) return;
+  
+  if(flag(MP3_FLAG_FADE_STOPS))
+  {
+    // Once silent, stop, then "fade" at once to the volume to put back for 
+    //  what comes next, both queued so that update() doesn't block
+    if(!this->queueCommand(MP3_CMD_STOP, NULL, 0)) return;
+    this->stopping();
+    
+    setFlag(MP3_FLAG_FADE_STOPS, false);
+    fadeTarget   = fadeRestore;
+    fadeDuration = 0;
+    return;
+  }
+  
+  setFlag(MP3_FLAG_FADE_ACTIVE, false);
+}
+
 void  JQ8400_Serial::setEqualizer(byte equalizerMode)
 {
+  if(isRedundant(MP3_SHADOW_EQ, equalizerMode)) return;
+  
   currentEq = equalizerMode;
+  markShadow(MP3_SHADOW_EQ);
   this->sendCommand(MP3_CMD_EQ_SET, equalizerMode);
 }
 
 void  JQ8400_Serial::setLoopMode(byte loopMode)
 {
+  if(isRedundant(MP3_SHADOW_LOOP, loopMode)) return;
+  
   currentLoop = loopMode;
+  markShadow(MP3_SHADOW_LOOP);
   this->sendCommand(MP3_CMD_LOOP_SET, loopMode);
 }
 
 
 uint8_t JQ8400_Serial::getAvailableSources() 
 {
-  return this->sendCommandWithByteResponse(MP3_CMD_GET_SOURCES);
+  return this->sendFrameWithByteResponse(JQ8400_Frame<MP3_CMD_GET_SOURCES>::bytes);
 }
 
 void  JQ8400_Serial::setSource(byte source)
 {
+  if(isRedundant(MP3_SHADOW_SOURCE, source)) return;
+  
+  currentSource = source;
+  markShadow(MP3_SHADOW_SOURCE);
+  
+  // Different media, different everything
+  this->trackChanging();
+  invalidateShadow(MP3_SHADOW_FILES);
+  
   this->sendCommand(MP3_CMD_SOURCE_SET, source);
 }
 
 uint8_t JQ8400_Serial::getSource() 
 {
-  return this->sendCommandWithByteResponse(MP3_CMD_GET_SOURCE);
+  if(!shadowValid(MP3_SHADOW_SOURCE)) return this->refreshSource();
+  return currentSource;
+}
+
+uint8_t JQ8400_Serial::refreshSource() 
+{
+  // The response updates currentSource through observeFrame()
+  return this->sendFrameWithByteResponse(JQ8400_Frame<MP3_CMD_GET_SOURCE>::bytes);
 }
 
 
@@ -263,12 +626,16 @@ void  JQ8400_Serial::sleep()
   //  to be stop, and have defined for sake of convenience the other stop
   //  command as "RESET", we will issue both to be sure
     
-  this->sendCommand(MP3_CMD_SLEEP);
-  this->sendCommand(MP3_CMD_STOP);
+  this->sendFrame(JQ8400_Frame<MP3_CMD_SLEEP>::bytes);
+  this->sendFrame(JQ8400_Frame<MP3_CMD_STOP>::bytes);
 }
 
 void  JQ8400_Serial::reset()
 {
+  // Nothing we thought we knew survives a reset
+  invalidateShadow();
+  this->cancelSequence();
+  
   uint8_t retry = 5; // Try really hard to make ourselves heard.
   do
   {
@@ -278,16 +645,26 @@ void  JQ8400_Serial::reset()
     //  command as "RESET", we will issue both to be sure and then 
     //  set things back to "defaults", in absense of an actual reset
     
-    this->sendCommand(MP3_CMD_STOP);  delay(1); // There seems to be something
-    this->sendCommand(MP3_CMD_RESET); delay(1); //  related to timing here
+    //
+    // The device needs some time between these, that is taken care of by
+    //  the inter frame gap (see setInterFrameGap()).
     
+    this->beginBatch();
+    
+    this->sendFrame(JQ8400_Frame<MP3_CMD_STOP>::bytes);
+    this->sendFrame(JQ8400_Frame<MP3_CMD_RESET>::bytes);
     
     // Reset to the startup defaults
+    invalidateShadow(MP3_SHADOW_VOLUME);
+    invalidateShadow(MP3_SHADOW_EQ);
+    invalidateShadow(MP3_SHADOW_LOOP);
     this->setVolume(20);
     this->setEqualizer(0);
     this->setLoopMode(2);
     this->seekFileByIndexNumber(1);
-    this->sendCommand(MP3_CMD_STOP);
+    this->sendFrame(JQ8400_Frame<MP3_CMD_STOP>::bytes);
+    
+    this->endBatch();
     
     uint8_t timeout = 9;
     while(timeout-- > 0 )
@@ -297,35 +674,164 @@ void  JQ8400_Serial::reset()
         retry = 0;
         break; 
       }
-      delay(1);
+      this->idleFor(1);
     }
   }
   while(retry-- > 0);
+  
+  // If the available sources did not settle it, find out which source the 
+  //  device started with now, rather than delaying the first command that needs it.
+  if(!shadowValid(MP3_SHADOW_SOURCE)) this->refreshSource();
+}
+
+
+void JQ8400_Serial::startup(uint8_t warm)
+{
+  // What we knew of the settings is kept, to restore them
+  invalidateShadow(MP3_SHADOW_SOURCE);
+  invalidateShadow(MP3_SHADOW_INDEX);
+  invalidateShadow(MP3_SHADOW_STATUS);
+  invalidateShadow(MP3_SHADOW_FILES);
+  invalidateShadow(MP3_SHADOW_POSITION);
+  this->cancelSequence();
+  
+  startupStatus   = MP3_STARTUP_PENDING;
+  setFlag(MP3_FLAG_STARTUP_WARM, warm);
+  startupAttempts = 0;
+  
+  if(warm) this->startupProbe();
+  else     this->startupCold();
+}
+
+void JQ8400_Serial::startupCold()
+{
+  setFlag(MP3_FLAG_STARTUP_WARM, false);
+  
+  // As reset(), but once, the settings sent are what they were if we knew, 
+  //  reset()'s defaults otherwise
+  uint8_t volume = shadowValid(MP3_SHADOW_VOLUME) ? currentVolume : 20;
+  uint8_t eq     = shadowValid(MP3_SHADOW_EQ)     ? currentEq     : 0;
+  uint8_t loop   = shadowValid(MP3_SHADOW_LOOP)   ? currentLoop   : 2;
+  
+  invalidateShadow(MP3_SHADOW_VOLUME);
+  invalidateShadow(MP3_SHADOW_EQ);
+  invalidateShadow(MP3_SHADOW_LOOP);
+  
+  this->beginBatch();
+  this->sendFrame(JQ8400_Frame<MP3_CMD_STOP>::bytes);
+  this->sendFrame(JQ8400_Frame<MP3_CMD_RESET>::bytes);
+  this->setVolume(volume);
+  this->setEqualizer(eq);
+  this->setLoopMode(loop);
+  this->endBatch(false);
+  
+  this->startupProbe();
+}
+
+void JQ8400_Serial::startupProbe()
+{
+  setFlag(MP3_FLAG_STARTUP_PROBE_DUE, false);
+  
+  // No room, try again on the next update()
+  if(!this->queueCommand(MP3_CMD_GET_SOURCES, NULL, 0, true, startupAnswered))
+  {
+    setFlag(MP3_FLAG_STARTUP_PROBE_DUE, true);
+    startupProbeAt  = millis();
+    return;
+  }
+  
+  startupAttempts++;
+}
+
+void JQ8400_Serial::startupAnswered(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length)
+{
+  (void) request;
+  
+  if(mp3.startupStatus != MP3_STARTUP_PENDING) return;
+  
+  // The device did answer which sources it has, if the source went unanswered
+  //  it may be known from that (there was only one), otherwise both are asked 
+  //  again below, without a cold start
+  if(command == MP3_CMD_GET_SOURCE)
+  {
+    if(result == MP3_REQUEST_DONE || mp3.shadowValid(MP3_SHADOW_SOURCE))
+    {
+      mp3.startupFinished(MP3_STARTUP_READY);
+      return;
+    }
+  }
+  // Answering with no sources, the media is not ready yet
+  else if(result == MP3_REQUEST_DONE && length && data[0])
+  {
+    // The responses fill in the shadow, the last tells us we are done
+    if(mp3.flag(MP3_FLAG_STARTUP_WARM))
+    {
+      mp3.queueCommand(MP3_CMD_STATUS,           NULL, 0, true, discardResponse);
+      mp3.queueCommand(MP3_CMD_CURRENT_FILE_IDX, NULL, 0, true, discardResponse);
+    }
+    
+    // No room, probe again on the next update()
+    if(!mp3.queueCommand(MP3_CMD_GET_SOURCE, NULL, 0, true, startupAnswered))
+    {
+      mp3.setFlag(MP3_FLAG_STARTUP_PROBE_DUE, true);
+      mp3.startupProbeAt  = millis();
+    }
+    return;
+  }
+  else if(mp3.flag(MP3_FLAG_STARTUP_WARM))
+  {
+    mp3.startupCold();
+    return;
+  }
+  
+  if(mp3.startupAttempts >= MP3_STARTUP_ATTEMPTS)
+  {
+    mp3.startupFinished(MP3_STARTUP_FAILED);
+    return;
+  }
+  
+  mp3.setFlag(MP3_FLAG_STARTUP_PROBE_DUE, true);
+  mp3.startupProbeAt  = millis() + MP3_STARTUP_RETRY;
 }
 
+void JQ8400_Serial::startupFinished(uint8_t status)
+{
+  startupStatus = status;
+  if(readyCallback) readyCallback(*this, status);
+}
 
     byte  JQ8400_Serial::getStatus()    
     {
-      if(MP3_STATUS_CHECKS_IN_AGREEMENT <= 1)
+      if(flag(MP3_FLAG_STATUS_TRACKING) && shadowValid(MP3_SHADOW_STATUS))
+      {
+        return currentStatus;
+      }
+      
+      if(statusChecks <= 1)
       {
-        return this->sendCommandWithByteResponse(MP3_CMD_STATUS); 
+        return this->sendFrameWithByteResponse(JQ8400_Frame<MP3_CMD_STATUS>::bytes); 
       }
       
-      byte statTotal = 0;
-      byte stat       = 0;
-      do
+      // Each response is voted on as it arrives (see observeFrame()), only
+      //  these responses, a run of earlier ones would outvote a change since.
+      //  Stop asking as soon as two or more agree, or one says stopped, 
+      //  which is fairly reliable.
+      seedStatusVote(0xFF);
+      for(byte x = 0; x < statusChecks; x++)
       {
-        statTotal = 0;
-        for(byte x = 0; x < MP3_STATUS_CHECKS_IN_AGREEMENT; x++)
+        uint8_t status = this->sendFrameWithByteResponse(JQ8400_Frame<MP3_CMD_STATUS>::bytes);
+        
+        if(lastRequestResult == MP3_REQUEST_DONE && status == MP3_STATUS_STOPPED)
         {
-          stat = this->sendCommandWithByteResponse(MP3_CMD_STATUS);      
-          if(stat == 0) return 0; // STOP is fairly reliable
-          statTotal += stat;
+          seedStatusVote(MP3_STATUS_STOPPED);
+          statusObserved(MP3_STATUS_STOPPED);
+          break;
         }
-
-      } while (statTotal != 1 * MP3_STATUS_CHECKS_IN_AGREEMENT && statTotal != 2 * MP3_STATUS_CHECKS_IN_AGREEMENT);
+        
+        if(statusVoteCount[currentStatus] >= 2) break;
+      }
       
-      return statTotal / MP3_STATUS_CHECKS_IN_AGREEMENT;      
+      return shadowValid(MP3_SHADOW_STATUS) ? currentStatus : MP3_STATUS_STOPPED;
     }
     
     byte  JQ8400_Serial::getVolume()    { return currentVolume; }
@@ -333,201 +839,698 @@ void  JQ8400_Serial::reset()
     byte  JQ8400_Serial::getLoopMode()  { return currentLoop;   }
     
     
-    uint16_t  JQ8400_Serial::countFiles()   
+    uint32_t JQ8400_Serial::shadowAge(uint8_t field)
     {
-      return this->sendCommandWithUnsignedIntResponse(MP3_CMD_COUNT_FILES); 
+      if(!shadowValid(field)) return 0xFFFFFFFF;
+      if(!MP3_SHADOW_AGES && field != MP3_SHADOW_POSITION) return 0;
+      return millis() - shadowUpdatedAt[MP3_SHADOW_AGES ? field : 0];
     }
     
-    uint16_t  JQ8400_Serial::currentFileIndexNumber()
+    uint16_t JQ8400_Serial::shadowValue(uint8_t field)
     {
-      return this->sendCommandWithUnsignedIntResponse(MP3_CMD_CURRENT_FILE_IDX); 
+      switch(field)
+      {
+        case MP3_SHADOW_VOLUME: return currentVolume;
+        case MP3_SHADOW_EQ:     return currentEq;
+        case MP3_SHADOW_LOOP:   return currentLoop;
+        case MP3_SHADOW_SOURCE: return currentSource;
+        case MP3_SHADOW_INDEX:  return currentIndex;
+        case MP3_SHADOW_STATUS: return currentStatus;
+        case MP3_SHADOW_FILES:  return currentFileCount;
+        case MP3_SHADOW_POSITION: return currentPosition;
+      }
+      return 0;
     }
     
-    uint16_t  JQ8400_Serial::currentFilePositionInSeconds() 
+    void JQ8400_Serial::invalidateShadow(uint8_t field)
     {
-      uint8_t buf[3];
-      
-      // This turns on continuous position reporting, every second
-      this->sendCommandData(MP3_CMD_CURRENT_FILE_POS, 0, 0, buf, 3);
-      
-      // Stop it doing that
-      this->sendCommand(MP3_CMD_CURRENT_FILE_POS_STOP);
+      if(field == MP3_SHADOW_ALL)
+      {
+        shadowValidBits = 0;
+      }
+      else if(field < MP3_SHADOW_FIELDS)
+      {
+        shadowValidBits &= ~(1 << field);
+      }
       
-      return (buf[0]*60*60) + (buf[1]*60) + buf[2];
+      // Something has (probably) changed the status, old responses don't count
+      if(field == MP3_SHADOW_ALL || field == MP3_SHADOW_STATUS)
+      {
+        seedStatusVote(0xFF);
+        statusPolledAt = millis(); // Give the device a moment first
+      }
     }
     
-    uint16_t  JQ8400_Serial::currentFileLengthInSeconds()   
+    void JQ8400_Serial::sync()
     {
-      uint8_t buf[3];
-      
-      this->sendCommandData(MP3_CMD_CURRENT_FILE_LEN, 0, 0, buf, 3);
+      // What only we know, the device can't be asked for these
+      if(shadowValid(MP3_SHADOW_VOLUME)) this->queueCommandWaiting(MP3_CMD_VOL_SET,  &currentVolume, 1, false);
+      if(shadowValid(MP3_SHADOW_EQ))     this->queueCommandWaiting(MP3_CMD_EQ_SET,   &currentEq,     1, false);
+      if(shadowValid(MP3_SHADOW_LOOP))   this->queueCommandWaiting(MP3_CMD_LOOP_SET, &currentLoop,   1, false);
       
-      return (buf[0]*60*60) + (buf[1]*60) + buf[2];
+      // What the device can tell us, the responses update the shadow through observeFrame()
+      this->queueCommandWaiting(MP3_CMD_GET_SOURCE,       NULL, 0, true);
+      this->queueCommandWaiting(MP3_CMD_STATUS,           NULL, 0, true);
+      this->queueCommandWaiting(MP3_CMD_CURRENT_FILE_IDX, NULL, 0, true);
+      this->queueCommandWaiting(MP3_CMD_COUNT_FILES,      NULL, 0, true);
       
-      return 0; /* FIXME this->sendCommandWithUnsignedIntResponse(MP3_CMD_CURRENT_FILE_LEN_SEC); */ 
+      if(!this->flag(MP3_FLAG_ASYNC))
+      {
+        this->flushQueue();
+      }
     }
     
-    void          JQ8400_Serial::currentFileName(char *buffer, uint16_t bufferLength) 
+    void JQ8400_Serial::queueCommandWaiting(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, uint8_t expectResponse)
     {
-      // this->sendCommand(MP3_CMD_CURRENT_FILE_NAME, 0, 0, buffer, bufferLength);
-      this->sendCommand(MP3_CMD_CURRENT_FILE_NAME, (uint8_t *)buffer, bufferLength);
-      buffer[bufferLength-1] = 0; // Ensure null termination since this is a string.
+      while(!this->queueCommand(command, requestBuffer, requestLength, expectResponse, expectResponse ? discardResponse : NULL)) 
+      {
+        this->update();
+        this->idle(this->byteTime);
+      }
     }
     
-    // Used for the status commands, they mostly return an 8 to 16 bit integer 
-    // and take no arguments
-    uint16_t JQ8400_Serial::sendCommandWithUnsignedIntResponse(byte command)
-    {      
-      uint8_t buffer[4];
-      this->sendCommand(command, buffer, sizeof(buffer));
-      return ((uint8_t)buffer[0]<<8) | ((uint8_t)buffer[1]);
+    uint16_t  JQ8400_Serial::countFiles()   
+    {
+      return this->sendFrameWithUnsignedIntResponse(JQ8400_Frame<MP3_CMD_COUNT_FILES>::bytes); 
     }
     
-    uint8_t JQ8400_Serial::sendCommandWithByteResponse(uint8_t command)
+    uint16_t  JQ8400_Serial::currentFileIndexNumber()
     {
-      uint8_t response = 0;
-      this->sendCommand(command, &response, 1);
-      return response;
+      return this->sendFrameWithUnsignedIntResponse(JQ8400_Frame<MP3_CMD_CURRENT_FILE_IDX>::bytes); 
     }
     
-    void  JQ8400_Serial::sendCommandData(uint8_t command, uint8_t *requestBuffer, uint8_t requestLength, uint8_t *responseBuffer, uint8_t bufferLength)
+    uint16_t  JQ8400_Serial::currentFilePositionInSeconds() 
     {
-      // Calculate the checksum which forms the end byte
-      uint8_t MP3_CHECKSUM = MP3_CMD_BEGIN + command + requestLength;
-      
-      for(uint8_t x = 0; x < requestLength; x++)
+      if(flag(MP3_FLAG_POSITION_STREAMING))
       {
-        MP3_CHECKSUM += (uint8_t)requestBuffer[x];
+        return this->currentFilePositionInMilliseconds() / 1000;
       }
       
-#if MP3_DEBUG
-      Serial.println();
+      uint8_t buf[3];
+      
+      // This turns on continuous position reporting, every second
+      this->sendFrame(JQ8400_Frame<MP3_CMD_CURRENT_FILE_POS>::bytes, buf, 3);
       
-      HEX_PRINT(MP3_CMD_BEGIN);  Serial.print(" ");
-      HEX_PRINT(command);        Serial.print(" ");
-      HEX_PRINT(requestLength);  Serial.print(" ");
+      // Stop it doing that
+      this->sendFrame(JQ8400_Frame<MP3_CMD_CURRENT_FILE_POS_STOP>::bytes);
       
-      for(uint8_t x = 0; x < requestLength; x++)
+      return (buf[0]*60*60) + (buf[1]*60) + buf[2];
+    }
+    
+    uint32_t  JQ8400_Serial::currentFilePositionInMilliseconds() 
+    {
+      if(!flag(MP3_FLAG_POSITION_STREAMING))
       {
-          HEX_PRINT(requestBuffer[x]); 
-          Serial.print(' ');
+        return this->currentFilePositionInSeconds() * 1000UL;
       }
       
-      HEX_PRINT(MP3_CHECKSUM);  Serial.print(" ");
-#endif
-      
-      // If there is any random garbage on the line, clear that out now.
-      while(this->waitUntilAvailable(10)) this->_Serial->read();
-
-      this->_Serial->write(MP3_CMD_BEGIN);
-      this->_Serial->write(command);
-      this->_Serial->write(requestLength);
-      for(uint8_t x = 0; x < requestLength; x++)
+      // Pick up any reports which have arrived, without waiting for one,
+      //  update() does this if anything is queued (and must, a response to 
+      //  it may be in flight), which can happen without async mode too.
+      if(this->flag(MP3_FLAG_ASYNC) || this->pendingRequests()) 
       {
-          this->_Serial->write(requestBuffer[x]);
+        this->update();
       }
-      this->_Serial->write(MP3_CHECKSUM);
-            
-      if(responseBuffer && bufferLength) 
+      else
       {
-        memset(responseBuffer, 0, bufferLength);
+        this->drain();
       }
       
-      // If we don't expect a response (or don't care) don't wait for ones
-      else
+      if(!shadowValid(MP3_SHADOW_POSITION)) return 0;
+      
+      uint32_t position = currentPosition * 1000UL;
+      if(shadowValid(MP3_SHADOW_STATUS) && currentStatus == MP3_STATUS_PLAYING)
       {
-        return;
+        // Reports come each second, if they are late don't run away
+        uint32_t since = shadowAge(MP3_SHADOW_POSITION);
+        position += since < 1000 ? since : 1000;
       }
       
-      // Allow some time for the device to process what we did and 
-      // respond, up to 1 second, but typically only a few ms.
-      this->waitUntilAvailable(1000);
-
+      return position;
+    }
+    
+    void JQ8400_Serial::setPositionStreaming(uint8_t enable)
+    {
+      setFlag(MP3_FLAG_POSITION_STREAMING, enable);
       
-#if MP3_DEBUG
-      Serial.print(" ==> [");
-#endif
+      // Starting reporting gets an immediate response which we can use, stopping does not
+      if(enable)
+      {
+        uint8_t buf[3];
+        this->sendFrame(JQ8400_Frame<MP3_CMD_CURRENT_FILE_POS>::bytes, buf, 3);
+      }
+      else
+      {
+        this->sendFrame(JQ8400_Frame<MP3_CMD_CURRENT_FILE_POS_STOP>::bytes);
+      }
+    }
+    
+    uint16_t  JQ8400_Serial::currentFileLengthInSeconds()   
+    {
+      // As currentNameKnown(), asking for the index is cheaper than the length
+      if(lengthIndex && lengthIndex == (indexFollowed() ? currentIndex : this->currentFileIndexNumber()))
+      {
+        return currentLength;
+      }
+      
+      uint8_t buf[3];
+      
+      this->sendFrame(JQ8400_Frame<MP3_CMD_CURRENT_FILE_LEN>::bytes, buf, 3);
+      
+      return (buf[0]*60*60) + (buf[1]*60) + buf[2];
+    }
+    
+    void          JQ8400_Serial::currentFileName(char *buffer, uint16_t bufferLength) 
+    {
+      if(!bufferLength) return;
+      
+      uint8_t known = this->currentNameKnown();
+      
+      if(!known)
+      {
+        // The name comes into currentName (through observeFrame() too, which also sets nameIndex)
+        nameIndex = 0;
+        this->sendFrame(JQ8400_Frame<MP3_CMD_CURRENT_FILE_NAME>::bytes, (uint8_t *)currentName, sizeof(currentName));
+        known = this->lastRequestResult == MP3_REQUEST_DONE;
+      }
+      
+      uint16_t length = 0;
+      if(known)
+      {
+        length = bufferLength - 1 < nameLength ? bufferLength - 1 : nameLength;
+        memcpy(buffer, currentName, length);
+      }
+      
+      buffer[length] = 0; // Ensure null termination since this is a string.
+    }
+    
+    uint8_t       JQ8400_Serial::currentNameKnown()
+    {
+      // A change of track seen invalidates the index, so while they are seen the 
+      //  shadow is as good as asking, and if we must ask, then the name we go 
+      //  on to get is kept under the answer
+      uint16_t index = indexFollowed() ? currentIndex : this->currentFileIndexNumber();
+      return nameIndex && nameIndex == index;
+    }
+    
+    uint8_t       JQ8400_Serial::currentFileName(JQ8400_NameCallback callback) 
+    {
+      if(!this->currentNameKnown())
+      {
+        // receiveResponse() hands over the bytes as they are read
+        nameIndex        = 0;
+        this->nameStream = callback;
+        this->sendFrame(JQ8400_Frame<MP3_CMD_CURRENT_FILE_NAME>::bytes, (uint8_t *)currentName, sizeof(currentName));
+        this->nameStream = NULL;
+        
+        return this->lastRequestResult;
+      }
+      
+      for(uint8_t x = 0; x < nameLength; x++) callback(*this, x, currentName[x]);
+      
+      return MP3_REQUEST_DONE;
+    }
+    
+    // Used for the status commands, they mostly return an 8 to 16 bit integer 
+    // and take no arguments
+    uint16_t JQ8400_Serial::sendCommandWithUnsignedIntResponse(byte command)
+    {      
+      uint8_t buffer[4];
+      this->sendCommand(command, buffer, sizeof(buffer));
+      return ((uint8_t)buffer[0]<<8) | ((uint8_t)buffer[1]);
+    }
+    
+    uint8_t JQ8400_Serial::sendCommandWithByteResponse(uint8_t command)
+    {
+      uint8_t response = 0;
+      this->sendCommand(command, &response, 1);
+      return response;
+    }
+    
+    uint16_t JQ8400_Serial::sendFrameWithUnsignedIntResponse(const uint8_t *frame)
+    {      
+      uint8_t buffer[4];
+      this->sendFrame(frame, buffer, sizeof(buffer));
+      return ((uint8_t)buffer[0]<<8) | ((uint8_t)buffer[1]);
+    }
+    
+    uint8_t JQ8400_Serial::sendFrameWithByteResponse(const uint8_t *frame)
+    {
+      uint8_t response = 0;
+      this->sendFrame(frame, &response, 1);
+      return response;
+    }
+    
+    void  JQ8400_Serial::sendCommandData(uint8_t command, uint8_t *requestBuffer, uint8_t requestLength, uint8_t *responseBuffer, uint8_t bufferLength)
+    {
+      if(this->flag(MP3_FLAG_ASYNC))
+      {
+        if(!(responseBuffer && bufferLength))
+        {
+          // Fire and forget, it goes in the queue, if the queue is full 
+          //  we have no choice but to wait for room.
+          this->queueCommandWaiting(command, requestBuffer, requestLength, false);
+          return;
+        }
+      }
+      
+      this->transact(command, requestBuffer, requestLength, NULL, responseBuffer, bufferLength);
+    }
+    
+    void  JQ8400_Serial::sendFrame(const uint8_t *frame, uint8_t *responseBuffer, uint8_t bufferLength)
+    {
+      uint8_t command = pgm_read_byte(frame + 1);
+      
+      if(this->flag(MP3_FLAG_ASYNC))
+      {
+        if(!(responseBuffer && bufferLength))
+        {
+          // The queue holds commands not frames, take it apart again
+          uint8_t data[MP3_FRAME_DATA_LENGTH];
+          uint8_t length = pgm_read_byte(frame + 2);
+          memcpy_P(data, frame + 3, length);
+          
+          this->queueCommandWaiting(command, data, length, false);
+          return;
+        }
+      }
       
-      // The response format is the same as the command format
-      //  AA [CMD] [DATA_COUNT] [B1..N] [SUM]
-      MP3_CHECKSUM = 0;
+      this->transact(command, NULL, 0, frame, responseBuffer, bufferLength);
+    }
+    
+    void  JQ8400_Serial::transact(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, const uint8_t *frame, uint8_t *responseBuffer, uint8_t bufferLength)
+    {
+      const ResponsePolicy &policy  = this->responsePolicy[commandClass(command)];
+      uint16_t              timeout = this->responseTimeout(command, frame ? pgm_read_byte(frame + 2) : requestLength);
       
-      uint8_t      i = 0;
-      uint8_t      j = 0;
-      uint8_t      dataCount = 0;
-      while(this->waitUntilAvailable(150))
+      for(uint8_t attempt = 0; ; attempt++)
       {
-        j = this->_Serial->read();
-                
-#if MP3_DEBUG
-        HEX_PRINT(j); Serial.print(" ");
+        this->prepareToSend();
+        
+#if MP3_STATS
+        uint32_t txStart = micros();
+#endif
+        
+        if(frame) this->writeFrame(frame);
+        else      this->writeFrame(command, requestBuffer, requestLength);
+        
+#if MP3_STATS
+        uint32_t txEnd = micros();
+        this->stats.txMicros += txEnd - txStart;
 #endif
-        if(i == 2)
+        
+        // If we don't expect a response (or don't care) don't wait for ones
+        if(!(responseBuffer && bufferLength)) 
         {
-          // The number of data bytes to read
-          dataCount = j;
+#if MP3_STATS
+          this->recordStats(command, MP3_REQUEST_DONE, txEnd - txStart);
+#endif
+          return;
         }
         
-        // We only record the data bytes so bytes 0,1 and 2 are discarded
-        //   except for calculating checksum
-        if(i <= 2) 
+        this->lastRequestResult = this->receiveResponse(command, responseBuffer, bufferLength, timeout);
+        
+#if MP3_STATS
+        uint32_t rxEnd = micros();
+        this->stats.exchanges++;
+        if(this->firstByteAt)
         {
-          MP3_CHECKSUM += j;
-          i++;
-          continue;
+          this->stats.firstByteMicros += this->firstByteAt - txEnd;
+          this->stats.payloadMicros   += rxEnd - this->firstByteAt;
         }
         else
         {
-          if(dataCount > 0)
-          {
-            // This is a databyte to read
-            if((i-3) <= (bufferLength-1))
-            {
-              responseBuffer[i-3] = j;
-            }
-            i++;
-            dataCount--;
-            MP3_CHECKSUM += j;
-          }
-          else
-          {
-            // This is the checksum byte
-            if((MP3_CHECKSUM & 0xFF) != j)
-            {
-              // Checksum Failed
-              #if MP3_DEBUG
-                Serial.print(" ** CHECKSUM FAILED " );
-                HEX_PRINT((MP3_CHECKSUM & 0xFF)); 
-                Serial.print(" != ");
-                HEX_PRINT(j); 
-              #endif
-              memset(responseBuffer, 0, bufferLength);
-            }
-            else
-            {
-               #if MP3_DEBUG
-                Serial.print(" ** CHECKSUM OK " );
-                HEX_PRINT((MP3_CHECKSUM & 0xFF)); 
-                Serial.print(" == ");
-                HEX_PRINT(j); 
-              #endif
-            }
-          }
+          this->stats.firstByteMicros += rxEnd - txEnd;
         }
+        this->recordStats(command, this->lastRequestResult, rxEnd - txStart);
+#endif
+        
+        if(this->lastRequestResult == MP3_REQUEST_DONE || attempt >= policy.retries) return;
+        
+#if MP3_STATS
+        this->stats.retries++;
+#endif
+        
+        this->idleFor((uint16_t)policy.backoff << attempt);
       }
+    }
+    
+    void  JQ8400_Serial::prepareToSend()
+    {
+#if MP3_STATS
+      uint32_t start = micros();
+#endif
+      
+      // Nothing may overtake what is already queued (by us, or by the status 
+      //  tracker), nor be sent while a response is on it's way
+      this->flushQueue();
+      
+      // If there is any random garbage on the line, clear that out now,
+      //  but only what is already here, don't wait around for more.
+      this->drain();
+      
+#if MP3_STATS
+      uint32_t flushed = micros();
+      this->stats.flushMicros += flushed - start;
+#endif
+      
+      // Give the device the gap it needs after the previous frame, if it 
+      //  has not already passed
+      while(!this->txReady()) this->idle(this->txReadyAt - micros());
+      
+#if MP3_STATS
+      this->stats.gapMicros += micros() - flushed;
+#endif
+    }
+    
+    uint8_t  JQ8400_Serial::receiveResponse(uint8_t command, uint8_t *responseBuffer, uint8_t bufferLength, uint16_t timeout)
+    {
+      memset(responseBuffer, 0, bufferLength);
       
-#if MP3_DEBUG      
-      Serial.print("] --> ");
-      for(uint8_t x = 0; x < bufferLength; x++)
+      // Allow some time for the device to process what we did and 
+      // respond, typically only a few ms.
+      //
+      // The frame tells us it's own length so we stop the moment the 
+      // checksum byte arrives, anything after that is left for the next reader.
+      
+      this->rxState = MP3_RX_STATE_BEGIN;
+      
+      uint8_t  result     = MP3_RX_INCOMPLETE;
+      uint8_t  unexpected = false;
+      uint32_t startTime  = millis();
+      uint32_t waited     = 0;
+      
+#if MP3_STATS
+      this->firstByteAt = 0;
+#endif
+      
+      while(result == MP3_RX_INCOMPLETE && waited < timeout && this->waitUntilAvailable(timeout - waited))
       {
-        HEX_PRINT(responseBuffer[x]);
+        uint8_t j = this->_Serial->read();
+        
+#if MP3_STATS
+        if(!this->firstByteAt) this->firstByteAt = micros();
+#endif
+        
+        uint8_t isData = this->rxState == MP3_RX_STATE_DATA;
+        
+        result = this->parseResponseByte(j);
+        
+        if(isData && this->nameStream && this->rxCommand == command) this->nameStream(*this, this->rxCount - 1, j);
+        
+        // The response echoes our command, a frame which doesn't is something 
+        //  else (eg a position report), not to be mistaken for the answer
+        if(result == MP3_RX_FRAME && this->rxCommand != command)
+        {
+          if(this->rxCommand != MP3_CMD_CURRENT_FILE_POS) unexpected = true;
+          
+          this->handleUnsolicitedFrame();
+          result = MP3_RX_INCOMPLETE;
+        }
+        
+        waited = millis() - startTime;
       }
       
-      Serial.println();
+      if(result == MP3_RX_FRAME)
+      {
+        uint8_t length = this->rxLength;
+        if(length > sizeof(this->rxData)) length = sizeof(this->rxData);
+        
+        this->observeFrame(this->rxCommand, this->rxData, length);
+        
+        if(length > bufferLength)          length = bufferLength;
+        memcpy(responseBuffer, this->rxData, length);
+        
+        result = MP3_REQUEST_DONE;
+      }
+      else
+      {
+        // Checksum failed or timed out, the response stays zeroed.
+        this->rxState = MP3_RX_STATE_BEGIN;
+        
+#if MP3_TRACE
+        if(result != MP3_RX_BAD_CHECKSUM) this->trace(MP3_TRACE_TIMEOUT, command, NULL, 0);
 #endif
+        
+        if(result == MP3_RX_BAD_CHECKSUM) result = MP3_REQUEST_CHECKSUM_FAILED;
+        else if(unexpected)               result = MP3_REQUEST_UNEXPECTED;
+        else                              result = MP3_REQUEST_TIMEOUT;
+      }
+      
+      return result;
+    }
+    
+
+void JQ8400_Serial::drain()
+{
+  while(this->_Serial->available())
+  {
+    if(this->parseResponseByte(this->_Serial->read()) == MP3_RX_FRAME)
+    {
+      this->handleUnsolicitedFrame();
+    }
+  }
+}
+
+void JQ8400_Serial::observeFrame(uint8_t command, const uint8_t *data, uint8_t length)
+{
+  if(!length) return;
+  
+  switch(command)
+  {
+    case MP3_CMD_GET_SOURCE:
+      this->sourceObserved(data[0]);
+      break;
+      
+    case MP3_CMD_GET_SOURCES:
+      // With only one source there is only one it can be, and if the one
+      //  we thought it was has gone, we no longer know.
+      if(data[0] && !(data[0] & (data[0] - 1)))
+      {
+        uint8_t source = 0;
+        while(!(data[0] & (1 << source))) source++;
+        this->sourceObserved(source);
+      }
+      else if(!(data[0] & (1 << currentSource)))
+      {
+        invalidateShadow(MP3_SHADOW_SOURCE);
+      }
+      break;
+      
+    case MP3_CMD_STATUS:
+      this->statusSampled(data[0]);
+      break;
+      
+    case MP3_CMD_CURRENT_FILE_LEN:
+      if(length < 3) break;
+      
+      // The length of the file doesn't change, only which file it is
+      currentLength = (data[0]*60*60) + (data[1]*60) + data[2];
+      lengthIndex   = shadowValid(MP3_SHADOW_INDEX) ? currentIndex : 0;
+      break;
+      
+    case MP3_CMD_CURRENT_FILE_NAME:
+      nameLength = length < MP3_NAME_LENGTH ? length : MP3_NAME_LENGTH;
+      memcpy(currentName, data, nameLength);
+      nameIndex  = shadowValid(MP3_SHADOW_INDEX) ? currentIndex : 0;
+      break;
       
+    case MP3_CMD_CURRENT_FILE_IDX:
+      if(length < 2) break;
+      currentIndex = (data[0] << 8) | data[1];
+      markShadow(MP3_SHADOW_INDEX);
+      break;
+      
+    case MP3_CMD_CURRENT_FILE_POS:
+    {
+      if(length < 3) break;
+      
+      uint16_t position = (data[0]*60*60) + (data[1]*60) + data[2];
+      
+      // Without any command from us, a position going forward means playing, 
+      //  going backward means the track ended and another began
+      if(shadowValid(MP3_SHADOW_POSITION))
+      {
+        if(position > currentPosition) 
+        {
+          this->seedStatusVote(MP3_STATUS_PLAYING);
+          this->statusObserved(MP3_STATUS_PLAYING);
+        }
+        else if(position < currentPosition)
+        {
+          this->trackEnded();
+        }
+      }
+      
+      currentPosition = position;
+      markShadow(MP3_SHADOW_POSITION);
+      
+      if(positionCallback) positionCallback(*this, position);
     }
+    break;
+      
+    case MP3_CMD_COUNT_FILES:
+      if(length < 2) break;
+      currentFileCount = (data[0] << 8) | data[1];
+      markShadow(MP3_SHADOW_FILES);
+      break;
+  }
+}
+
+void JQ8400_Serial::sourceObserved(uint8_t source)
+{
+  uint8_t changed = shadowValid(MP3_SHADOW_SOURCE) && currentSource != source;
+  
+  currentSource = source;
+  markShadow(MP3_SHADOW_SOURCE);
+  
+  // The index numbers are of different files now
+  if(changed) lengthIndex = nameIndex = 0;
+  
+  if(changed && sourceChangeCallback) sourceChangeCallback(*this, source);
+}
+
+void JQ8400_Serial::statusObserved(uint8_t status)
+{
+  uint8_t wasPlaying = shadowValid(MP3_SHADOW_STATUS) && currentStatus == MP3_STATUS_PLAYING;
+  uint8_t changed    = currentStatus != status;
+  
+  currentStatus = status;
+  markShadow(MP3_SHADOW_STATUS);
+  
+  if(changed && statusChangeCallback) statusChangeCallback(*this, status);
+  
+  // We didn't stop it (that would have invalidated the status), so it finished
+  if(wasPlaying && status == MP3_STATUS_STOPPED) this->trackEnded();
+}
+
+void JQ8400_Serial::statusSampled(uint8_t status)
+{
+  if(status > MP3_STATUS_PAUSED) return;
+  
+  // Slide the window, the oldest response out, this one in
+  if(statusVoteFill == MP3_STATUS_VOTE_WINDOW)
+  {
+    statusVoteCount[statusVotes[statusVoteHead]]--;
+  }
+  else
+  {
+    statusVoteFill++;
+  }
+  
+  statusVotes[statusVoteHead] = status;
+  statusVoteCount[status]++;
+  if(++statusVoteHead == MP3_STATUS_VOTE_WINDOW) statusVoteHead = 0;
+  
+  // The majority wins, a tie goes to the most recent
+  uint8_t winner = status;
+  for(uint8_t x = 0; x <= MP3_STATUS_PAUSED; x++)
+  {
+    if(statusVoteCount[x] > statusVoteCount[winner]) winner = x;
+  }
+  
+  this->statusObserved(winner);
+}
+
+void JQ8400_Serial::seedStatusVote(uint8_t status)
+{
+  statusVoteCount[0] = statusVoteCount[1] = statusVoteCount[2] = 0;
+  statusVoteHead     = 0;
+  statusVoteFill     = 0;
+  
+  if(status > MP3_STATUS_PAUSED) return;
+  
+  memset(statusVotes, status, sizeof(statusVotes));
+  statusVoteCount[status] = MP3_STATUS_VOTE_WINDOW;
+  statusVoteFill          = MP3_STATUS_VOTE_WINDOW;
+}
+
+void JQ8400_Serial::trackStatus()
+{
+  if(this->commandPending(MP3_CMD_STATUS)) return;
+  
+  uint8_t  playing  = shadowValid(MP3_SHADOW_STATUS) && currentStatus == MP3_STATUS_PLAYING;
+  uint32_t interval = MP3_STATUS_POLL_SLOW;
+  
+  if(statusConfidence() < 100)
+  {
+    interval = MP3_STATUS_POLL_FAST;
+  }
+  else if(playing && lengthIndex && indexFollowed() && lengthIndex == currentIndex && shadowValid(MP3_SHADOW_POSITION))
+  {
+    // Don't sleep through the end of the track
+    uint32_t at        = (uint32_t)currentPosition * 1000 + shadowAge(MP3_SHADOW_POSITION);
+    uint32_t remaining = (uint32_t)currentLength * 1000 > at ? (uint32_t)currentLength * 1000 - at : 0;
     
+    if(remaining < interval) interval = remaining > MP3_STATUS_POLL_FAST ? remaining : MP3_STATUS_POLL_FAST;
+  }
+  
+  if(millis() - statusPolledAt < interval) return;
+  
+  if(!this->queueCommand(MP3_CMD_STATUS, NULL, 0, true, discardResponse)) return;
+  statusPolledAt = millis();
+  
+  // To know when the end is near we need to know where we are, in what
+  if(!playing) return;
+  
+  if(!shadowValid(MP3_SHADOW_INDEX))
+  {
+    if(!this->commandPending(MP3_CMD_CURRENT_FILE_IDX)) this->queueCommand(MP3_CMD_CURRENT_FILE_IDX, NULL, 0, true, discardResponse);
+  }
+  else if(lengthIndex != currentIndex)
+  {
+    if(!this->commandPending(MP3_CMD_CURRENT_FILE_LEN)) this->queueCommand(MP3_CMD_CURRENT_FILE_LEN, NULL, 0, true, discardResponse);
+  }
+  else if(!shadowValid(MP3_SHADOW_POSITION) && !flag(MP3_FLAG_POSITION_STREAMING))
+  {
+    if(!this->commandPending(MP3_CMD_CURRENT_FILE_POS)) this->queueCommand(MP3_CMD_CURRENT_FILE_POS, NULL, 0, true, discardResponse);
+  }
+}
+
+uint8_t JQ8400_Serial::commandPending(uint8_t command)
+{
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    if(this->requests[x].id && this->requests[x].command == command && this->requests[x].state < MP3_REQUEST_DONE) return true;
+  }
+  
+  return false;
+}
+
+void JQ8400_Serial::trackEnded()
+{
+  uint16_t index = shadowValid(MP3_SHADOW_INDEX) ? currentIndex : 0;
+  
+  // If that was the last of a segment, it's time for the next, or if it 
+  //  stopped, which it only does at the end of a segment
+  if(playlistSegmentLeft && (!--playlistSegmentLeft || (shadowValid(MP3_SHADOW_STATUS) && currentStatus == MP3_STATUS_STOPPED)))
+  {
+    playlistSegmentLeft = 0;
+    setFlag(MP3_FLAG_PLAYLIST_DUE, true);
+  }
+  
+  // Whatever plays next, if anything, we don't know it's index or position
+  invalidateShadow(MP3_SHADOW_INDEX);
+  invalidateShadow(MP3_SHADOW_POSITION);
+  
+  if(trackEndCallback) trackEndCallback(*this, index);
+}
+
+void JQ8400_Serial::handleUnsolicitedFrame()
+{
+#if MP3_STATS
+  this->stats.unsolicited++;
+#endif
+  
+  uint8_t length = this->rxLength < sizeof(this->rxData) ? this->rxLength : sizeof(this->rxData);
+  
+  this->observeFrame(this->rxCommand, this->rxData, length);
+  
+  if(this->unsolicitedHandler)
+  {
+    this->unsolicitedHandler(*this, this->rxCommand, this->rxData, length);
+  }
+}
 
 // Waits until data becomes available, or a timeout occurs
 int JQ8400_Serial::waitUntilAvailable(uint16_t maxWaitTime)
@@ -538,7 +1541,675 @@ int JQ8400_Serial::waitUntilAvailable(uint16_t maxWaitTime)
   do {
     c = this->_Serial->available();
     if (c) break;
+    this->idle((maxWaitTime - (millis() - startTime)) * 1000UL);
   } while(millis() - startTime < maxWaitTime);
   
   return c;
 }
+
+void JQ8400_Serial::idleFor(uint16_t ms)
+{
+  if(!this->waitStrategy) 
+  {
+    delay(ms);
+    return;
+  }
+  
+  uint32_t startTime = millis();
+  while(millis() - startTime < ms) this->idle((ms - (millis() - startTime)) * 1000UL);
+}
+
+void JQ8400_Serial::waitIdle(JQ8400_Serial &mp3, uint32_t maxMicros)
+{
+#if defined(__AVR__)
+  // Any interrupt wakes us, and the millis() timer is one within about 1ms, 
+  //  so maxMicros needs no timer of it's own.  sleep_cpu() straight after
+  //  sei() runs before any interrupt can, so one can't slip in between 
+  //  the check and the sleep and leave us asleep with a byte waiting.
+  (void) maxMicros;
+  
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  if(mp3._Serial->available()) 
+  {
+    sei();
+    return;
+  }
+  sleep_enable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
+#elif defined(ESP32)
+  // A blocked task isn't woken by the UART, so never more than a tick
+  (void) mp3;
+  
+  if(maxMicros >= portTICK_PERIOD_MS * 1000UL) vTaskDelay(1);
+  else                                         yield();
+#else
+  (void) mp3;
+  (void) maxMicros;
+  
+  yield();
+#endif
+}
+
+
+void JQ8400_Serial::writeFrame(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength)
+{
+  // Assemble the frame and send it in a single write, computing the checksum 
+  //  as we go.  Queued data is never longer than the buffer, but a blocking 
+  //  command's can be (a folder and file path, 13 bytes) with MP3_FRAME_DATA_LENGTH
+  //  set lower, that goes out in buffer sized pieces.
+  uint8_t frame[MP3_FRAME_DATA_LENGTH + 4];
+  uint8_t checksum = MP3_CMD_BEGIN + command + requestLength;
+  
+  frame[0] = MP3_CMD_BEGIN;
+  frame[1] = command;
+  frame[2] = requestLength;
+  
+  uint8_t i = 3;
+  for(uint8_t x = 0; x < requestLength; x++)
+  {
+    if(i == sizeof(frame))
+    {
+      this->_Serial->write(frame, i);
+      i = 0;
+    }
+    
+    frame[i++]  = requestBuffer[x];
+    checksum   += requestBuffer[x];
+  }
+  
+  if(i == sizeof(frame))
+  {
+    this->_Serial->write(frame, i);
+    i = 0;
+  }
+  frame[i++] = checksum;
+  
+  this->_Serial->write(frame, i);
+  
+#if MP3_TRACE
+  this->trace(MP3_TRACE_TX, command, requestBuffer, requestLength);
+#endif
+  
+  this->frameWritten(requestLength + 4);
+}
+
+void JQ8400_Serial::writeFrame(const uint8_t *frame)
+{
+  // All done already, only to get it out of flash
+  uint8_t buf[MP3_FRAME_DATA_LENGTH + 4];
+  uint8_t length = pgm_read_byte(frame + 2) + 4;
+  
+  memcpy_P(buf, frame, length);
+  this->_Serial->write(buf, length);
+  
+#if MP3_TRACE
+  this->trace(MP3_TRACE_TX, buf[1], buf + 3, buf[2]);
+#endif
+  
+  this->frameWritten(length);
+}
+
+void JQ8400_Serial::frameWritten(uint16_t length)
+{
+  // The next frame may go once this one is on the wire, plus the gap
+  this->txReadyAt = micros() + length * (uint32_t)this->byteTime + this->interFrameGap;
+  
+#if MP3_STATS
+  this->stats.bytesTx += length;
+#endif
+}
+
+uint8_t JQ8400_Serial::parseResponseByte(uint8_t b)
+{
+#if MP3_STATS
+  this->stats.bytesRx++;
+#endif
+  
+  // The response format is the same as the command format
+  //  AA [CMD] [DATA_COUNT] [B1..N] [SUM]
+  switch(this->rxState)
+  {
+    case MP3_RX_STATE_BEGIN:
+      // Anything before the start byte is garbage, skip it
+      if(b == MP3_CMD_BEGIN)
+      {
+        this->rxChecksum = b;
+        this->rxState    = MP3_RX_STATE_COMMAND;
+      }
+      return MP3_RX_INCOMPLETE;
+      
+    case MP3_RX_STATE_COMMAND:
+      this->rxCommand   = b;
+      this->rxChecksum += b;
+      this->rxState     = MP3_RX_STATE_LENGTH;
+      return MP3_RX_INCOMPLETE;
+      
+    case MP3_RX_STATE_LENGTH:
+      this->rxLength    = b;
+      this->rxCount     = 0;
+      this->rxChecksum += b;
+      this->rxState     = b ? MP3_RX_STATE_DATA : MP3_RX_STATE_CHECKSUM;
+      return MP3_RX_INCOMPLETE;
+      
+    case MP3_RX_STATE_DATA:
+      // Data beyond our buffer is still counted (and checksummed) but discarded
+      if(this->rxCount < sizeof(this->rxData)) this->rxData[this->rxCount] = b;
+      this->rxCount++;
+      this->rxChecksum += b;
+      if(this->rxCount == this->rxLength) this->rxState = MP3_RX_STATE_CHECKSUM;
+      return MP3_RX_INCOMPLETE;
+      
+    default:
+      this->rxState = MP3_RX_STATE_BEGIN;
+      
+#if MP3_STATS
+      if(b != this->rxChecksum) this->stats.checksumErrors++;
+#endif
+      
+#if MP3_TRACE
+      this->trace(b == this->rxChecksum ? MP3_TRACE_RX : MP3_TRACE_RX_BAD, this->rxCommand, this->rxData, this->rxLength < sizeof(this->rxData) ? this->rxLength : sizeof(this->rxData));
+#endif
+      
+      return (b == this->rxChecksum) ? MP3_RX_FRAME : MP3_RX_BAD_CHECKSUM;
+  }
+}
+
+uint8_t JQ8400_Serial::queueCommand(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, uint8_t expectResponse, JQ8400_RequestCallback callback)
+{
+  if(requestLength > MP3_FRAME_DATA_LENGTH) return 0;
+  
+  // Find a free slot, failing that reclaim the oldest completed (uncollected) one
+  uint8_t slot = MP3_NO_SLOT;
+  uint8_t age  = 0;
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    if(!this->requests[x].id)
+    {
+      slot = x;
+      break;
+    }
+    
+    if(this->requests[x].state >= MP3_REQUEST_DONE && (uint8_t)(this->nextRequestId - this->requests[x].id) >= age)
+    {
+      slot = x;
+      age  = this->nextRequestId - this->requests[x].id;
+    }
+  }
+  
+  if(slot == MP3_NO_SLOT) return 0;
+  
+  AsyncRequest &r = this->requests[slot];
+  r.id             = this->nextRequestId++;
+  if(!this->nextRequestId) this->nextRequestId = 1; // 0 is never a valid handle
+  r.state          = MP3_REQUEST_QUEUED;
+  r.command        = command;
+  r.length         = requestLength;
+  r.expectResponse = expectResponse;
+  r.attempts       = 0;
+  r.callback       = callback;
+  if(requestLength) memcpy(r.data, requestBuffer, requestLength);
+  
+  return r.id;
+}
+
+uint8_t JQ8400_Serial::requestState(uint8_t request)
+{
+  if(!request) return MP3_REQUEST_UNKNOWN;
+  
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    if(this->requests[x].id == request) 
+    {
+      if(x == this->awaitingResponseTo(MP3_ANY_COMMAND) && this->rxState != MP3_RX_STATE_BEGIN)
+      {
+        return MP3_REQUEST_AWAIT_PAYLOAD;
+      }
+      return this->requests[x].state;
+    }
+  }
+  
+  return MP3_REQUEST_UNKNOWN;
+}
+
+uint8_t JQ8400_Serial::requestResponse(uint8_t request, uint8_t *buffer, uint8_t bufferLength)
+{
+  if(!request) return 0;
+  
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    AsyncRequest &r = this->requests[x];
+    if(r.id != request) continue;
+    
+    // Still going, nothing to collect yet
+    if(r.state < MP3_REQUEST_DONE) return 0;
+    
+    uint8_t length = 0;
+    if(r.state == MP3_REQUEST_DONE)
+    {
+      length = r.length;
+      if(buffer) memcpy(buffer, r.data, length < bufferLength ? length : bufferLength);
+    }
+    
+    r.id = 0;
+    return length;
+  }
+  
+  return 0;
+}
+
+uint8_t JQ8400_Serial::collectRequest(uint8_t &request, uint8_t *buffer, uint8_t bufferLength, uint8_t *length)
+{
+  uint8_t result = this->requestState(request);
+  if(result != MP3_REQUEST_UNKNOWN && result < MP3_REQUEST_DONE) return result;
+  
+  uint8_t got = this->requestResponse(request, buffer, bufferLength);
+  if(length) *length = got;
+  
+  request = 0;
+  return result;
+}
+
+uint8_t JQ8400_Serial::pendingRequests()
+{
+  uint8_t count = 0;
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    if(this->requests[x].id && this->requests[x].state < MP3_REQUEST_DONE) count++;
+  }
+  return count;
+}
+
+void JQ8400_Serial::failRequest(uint8_t slot, uint8_t result)
+{
+  AsyncRequest &r = this->requests[slot];
+  this->setFlag(MP3_FLAG_RX_UNEXPECTED, false);
+  
+#if MP3_STATS
+  this->recordStats(r.command, result, micros() - r.sentMicros);
+#endif
+  
+  // Back in the queue, being the oldest it goes next (once the backoff passes)
+  if(r.attempts < this->responsePolicy[commandClass(r.command)].retries)
+  {
+    r.attempts++;
+    r.state  = MP3_REQUEST_QUEUED;
+    
+#if MP3_STATS
+    this->stats.retries++;
+#endif
+    
+    r.sentAt = millis();
+    return;
+  }
+  
+  this->completeRequest(slot, result);
+}
+
+uint8_t JQ8400_Serial::awaitingResponseTo(uint8_t command)
+{
+  // By order of transmission, not of queueing, a retry goes after what may
+  //  have been sent in the meantime
+  uint8_t slot = MP3_NO_SLOT;
+  uint8_t age  = 0;
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    AsyncRequest &r = this->requests[x];
+    if(!r.id || r.state != MP3_REQUEST_AWAIT_HEADER) continue;
+    if(command != MP3_ANY_COMMAND && r.command != command) continue;
+    
+    if((uint8_t)(this->txSequence - r.sentSequence) >= age)
+    {
+      slot = x;
+      age  = this->txSequence - r.sentSequence;
+    }
+  }
+  
+  return slot;
+}
+
+void JQ8400_Serial::configure(const JQ8400_Config &config)
+{
+  this->setResponsePolicy(MP3_CLASS_QUERY, config.queryTimeout, config.queryRetries, config.retryBackoff);
+  this->setResponsePolicy(MP3_CLASS_NAME,  config.nameTimeout,  config.nameRetries,  config.retryBackoff);
+  this->setStatusChecks(config.statusChecks);
+  this->setPipelineDepth(config.pipelineDepth);
+  this->setInterFrameGap(config.interFrameGap);
+  this->setBaudRate(config.baudRate);
+  
+#if MP3_TRACE
+  this->setTraceSink(config.traceSink, config.traceContext);
+#endif
+}
+
+uint32_t JQ8400_Serial::probeBaudRate(JQ8400_BaudCallback setRate, const uint32_t *rates, uint8_t count)
+{
+  // One attempt at each, a wrong rate gives either nothing or garbage
+  ResponsePolicy policy = this->responsePolicy[MP3_CLASS_QUERY];
+  this->responsePolicy[MP3_CLASS_QUERY].retries = 0;
+  
+  uint32_t found = 0;
+  for(uint8_t x = 0; x < count && !found; x++)
+  {
+    setRate(*this, rates[x]);
+    this->setBaudRate(rates[x]);
+    
+    // Whatever arrived at the last rate is meaningless at this one
+    while(this->_Serial->available()) this->_Serial->read();
+    
+    uint8_t status;
+    this->transact(MP3_CMD_STATUS, NULL, 0, NULL, &status, 1);
+    if(this->lastRequestResult == MP3_REQUEST_DONE) found = rates[x];
+  }
+  
+  this->responsePolicy[MP3_CLASS_QUERY] = policy;
+  
+  if(!found)
+  {
+    setRate(*this, 9600);
+    this->setBaudRate(9600);
+  }
+  
+  return found;
+}
+
+void JQ8400_Serial::setResponsePolicy(uint8_t commandClass, uint16_t timeout, uint8_t retries, uint8_t backoff)
+{
+  if(commandClass >= MP3_CLASSES) return;
+  
+  this->responsePolicy[commandClass].timeout = timeout;
+  this->responsePolicy[commandClass].retries = retries;
+  this->responsePolicy[commandClass].backoff = backoff;
+}
+
+void JQ8400_Serial::completeRequest(uint8_t slot, uint8_t result)
+{
+  AsyncRequest &r = this->requests[slot];
+  this->setFlag(MP3_FLAG_RX_UNEXPECTED, false);
+  
+#if MP3_STATS
+  // Failures were counted by failRequest()
+  if(result == MP3_REQUEST_DONE) this->recordStats(r.command, result, micros() - r.sentMicros);
+#endif
+  
+  if(result == MP3_REQUEST_DONE && r.expectResponse)
+  {
+    r.length = this->rxLength < sizeof(r.data) ? this->rxLength : sizeof(r.data);
+    memcpy(r.data, this->rxData, r.length);
+    this->observeFrame(this->rxCommand, r.data, r.length);
+  }
+  else
+  {
+    r.length = 0;
+  }
+  
+  r.state = result;
+  
+  if(r.callback)
+  {
+    // The slot is freed before the callback, which may queue another request
+    //  and be given it, so the callback is given a copy of the response
+    JQ8400_RequestCallback callback = r.callback;
+    uint8_t id      = r.id;
+    uint8_t command = r.command;
+    uint8_t length  = r.length;
+    uint8_t data[MP3_FRAME_DATA_LENGTH];
+    
+    memcpy(data, r.data, length);
+    r.id = 0;
+    
+    callback(*this, id, result, command, data, length);
+  }
+  else if(!r.expectResponse)
+  {
+    // Nobody is going to collect this
+    r.id = 0;
+  }
+}
+
+uint8_t JQ8400_Serial::oldestRequest(uint8_t state)
+{
+  uint8_t slot = MP3_NO_SLOT;
+  uint8_t age  = 0;
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    if(this->requests[x].id && this->requests[x].state == state && (uint8_t)(this->nextRequestId - this->requests[x].id) >= age)
+    {
+      slot = x;
+      age  = this->nextRequestId - this->requests[x].id;
+    }
+  }
+  return slot;
+}
+
+uint8_t JQ8400_Serial::countRequests(uint8_t state)
+{
+  uint8_t count = 0;
+  for(uint8_t x = 0; x < MP3_ASYNC_QUEUE_LENGTH; x++)
+  {
+    if(this->requests[x].id && this->requests[x].state == state) count++;
+  }
+  return count;
+}
+
+void JQ8400_Serial::update()
+{
+  // Consume only what has already arrived, responses come back in the
+  //  order the commands were sent so belong to the oldest one awaiting
+  while(this->_Serial->available())
+  {
+    uint8_t result = this->parseResponseByte(this->_Serial->read());
+    if(result == MP3_RX_INCOMPLETE) continue;
+    
+    // A corrupt frame can't say who it is for, it can only be the first sent
+    if(result == MP3_RX_BAD_CHECKSUM)
+    {
+      uint8_t slot = this->awaitingResponseTo(MP3_ANY_COMMAND);
+      if(slot != MP3_NO_SLOT) this->failRequest(slot, MP3_REQUEST_CHECKSUM_FAILED);
+      continue;
+    }
+    
+    // Otherwise it's the response for whatever it echoes, 
+    //  or if we didn't ask for that, something else (eg a position report)
+    uint8_t slot = this->awaitingResponseTo(this->rxCommand);
+    if(slot == MP3_NO_SLOT)
+    {
+      if(this->rxCommand != MP3_CMD_CURRENT_FILE_POS && this->countRequests(MP3_REQUEST_AWAIT_HEADER)) this->setFlag(MP3_FLAG_RX_UNEXPECTED, true);
+      this->handleUnsolicitedFrame();
+      continue;
+    }
+    
+    // Responses come in order, any older one still waiting has lost it's response
+    uint8_t older;
+    while((older = this->awaitingResponseTo(MP3_ANY_COMMAND)) != slot)
+    {
+      this->failRequest(older, MP3_REQUEST_TIMEOUT);
+    }
+    
+    this->completeRequest(slot, MP3_REQUEST_DONE);
+  }
+  
+  // Position reports stop when playing stops, if they were coming and have
+  //  stopped without us doing anything, the track has finished
+  if(flag(MP3_FLAG_POSITION_STREAMING) && shadowValid(MP3_SHADOW_STATUS) && currentStatus == MP3_STATUS_PLAYING && shadowAge(MP3_SHADOW_POSITION) > MP3_POSITION_SILENCE && shadowValid(MP3_SHADOW_POSITION))
+  {
+    this->seedStatusVote(MP3_STATUS_STOPPED);
+    this->statusObserved(MP3_STATUS_STOPPED);
+  }
+  
+  if(flag(MP3_FLAG_STATUS_TRACKING)) this->trackStatus();
+  
+  if(flag(MP3_FLAG_STARTUP_PROBE_DUE) && (int32_t)(millis() - startupProbeAt) >= 0) this->startupProbe();
+  
+  if(flag(MP3_FLAG_FADE_ACTIVE)) this->advanceFade();
+  
+  // The next segment of a long sequence, once nothing else is in the way
+  if(flag(MP3_FLAG_PLAYLIST_DUE) && !this->pendingRequests() && this->txReady())
+  {
+    setFlag(MP3_FLAG_PLAYLIST_DUE, false);
+    
+    invalidateShadow(MP3_SHADOW_STATUS);
+    this->writePlaylist();
+  }
+  
+  // If the first sent has had no response in time, it's not going to get one
+  uint8_t slot;
+  while((slot = this->awaitingResponseTo(MP3_ANY_COMMAND)) != MP3_NO_SLOT)
+  {
+    AsyncRequest &r = this->requests[slot];
+    if((uint16_t)((uint16_t)millis() - r.sentAt) < this->responseTimeout(r.command, r.length)) break;
+    
+    this->rxState = MP3_RX_STATE_BEGIN;
+    
+#if MP3_TRACE
+    this->trace(MP3_TRACE_TIMEOUT, r.command, NULL, 0);
+#endif
+    
+    this->failRequest(slot, this->flag(MP3_FLAG_RX_UNEXPECTED) ? MP3_REQUEST_UNEXPECTED : MP3_REQUEST_TIMEOUT);
+  }
+  
+  // Transmit the oldest queued requests, as long as the pipeline has room 
+  //  and the gap since the last frame has passed
+  while((slot = this->oldestRequest(MP3_REQUEST_QUEUED)) != MP3_NO_SLOT)
+  {
+    uint8_t awaiting = this->countRequests(MP3_REQUEST_AWAIT_HEADER);
+    if(awaiting >= this->pipelineDepth || !this->txReady()) return;
+    
+    AsyncRequest &r = this->requests[slot];
+    
+    // A retry waits out it's backoff first
+    if(r.attempts && (uint16_t)((uint16_t)millis() - r.sentAt) < ((uint16_t)this->responsePolicy[commandClass(r.command)].backoff << (r.attempts - 1))) return;
+    
+    // Any partial frame on the line now can not be a response
+    if(!awaiting) this->rxState = MP3_RX_STATE_BEGIN;
+    
+#if MP3_STATS
+    r.sentMicros = micros();
+#endif
+    
+    this->writeFrame(r.command, r.data, r.length);
+    
+    if(r.expectResponse)
+    {
+      r.state        = MP3_REQUEST_AWAIT_HEADER;
+      r.sentAt       = millis();
+      r.sentSequence = this->txSequence++;
+    }
+    else
+    {
+      this->completeRequest(slot, MP3_REQUEST_DONE);
+    }
+  }
+}
+
+void JQ8400_Serial::beginBatch()
+{
+  if(!this->batchDepth++)
+  {
+    this->setFlag(MP3_FLAG_ASYNC_BEFORE_BATCH, this->flag(MP3_FLAG_ASYNC));
+    this->setFlag(MP3_FLAG_ASYNC, true);
+  }
+}
+
+void JQ8400_Serial::endBatch(uint8_t wait)
+{
+  if(!this->batchDepth || --this->batchDepth) return;
+  
+  this->setFlag(MP3_FLAG_ASYNC, this->flag(MP3_FLAG_ASYNC_BEFORE_BATCH));
+  if(wait) this->flushQueue();
+}
+
+void JQ8400_Serial::flushQueue()
+{
+  while(this->pendingRequests()) 
+  {
+    this->update();
+    if(this->pendingRequests()) this->idle(this->byteTime);
+  }
+}
+
+#if MP3_STATS
+
+void JQ8400_Serial::recordStats(uint8_t command, uint8_t result, uint32_t latency)
+{
+  static const uint16_t limits[MP3_STATS_BUCKETS - 1] PROGMEM = MP3_STATS_BUCKET_LIMITS;
+  
+  if(result == MP3_REQUEST_TIMEOUT)    this->stats.timeouts++;
+  if(result == MP3_REQUEST_UNEXPECTED) this->stats.unexpected++;
+  
+  // This command's entry, or a new one, or once they are all used the last
+  //  (for everything else)
+  uint8_t x;
+  for(x = 0; x < MP3_STATS_COMMANDS - 1; x++)
+  {
+    if(!this->stats.commands[x].count || this->stats.commands[x].command == command) break;
+  }
+  
+  JQ8400_CommandStats &c = this->stats.commands[x];
+  if(c.count && c.command != command) command = 0xFF;
+  c.command = command;
+  
+  if(!c.count || latency < c.minMicros) c.minMicros = latency;
+  if(latency > c.maxMicros)             c.maxMicros = latency;
+  
+  c.count++;
+  c.totalMicros += latency;
+  if(result != MP3_REQUEST_DONE) c.failures++;
+  
+  uint8_t bucket = 0;
+  while(bucket < MP3_STATS_BUCKETS - 1 && latency > pgm_read_word(&limits[bucket]) * 1000UL) bucket++;
+  c.histogram[bucket]++;
+}
+
+void JQ8400_Serial::dumpStats(Print &out)
+{
+  static const uint16_t limits[MP3_STATS_BUCKETS - 1] PROGMEM = MP3_STATS_BUCKET_LIMITS;
+  
+  out.print(F("TX bytes: "));          out.print(this->stats.bytesTx);
+  out.print(F(", RX bytes: "));        out.print(this->stats.bytesRx);
+  out.print(F(", timeouts: "));        out.print(this->stats.timeouts);
+  out.print(F(", checksum errors: ")); out.print(this->stats.checksumErrors);
+  out.print(F(", unexpected: "));      out.print(this->stats.unexpected);
+  out.print(F(", retries: "));         out.print(this->stats.retries);
+  out.print(F(", unsolicited: "));     out.println(this->stats.unsolicited);
+  
+  if(this->stats.exchanges)
+  {
+    out.print(F("Average us of "));    out.print(this->stats.exchanges);
+    out.print(F(" queries, flush: ")); out.print(this->stats.flushMicros     / this->stats.exchanges);
+    out.print(F(", gap: "));           out.print(this->stats.gapMicros       / this->stats.exchanges);
+    out.print(F(", tx: "));            out.print(this->stats.txMicros        / this->stats.exchanges);
+    out.print(F(", first byte: "));    out.print(this->stats.firstByteMicros / this->stats.exchanges);
+    out.print(F(", payload: "));       out.println(this->stats.payloadMicros / this->stats.exchanges);
+  }
+  
+  out.print(F("Latency buckets (ms):"));
+  for(uint8_t x = 0; x < MP3_STATS_BUCKETS - 1; x++)
+  {
+    out.print(F(" <=")); out.print(pgm_read_word(&limits[x]));
+  }
+  out.println(F(" more"));
+  
+  for(uint8_t x = 0; x < MP3_STATS_COMMANDS && this->stats.commands[x].count; x++)
+  {
+    const JQ8400_CommandStats &c = this->stats.commands[x];
+    
+    if(c.command < 16) out.print(0);
+    out.print(c.command, HEX);
+    out.print(F(": "));        out.print(c.count);
+    out.print(F(" sent, "));   out.print(c.failures);
+    out.print(F(" failed, ")); out.print(c.minMicros);
+    out.print(F("/"));         out.print(c.totalMicros / c.count);
+    out.print(F("/"));         out.print(c.maxMicros);
+    out.print(F(" us min/avg/max, buckets"));
+    for(uint8_t b = 0; b < MP3_STATS_BUCKETS; b++)
+    {
+      out.print(F(" ")); out.print(c.histogram[b]);
+    }
+    out.println();
+  }
+}
+
+#endif
@@ -63,15 +63,413 @@
 #define MP3_STATUS_PAUSED  2
 
 // The response from a status query could be unreliable
-//  we can increase this to check multiple times.
+//  we can increase this to check multiple times, the default for 
+//  setStatusChecks()
+#ifndef MP3_STATUS_CHECKS_IN_AGREEMENT
 #define MP3_STATUS_CHECKS_IN_AGREEMENT 1
+#endif
 
-#define MP3_DEBUG 0
+// The last this many status responses are voted on to decide the status,
+//  see statusConfidence()
+#ifndef MP3_STATUS_VOTE_WINDOW
+#define MP3_STATUS_VOTE_WINDOW 5
+#endif
+
+// With setStatusTracking(), how often (ms) to poll the status when it is 
+//  uncertain (just after a command, the vote isn't unanimous, or near the 
+//  end of the track), and otherwise.
+#ifndef MP3_STATUS_POLL_FAST
+#define MP3_STATUS_POLL_FAST 200
+#endif
+
+#ifndef MP3_STATUS_POLL_SLOW
+#define MP3_STATUS_POLL_SLOW 2000
+#endif
+
+// Times startup() asks whether the device is ready, MP3_STARTUP_RETRY ms apart, before giving up
+#ifndef MP3_STARTUP_ATTEMPTS
+#define MP3_STARTUP_ATTEMPTS 10
+#endif
+
+#ifndef MP3_STARTUP_RETRY
+#define MP3_STARTUP_RETRY 100
+#endif
+
+// Progress of startup(), see startupState()
+#define MP3_STARTUP_NONE    0  // startup() not called
+#define MP3_STARTUP_PENDING 1  // In progress
+#define MP3_STARTUP_READY   2  // The device answered, ready to use
+#define MP3_STARTUP_FAILED  3  // The device never answered
+
+// Set to 1 to pass every frame sent and received to a trace sink (see 
+//  setTraceSink() and JQ8400_Trace), when 0 none of it is compiled in.
+//  MP3_DEBUG, which printed the frames as they went, now sets this instead.
+//  Like the other options which change what a JQ8400_Serial holds, it must 
+//  be the same for the whole build, see MP3_LAYOUT.
+#ifndef MP3_TRACE
+  #if defined(MP3_DEBUG) && MP3_DEBUG
+    #define MP3_TRACE 1
+  #else
+    #define MP3_TRACE 0
+  #endif
+#endif
+
+// What a trace sink is given, see setTraceSink()
+#define MP3_TRACE_TX       0  // A frame was sent
+#define MP3_TRACE_RX       1  // A frame was received
+#define MP3_TRACE_RX_BAD   2  // A frame was received with a bad checksum
+#define MP3_TRACE_TIMEOUT  3  // No (complete) response came to the command
+
+// Set to 1 to keep statistics of every command (latency, errors, bytes), 
+//  see getStats(), when 0 none of it is compiled in.
+#ifndef MP3_STATS
+#define MP3_STATS 0
+#endif
+
+// With MP3_STATS, how many different commands to keep statistics for 
+//  separately, any more are lumped together in the last.
+#ifndef MP3_STATS_COMMANDS
+#define MP3_STATS_COMMANDS 8
+#endif
+
+// With MP3_STATS, the latency histogram has a bucket for each of these 
+//  upper limits (ms), and one for anything longer.
+#define MP3_STATS_BUCKET_LIMITS { 2, 5, 10, 20, 50, 100, 200 }
+#define MP3_STATS_BUCKETS 8
+
+// The asynchronous engine (see update()) can hold this many commands
+//  queued, in flight, or completed but not yet collected.
+#ifndef MP3_ASYNC_QUEUE_LENGTH
+#define MP3_ASYNC_QUEUE_LENGTH 4
+#endif
+
+// Largest number of data bytes in a queued command or a received frame,
+//  the longest we send is a folder/file path (13), the longest we receive is a file name (11).
+#ifndef MP3_FRAME_DATA_LENGTH
+#define MP3_FRAME_DATA_LENGTH 16
+#endif
+
+// Bytes of a file name as the device gives it, 8.3 without the dot
+#define MP3_NAME_LENGTH 11
+
+// If not 0, the most RAM (bytes) a JQ8400_Serial may use, the library will
+//  not compile if it uses more.  On an AVR (ATmega328 etc) with the defaults 
+//  it is about 275 bytes, most of it is what can be tuned...
+//
+//   * the queue, MP3_ASYNC_QUEUE_LENGTH x (MP3_FRAME_DATA_LENGTH + 11), 108
+//   * the receive buffer, MP3_FRAME_DATA_LENGTH, 16
+//   * when each shadow field was set, 32, 4 with MP3_SHADOW_AGES at 0
+//   * the status vote, MP3_STATUS_VOTE_WINDOW + 9, 14
+//   * MP3_STATS, 44 + (MP3_STATS_COMMANDS x 33), and 4 per queued command
+//   * MP3_TRACE, 4, and the JQ8400_Trace itself if used
+//
+// Nothing else is allocated.  The stack used does not depend on what is 
+//  asked, paths and playlists are streamed from where they are, an entry at
+//  a time.  The most buffer a call puts on the stack is 13 bytes for a folder
+//  and file number, above MP3_FRAME_DATA_LENGTH + 4 to assemble the frame, 
+//  and in asynchronous mode MP3_FRAME_DATA_LENGTH to queue it.  A request's 
+//  callback is called from update() with MP3_FRAME_DATA_LENGTH below it, a
+//  copy of the response.
+#ifndef MP3_RAM_BUDGET
+#define MP3_RAM_BUDGET 0
+#endif
+
+// Classes of command which expect a response, each with it's own timeout 
+//  and retries, see setResponsePolicy()
+#define MP3_CLASS_QUERY 0  // Status, position, counts etc, answered in a few ms
+#define MP3_CLASS_NAME  1  // The file name, which the device takes longer to look up
+#define MP3_CLASSES     2
+
+// The default policies, how long (ms) to allow the device to answer a query,
+//  on top of the time the query and the response take on the wire at the 
+//  baud rate (see setBaudRate()), and how many times to try again if the 
+//  answer doesn't come (or is corrupt), waiting MP3_RETRY_BACKOFF ms before
+//  the first retry, doubling for each one after.
+#ifndef MP3_QUERY_TIMEOUT
+#define MP3_QUERY_TIMEOUT 90
+#endif
+
+#ifndef MP3_QUERY_RETRIES
+#define MP3_QUERY_RETRIES 2
+#endif
+
+#ifndef MP3_NAME_TIMEOUT
+#define MP3_NAME_TIMEOUT 280
+#endif
+
+#ifndef MP3_NAME_RETRIES
+#define MP3_NAME_RETRIES 1
+#endif
+
+#ifndef MP3_RETRY_BACKOFF
+#define MP3_RETRY_BACKOFF 5
+#endif
+
+// Sequences (see playSequenceByFileNumber()) longer than this many files are 
+//  sent to the device in segments of this many, each once the last has played.
+//  The frame length byte allows at most 127.
+#ifndef MP3_PLAYLIST_SEGMENT
+#define MP3_PLAYLIST_SEGMENT 32
+#endif
+
+#if MP3_PLAYLIST_SEGMENT > 127
+#error MP3_PLAYLIST_SEGMENT can be at most 127
+#endif
+
+// If position reports (see setPositionStreaming()) stop for this long (ms) while 
+//  playing, the track is taken to have finished.
+#define MP3_POSITION_SILENCE 2500
+
+// How long (us) one byte takes on the wire at 9600 baud (10 bits), the 
+//  default, see setBaudRate()
+#define MP3_BYTE_TIME 1042
+
+// Default minimum time (us) between the end of one frame and the start of the next,
+//  see setInterFrameGap()
+#ifndef MP3_INTER_FRAME_GAP
+#define MP3_INTER_FRAME_GAP 1000
+#endif
+
+// States of an asynchronous request, see requestState()
+#define MP3_REQUEST_UNKNOWN         0  // No such request (never existed, or already collected)
+#define MP3_REQUEST_QUEUED          1  // Waiting to be transmitted
+#define MP3_REQUEST_AWAIT_HEADER    2  // Transmitted, waiting for the response to start
+#define MP3_REQUEST_AWAIT_PAYLOAD   3  // Response header received, waiting for data and checksum
+#define MP3_REQUEST_DONE            4  // Completed successfully
+#define MP3_REQUEST_TIMEOUT         5  // No (complete) response in time, see setResponsePolicy()
+#define MP3_REQUEST_CHECKSUM_FAILED 6  // Response received but the checksum was wrong
+#define MP3_REQUEST_UNEXPECTED      7  // A response came, but not for the command we sent
+
+// Fields of the device shadow, see shadowValid()
+#define MP3_SHADOW_VOLUME   0
+#define MP3_SHADOW_EQ       1
+#define MP3_SHADOW_LOOP     2
+#define MP3_SHADOW_SOURCE   3
+#define MP3_SHADOW_INDEX    4
+#define MP3_SHADOW_STATUS   5
+#define MP3_SHADOW_FILES    6
+#define MP3_SHADOW_POSITION 7
+#define MP3_SHADOW_FIELDS   8
+#define MP3_SHADOW_ALL      0xFF
+
+// Set to 0 to keep when only the position was last set or confirmed, 
+//  shadowAge() is then 0 for the other fields while they are valid, it
+//  saves 28 bytes of RAM.
+#ifndef MP3_SHADOW_AGES
+#define MP3_SHADOW_AGES 1
+#endif
+
+// MP3_STATS, MP3_STATS_COMMANDS, MP3_TRACE, MP3_ASYNC_QUEUE_LENGTH, 
+//  MP3_FRAME_DATA_LENGTH, MP3_STATUS_VOTE_WINDOW and MP3_SHADOW_AGES change 
+//  the size and layout of JQ8400_Serial, so the library and your sketch must
+//  be compiled with the same values.  Set them for the whole build (a build
+//  flag like -DMP3_STATS=1, or change the defaults here), a #define in the 
+//  sketch is not seen by the library, which is compiled on it's own.
+//
+// So that a difference fails to link, rather than quietly corrupting memory,
+//  the library defines a symbol named for the values it was compiled with, 
+//  and the constructor, compiled in your sketch, uses the one named for the 
+//  values your sketch sees.  The error to link names JQ8400_Layout_...
+#define MP3_LAYOUT_NAME(stats, commands, trace, queue, data, votes, ages) \
+  JQ8400_Layout_##stats##_##commands##_##trace##_##queue##_##data##_##votes##_##ages
+#define MP3_LAYOUT_EXPAND(stats, commands, trace, queue, data, votes, ages) \
+  MP3_LAYOUT_NAME(stats, commands, trace, queue, data, votes, ages)
+#define MP3_LAYOUT MP3_LAYOUT_EXPAND(MP3_STATS, MP3_STATS_COMMANDS, MP3_TRACE, \
+  MP3_ASYNC_QUEUE_LENGTH, MP3_FRAME_DATA_LENGTH, MP3_STATUS_VOTE_WINDOW, MP3_SHADOW_AGES)
+
+extern const volatile uint8_t MP3_LAYOUT;
 
 #define HEX_PRINT(a) if(a < 16) Serial.print(0); Serial.print(a, HEX);
 
+/** Sum of bytes, truncated to 8 bits, at compile time (see JQ8400_Frame) */
+
+constexpr uint8_t JQ8400_FrameSum() { return 0; }
+
+template<typename... Bytes> constexpr uint8_t JQ8400_FrameSum(uint8_t first, Bytes... rest)
+{
+  return (uint8_t)(first + JQ8400_FrameSum(rest...));
+}
+
+/** A complete command frame built at compile time, for commands where 
+ *  all the bytes are known in advance (play, pause, status queries...).
+ * 
+ * The frame, checksum included, is stored in flash (PROGMEM) once however
+ *  many times it is used, and sent with a single copy, nothing is computed.
+ * 
+ *     JQ8400_Frame<MP3_CMD_PLAY>::bytes          // AA 02 00 AC
+ *     JQ8400_Frame<MP3_CMD_EQ_SET, 3>::bytes     // AA 1A 01 03 C8
+ * 
+ * @tparam CMD  Command byte
+ * @tparam ARGS Data bytes, if any
+ */
+
+template<uint8_t CMD, uint8_t... ARGS> struct JQ8400_Frame
+{
+  static const uint8_t length = sizeof...(ARGS) + 4;  ///< Total bytes in the frame
+  static const uint8_t bytes[length];                 ///< The frame itself, in PROGMEM
+};
+
+template<uint8_t CMD, uint8_t... ARGS> const uint8_t JQ8400_Frame<CMD, ARGS...>::bytes[JQ8400_Frame<CMD, ARGS...>::length] PROGMEM = 
+{
+  0xAA, CMD, (uint8_t)sizeof...(ARGS), ARGS..., JQ8400_FrameSum(0xAA, CMD, (uint8_t)sizeof...(ARGS), ARGS...)
+};
+
+#if MP3_STATS
+
+/** Statistics of one command, see JQ8400_Serial::getStats() */
+
+struct JQ8400_CommandStats
+{
+  uint8_t  command;      ///< MP3_CMD_*, or 0xFF for all others once the table filled up
+  uint16_t count;        ///< Number of times sent (each retry counts)
+  uint16_t failures;     ///< How many of those got no good response
+  uint32_t minMicros;    ///< Shortest latency, from sending to the complete response (or to sent, if none is expected)
+  uint32_t maxMicros;    ///< Longest latency
+  uint32_t totalMicros;  ///< Total latency, for the average
+  uint16_t histogram[MP3_STATS_BUCKETS]; ///< Count of latencies within each of MP3_STATS_BUCKET_LIMITS
+};
+
+/** Statistics of everything sent and received, see JQ8400_Serial::getStats() */
+
+struct JQ8400_Stats
+{
+  uint32_t bytesTx;          ///< Bytes written to the device
+  uint32_t bytesRx;          ///< Bytes read from the device
+  uint16_t timeouts;         ///< Responses which didn't come in time
+  uint16_t checksumErrors;   ///< Frames received with a bad checksum
+  uint16_t unexpected;       ///< Responses which came for a different command 
+  uint16_t retries;          ///< Requests tried again
+  uint16_t unsolicited;      ///< Frames received that were not a response
+  
+  // Where the time goes in blocking commands, totals
+  uint16_t exchanges;        ///< Number of blocking queries the following are the total of
+  uint32_t flushMicros;      ///< Waiting for the queue to empty and clearing the line
+  uint32_t gapMicros;        ///< Waiting for the inter frame gap
+  uint32_t txMicros;         ///< Writing
+  uint32_t firstByteMicros;  ///< Waiting for the response to start
+  uint32_t payloadMicros;    ///< Receiving the rest of the response
+  
+  JQ8400_CommandStats commands[MP3_STATS_COMMANDS]; ///< By command, the used entries have a non zero count
+};
+
+#endif
+
+class JQ8400_Serial;
+
+/** Callback for completion of an asynchronous request, see queueCommand()
+ * 
+ * @param mp3     The JQ8400_Serial the request was queued on.
+ * @param request The handle returned by queueCommand()
+ * @param result  MP3_REQUEST_DONE, MP3_REQUEST_TIMEOUT, MP3_REQUEST_CHECKSUM_FAILED or MP3_REQUEST_UNEXPECTED
+ * @param command The command byte that was sent
+ * @param data    Response data bytes (only valid during the callback)
+ * @param length  Number of response data bytes
+ */
+
+typedef void (*JQ8400_RequestCallback)(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length);
+
+/** Callback for a frame sent by the device which was not the response to a command, see setUnsolicitedHandler()
+ * 
+ * @param mp3     The JQ8400_Serial which received the frame.
+ * @param command The command byte of the frame
+ * @param data    Data bytes (only valid during the callback)
+ * @param length  Number of data bytes
+ */
+
+typedef void (*JQ8400_FrameCallback)(JQ8400_Serial &mp3, uint8_t command, const uint8_t *data, uint8_t length);
+
+/** Callback for an event noticed in what the device sends us, see onTrackEnd(), onPosition(), onSourceChange(), onStatusChange()
+ * 
+ * @param mp3     The JQ8400_Serial which noticed the event.
+ * @param value   Depends on the event, see the method which set the callback.
+ */
+
+typedef void (*JQ8400_EventCallback)(JQ8400_Serial &mp3, uint16_t value);
+
+/** Callback to supply the files of a sequence one at a time, see playSequence()
+ * 
+ * @param mp3      The JQ8400_Serial playing the sequence.
+ * @param position Which file of the sequence, from 0.
+ * @param name     Put the 2 character name of that file (in the "ZH" folder) here.
+ */
+
+typedef void (*JQ8400_PlaylistGenerator)(JQ8400_Serial &mp3, uint16_t position, char name[2]);
+
+/** Callback given the bytes of a file name as they arrive, see currentFileName()
+ * 
+ * @param mp3      The JQ8400_Serial receiving the name.
+ * @param position Which byte of the name, from 0 (starting again at 0 if the query is retried).
+ * @param c        The byte.
+ */
+
+typedef void (*JQ8400_NameCallback)(JQ8400_Serial &mp3, uint8_t position, char c);
+
+/** Called while the library waits for the device, instead of spinning, see setWaitStrategy()
+ * 
+ * @param mp3       The JQ8400_Serial which is waiting.
+ * @param maxMicros Return within this long, sooner is fine (it is called again if need be).
+ */
+
+typedef void (*JQ8400_WaitStrategy)(JQ8400_Serial &mp3, uint32_t maxMicros);
+
+/** Puts the stream to the device at a baud rate, see probeBaudRate()
+ * 
+ * @param mp3  The JQ8400_Serial whose stream it is.
+ * @param baud Rate to begin the stream at.
+ */
+
+typedef void (*JQ8400_BaudCallback)(JQ8400_Serial &mp3, uint32_t baud);
+
+/** Given each frame sent and received when MP3_TRACE is set, see setTraceSink()
+ * 
+ * Called from inside the protocol engine, often while it is timing
+ *  something, so it must be quick, record it and get out (see JQ8400_Trace).
+ * 
+ * @param mp3     The JQ8400_Serial which sent or received it.
+ * @param context Pointer given to setTraceSink()
+ * @param event   MP3_TRACE_TX, MP3_TRACE_RX, MP3_TRACE_RX_BAD or MP3_TRACE_TIMEOUT
+ * @param command Command byte
+ * @param data    Data bytes, NULL if they were streamed out (paths, playlists) or for a timeout.
+ * @param length  Number of data bytes (whether given or not).
+ */
+
+typedef void (*JQ8400_TraceSink)(JQ8400_Serial &mp3, void *context, uint8_t event, uint8_t command, const uint8_t *data, uint8_t length);
+
+/** Settings of a JQ8400_Serial, all in one place, see JQ8400_Serial::configure()
+ * 
+ * Each starts at the default from the matching MP3_* define, change only
+ *  what you need.
+ * 
+ *     JQ8400_Config config;
+ *     config.statusChecks = 3;
+ *     config.queryTimeout = 40;
+ *     
+ *     JQ8400_Serial mp3(Serial2, config);
+ */
+
+struct JQ8400_Config
+{
+  uint16_t queryTimeout  = MP3_QUERY_TIMEOUT;              ///< See setResponsePolicy(), MP3_CLASS_QUERY
+  uint8_t  queryRetries  = MP3_QUERY_RETRIES;              ///< See setResponsePolicy(), MP3_CLASS_QUERY
+  uint16_t nameTimeout   = MP3_NAME_TIMEOUT;               ///< See setResponsePolicy(), MP3_CLASS_NAME
+  uint8_t  nameRetries   = MP3_NAME_RETRIES;               ///< See setResponsePolicy(), MP3_CLASS_NAME
+  uint8_t  retryBackoff  = MP3_RETRY_BACKOFF;              ///< See setResponsePolicy(), both classes
+  uint8_t  statusChecks  = MP3_STATUS_CHECKS_IN_AGREEMENT; ///< See setStatusChecks()
+  uint8_t  pipelineDepth = 1;                              ///< See setPipelineDepth()
+  uint16_t interFrameGap = MP3_INTER_FRAME_GAP;            ///< See setInterFrameGap()
+  uint32_t baudRate      = 9600;                           ///< See setBaudRate()
+#if MP3_TRACE
+  JQ8400_TraceSink traceSink    = NULL;                    ///< See setTraceSink()
+  void            *traceContext = NULL;                    ///< See setTraceSink()
+#endif
+};
+
 class JQ8400_Serial
 {
+  friend class JQ8400_Group;
+  friend class JQ8400_Catalog;
+  friend class JQ8400_Esp32Uart;
+  
   protected: 
      Stream *_Serial; ///< Set in the constructor, the stream (eg HardwareSerial or SoftwareSerial object) that connects us to the device.
     
@@ -142,7 +540,567 @@ class JQ8400_Serial
      * 
      */
     
-    JQ8400_Serial(Stream &_Stream) { _Serial = &_Stream; };
+    JQ8400_Serial(Stream &_Stream) { (void) MP3_LAYOUT; _Serial = &_Stream; };
+    
+    /** Create JQ8400 object with a given serial object, and settings.
+     * 
+     * @param _Stream The stream to the device, as above.
+     * @param config  Settings, see configure()
+     */
+    
+    JQ8400_Serial(Stream &_Stream, const JQ8400_Config &config) { (void) MP3_LAYOUT; _Serial = &_Stream; configure(config); };
+    
+    /** Apply all of the settings in a JQ8400_Config at once, the same as 
+     *  calling each of the setters it names.
+     * 
+     * @param config Settings
+     */
+    
+    void configure(const JQ8400_Config &config);
+    
+    /** @name Asynchronous (Non Blocking) Operation
+     * 
+     * Normally every method here blocks until the command has been sent and,
+     *  for queries, until the response has been read.  
+     * 
+     * Alternatively commands can be queued with `queueCommand()` and then 
+     *  `update()` called from your `loop()` advances them without ever waiting, 
+     *  the result is given to a callback, or can be polled with `requestState()`
+     *  and collected with `requestResponse()`.
+     * 
+     * **Example**
+     * 
+     *     void statusArrived(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length)
+     *     {
+     *       if(result == MP3_REQUEST_DONE && length) 
+     *       {
+     *         Serial.println(data[0] == MP3_STATUS_PLAYING ? "Playing" : "Not Playing");
+     *       }
+     *     }
+     * 
+     *     void loop()
+     *     {
+     *       mp3.update();
+     *       if(!mp3.pendingRequests()) 
+     *       {
+     *         mp3.queueCommand(JQ8400_Serial::MP3_CMD_STATUS, NULL, 0, true, statusArrived);
+     *       }
+     *       // Do other things, nothing above blocks
+     *     }
+     * 
+     */
+    ///@{
+    
+    /** Advance the asynchronous engine, call this frequently from your `loop()`.
+     *  
+     *  Reads whatever response bytes have already arrived, completes or times out
+     *  the request in flight, and transmits the next queued command.  Never waits.
+     */
+    
+    void update();
+    
+    /** Queue a command for transmission by `update()`.
+     * 
+     * @param command         Byte value of to send as from the datasheet (see MP3_CMD_*)
+     * @param requestBuffer   Data bytes for the command (copied, may be NULL)
+     * @param requestLength   Number of data bytes, at most MP3_FRAME_DATA_LENGTH
+     * @param expectResponse  True if the device responds to this command (ie, a query)
+     * @param callback        Function to call on completion (may be NULL)
+     * 
+     * @return Request handle (non zero), or 0 if the queue is full or the data too long.
+     */
+    
+    uint8_t queueCommand(uint8_t command, const uint8_t *requestBuffer = NULL, uint8_t requestLength = 0, uint8_t expectResponse = 0, JQ8400_RequestCallback callback = NULL);
+    
+    /** Get the state of a queued request.
+     * 
+     * @param request Handle returned by queueCommand()
+     * @return One of the MP3_REQUEST_* states
+     */
+    
+    uint8_t requestState(uint8_t request);
+    
+    /** Collect the response of a completed request and release it.
+     * 
+     * Requests queued with a callback are released automatically after the 
+     *  callback, and requests without a callback which expect no response
+     *  are released once sent, so this is only needed for polled queries.
+     * 
+     * Completed but uncollected requests are reclaimed (oldest first) if
+     *  the queue runs out of room.
+     * 
+     * @param request      Handle returned by queueCommand()
+     * @param buffer       Buffer to copy the response data into (may be NULL)
+     * @param bufferLength Size of the buffer
+     * @return Number of data bytes in the response, 0 if not DONE.
+     */
+    
+    uint8_t requestResponse(uint8_t request, uint8_t *buffer = NULL, uint8_t bufferLength = 0);
+    
+    /** Follow a request to it's end from a state machine which polls it, 
+     *  collecting the response once there is one.
+     * 
+     * The handle is left as it is while the request waits to be sent or for 
+     *  it's response, and set to 0 once it has finished with, completed (the
+     *  response collected) or, for one without a response, sent.
+     * 
+     *     if(!request) request = mp3.queueCommand(...);   // No room before
+     *     uint8_t result = mp3.collectRequest(request, data, sizeof(data), &length);
+     *     if(request) return;                              // Still going
+     * 
+     * @param request      Handle returned by queueCommand(), 0 once finished with
+     * @param buffer       Buffer to copy the response data into (may be NULL)
+     * @param bufferLength Size of the buffer
+     * @param length       Set to the number of data bytes in the response (may be NULL)
+     * @return The request's state, once finished MP3_REQUEST_DONE or the failure
+     *  (or MP3_REQUEST_UNKNOWN if it has already been released).
+     */
+    
+    uint8_t collectRequest(uint8_t &request, uint8_t *buffer = NULL, uint8_t bufferLength = 0, uint8_t *length = NULL);
+    
+    /** Count the requests queued or in flight (not including completed ones).
+     * 
+     * @return Number of requests still to be completed.
+     */
+    
+    uint8_t pendingRequests();
+    
+    /** Send all commands that don't expect a response (play(), setVolume() etc) through
+     *  the queue instead of blocking.
+     * 
+     * Queries (getStatus() etc) still block, after first waiting for the 
+     *  queue to empty so that order is preserved.  You must call `update()`
+     *  frequently when this is enabled.
+     * 
+     * @param enable True to queue, False (default) to send immediately.
+     */
+    
+    void setAsync(uint8_t enable) { setFlag(MP3_FLAG_ASYNC, enable); }
+    
+    /** Set how long to wait for responses, and how hard to try, for a class
+     *  of command.  Applies to queued requests as well as blocking ones.
+     * 
+     * A failed attempt costs only the timeout, so keep it short and let the 
+     *  retries deal with the occasional lost or corrupt response.
+     * 
+     * **Example**
+     * 
+     *     // Status must be quick, but can be retried a few times
+     *     mp3.setResponsePolicy(MP3_CLASS_QUERY, 50, 3);
+     * 
+     * The time for the command and the response to cross the wire (at the
+     *  rate given to setBaudRate()) is added to the timeout, so it need only
+     *  allow for the device itself.
+     * 
+     * @param commandClass  MP3_CLASS_QUERY or MP3_CLASS_NAME
+     * @param timeout       Longest (ms) to allow the device to answer.
+     * @param retries       Number of times to try again after the first failure.
+     * @param backoff       Wait (ms) before the first retry, doubled for each after.
+     */
+    
+    void setResponsePolicy(uint8_t commandClass, uint16_t timeout, uint8_t retries = 0, uint8_t backoff = MP3_RETRY_BACKOFF);
+    
+    /** The result of the last query (getStatus(), countFiles() etc, but not
+     *  those answered from the device shadow), which will otherwise have 
+     *  returned 0 without telling you whether that is what the device said.
+     * 
+     *     uint16_t files = mp3.countFiles();
+     *     if(mp3.lastResult() != MP3_REQUEST_DONE) { ... no answer ... }
+     * 
+     * @return MP3_REQUEST_DONE, MP3_REQUEST_TIMEOUT, MP3_REQUEST_CHECKSUM_FAILED or MP3_REQUEST_UNEXPECTED
+     */
+    
+    uint8_t lastResult() { return lastRequestResult; }
+    
+#if MP3_STATS
+    /** @name Statistics
+     * 
+     * Only when MP3_STATS is set to 1 (for the whole build, see MP3_LAYOUT), otherwise none of 
+     *  this exists, nor costs anything.
+     */
+    ///@{
+    
+    /** Get the statistics kept since the start (or resetStats())
+     * 
+     *     const JQ8400_Stats &stats = mp3.getStats();
+     *     if(stats.timeouts > 10) { ... this one is not well ... }
+     */
+    
+    const JQ8400_Stats &getStats() { return stats; }
+    
+    /** Start the statistics over. */
+    
+    void resetStats() { memset(&stats, 0, sizeof(stats)); }
+    
+    /** Print the statistics in a readable table.
+     * 
+     *     mp3.dumpStats(Serial);
+     * 
+     * @param out Where to print them.
+     */
+    
+    void dumpStats(Print &out);
+    
+    ///@}
+#endif
+    
+    /** Set a function to receive frames from the device that were not a response
+     *  to a command we sent (for example the periodic position reports).
+     * 
+     * Such frames are picked up from whatever is waiting on the line before
+     *  each command is sent, and by `update()` while nothing is in flight.
+     * 
+     * @param handler Function to call, or NULL to discard such frames.
+     */
+    
+    void setUnsolicitedHandler(JQ8400_FrameCallback handler) { unsolicitedHandler = handler; }
+    
+#if MP3_TRACE
+    /** Set a function to be given every frame sent and received, and every
+     *  timeout, only when MP3_TRACE is set to 1.
+     * 
+     * See JQ8400_Trace for one which records them in a ring to be looked at 
+     *  later, nothing is printed from inside the engine.
+     * 
+     * @param sink    Function to call, NULL to stop.
+     * @param context Given to the function.
+     */
+    
+    void setTraceSink(JQ8400_TraceSink sink, void *context = NULL) { traceSink = sink; traceContext = context; }
+#endif
+    
+    /** Start a batch of commands.
+     * 
+     * Until `endBatch()`, commands which need no response are queued (as with 
+     *  `setAsync()`), they are then sent back to back spaced only by the 
+     *  inter frame gap (see `setInterFrameGap()`).  
+     * 
+     * **Example**
+     * 
+     *     mp3.beginBatch();
+     *     mp3.setVolume(25);
+     *     mp3.setEqualizer(MP3_EQ_ROCK);
+     *     mp3.setLoopMode(MP3_LOOP_ALL);
+     *     mp3.playFileByIndexNumber(3);
+     *     mp3.endBatch();
+     * 
+     * Batches may be nested, only the outermost endBatch() has any effect.
+     */
+    
+    void beginBatch();
+    
+    /** End a batch of commands, see `beginBatch()`
+     * 
+     * @param wait True (default) to block until the batch is sent (and any
+     *   queries in it answered), False to leave it to `update()`
+     */
+    
+    void endBatch(uint8_t wait = true);
+    
+    /** Block until everything queued has been sent and any responses received (or timed out).
+     */
+    
+    void flushQueue();
+    
+    /** Set the minimum time between the end of one frame sent to the device and 
+     *  the start of the next.
+     * 
+     *  The time is measured, not slept, if it has already passed by the time
+     *  the next command is ready, the command is sent immediately.
+     * 
+     * @param microseconds Gap, default MP3_INTER_FRAME_GAP (1000)
+     */
+    
+    void setInterFrameGap(uint16_t microseconds) { interFrameGap = microseconds; }
+    
+    /** Tell us the baud rate of the stream to the device (it does not change
+     *  the stream's rate itself), the time each frame takes on the wire, and
+     *  so when the next may be sent and how long to wait for responses, 
+     *  follow from it.
+     * 
+     * @param baud Rate, default 9600.
+     */
+    
+    void setBaudRate(uint32_t baud) { byteTime = baud ? 10000000UL / baud : MP3_BYTE_TIME; }
+    
+    /** Find the baud rate the device answers at.
+     * 
+     * Each rate is tried in turn with a single status query, the first to be
+     *  answered is kept.  If none is the stream is put back to 9600.
+     * 
+     * The JQ8400 has no known command to change it's own rate, this is for 
+     *  modules which have been made (or set by their vendor's tools) to run 
+     *  at a rate other than 9600.
+     * 
+     * **Example**
+     * 
+     *     void setRate(JQ8400_Serial &, uint32_t baud) { Serial2.begin(baud); }
+     *     
+     *     const uint32_t rates[] = { 115200, 57600, 38400, 19200, 9600 };
+     *     mp3.probeBaudRate(setRate, rates, 5);
+     * 
+     * @param setRate Function to put your stream at a rate.
+     * @param rates   Rates to try, in order.
+     * @param count   Number of rates.
+     * @return Rate found (and given to setBaudRate()), 0 if the device answered at none.
+     */
+    
+    uint32_t probeBaudRate(JQ8400_BaudCallback setRate, const uint32_t *rates, uint8_t count);
+    
+    /** Set how many queued queries may be sent before the response to the
+     *  first has been received.
+     * 
+     *  Responses are matched to queries in the order they were sent.  Default 1,
+     *  that is, nothing is sent while waiting for a response.
+     * 
+     * @param depth 1 to MP3_ASYNC_QUEUE_LENGTH
+     */
+    
+    void setPipelineDepth(uint8_t depth) { pipelineDepth = depth ? depth : 1; }
+    
+    /** Set what to do while waiting for the device (a response, room in the 
+     *  queue, or the inter frame gap), rather than spinning on millis().
+     * 
+     *  The built in strategies are
+     *  
+     *   * `JQ8400_Serial::waitSpin`  - Spin, as when none is set (the default).
+     *   * `JQ8400_Serial::waitYield` - Call yield(), for cooperative schedulers.
+     *   * `JQ8400_Serial::waitIdle`  - On AVR, idle sleep until an interrupt (the 
+     *     serial port receiving, or the millis() timer within about 1ms).  On
+     *     ESP32, block the task for a tick so FreeRTOS idles, and light sleeps 
+     *     if automatic light sleep is configured (esp_pm_configure()). Elsewhere 
+     *     yield().
+     *  
+     *  The ESP32 uses a tick rather than esp_light_sleep_start() with a UART 
+     *  wakeup, because the bytes which wake the chip are lost, and those 
+     *  would be the response.
+     *  
+     *  Between commands the library waits for nothing, so another strategy 
+     *  is free to power down while idle, see sleep().
+     * 
+     * **Example**
+     * 
+     *     mp3.setWaitStrategy(JQ8400_Serial::waitIdle);
+     * 
+     * @param strategy A JQ8400_WaitStrategy, NULL to spin.
+     */
+    
+    void setWaitStrategy(JQ8400_WaitStrategy strategy) { waitStrategy = strategy; }
+    
+    /** Wait strategy which returns immediately, see setWaitStrategy() */
+    
+    static void waitSpin(JQ8400_Serial &, uint32_t) { }
+    
+    /** Wait strategy which calls yield(), see setWaitStrategy() */
+    
+    static void waitYield(JQ8400_Serial &, uint32_t) { yield(); }
+    
+    /** Wait strategy which sleeps the processor (AVR) or the task (ESP32), see setWaitStrategy() */
+    
+    static void waitIdle(JQ8400_Serial &mp3, uint32_t maxMicros);
+    
+    /** Attach a pointer of your own to this object, so that callbacks can find
+     *  their way back to your data.
+     * 
+     * @param data Anything you like
+     */
+    
+    void  setUserData(void *data) { userData = data; }
+    
+    /** Get the pointer given to `setUserData()`
+     * 
+     * @return The pointer, or NULL
+     */
+    
+    void *getUserData() { return userData; }
+    
+    ///@}
+    
+    /** @name Events
+     * 
+     * Rather than poll the device to find out when something happens, the 
+     * library can watch what the device sends (both the responses to queries
+     * and the unsolicited position reports) and call you when it notices 
+     * something.
+     * 
+     * For the end of a track to be noticed without any polling at all, turn 
+     *  on `setPositionStreaming()` and call `update()` frequently.
+     * 
+     * The callbacks are called while reading from the device, they must not 
+     *  call any method which waits for a response (getStatus() etc), use 
+     *  queueCommand() instead if you need to.
+     * 
+     * **Example**
+     * 
+     *     void trackEnded(JQ8400_Serial &mp3, uint16_t index)
+     *     {
+     *       mp3.next();
+     *     }
+     *     
+     *     void setup()
+     *     {
+     *       ...
+     *       mp3.onTrackEnd(trackEnded);
+     *       mp3.setPositionStreaming(true);
+     *     }
+     * 
+     *     void loop()
+     *     {
+     *       mp3.update(); 
+     *     }
+     * 
+     */
+    ///@{
+    
+    /** Call a function when the playing track finishes by itself (not if we stopped it).
+     * 
+     *  Noticed from the status going from playing to stopped, the position 
+     *  jumping back to the start of the next track, or the position reports stopping.
+     * 
+     * @param callback Given the FAT index of the track that finished if known (else 0), NULL to stop.
+     */
+    
+    void onTrackEnd(JQ8400_EventCallback callback)     { trackEndCallback = callback; }
+    
+    /** Call a function on each position report (see setPositionStreaming())
+     * 
+     * @param callback Given the position in seconds, NULL to stop.
+     */
+    
+    void onPosition(JQ8400_EventCallback callback)     { positionCallback = callback; }
+    
+    /** Call a function when the device reports a different source than it had before.
+     * 
+     * @param callback Given the new source (MP3_SRC_*), NULL to stop.
+     */
+    
+    void onSourceChange(JQ8400_EventCallback callback) { sourceChangeCallback = callback; }
+    
+    /** Call a function when the device reports (or we infer) a different status than it had before.
+     * 
+     * @param callback Given the new status (MP3_STATUS_*), NULL to stop.
+     */
+    
+    void onStatusChange(JQ8400_EventCallback callback) { statusChangeCallback = callback; }
+    
+    /** Have `update()` keep track of the status by polling the device for it.
+     * 
+     * Polls quickly while the status is uncertain (just after play(), next() 
+     *  etc, or when the recent responses disagree) and when the end of the track 
+     *  is near (the file length and position are fetched as needed), otherwise
+     *  slowly.  See MP3_STATUS_POLL_FAST and MP3_STATUS_POLL_SLOW.
+     * 
+     * Together with onTrackEnd() and onStatusChange() this avoids the need to 
+     *  ever call getStatus() (which will then return the tracked status 
+     *  immediately).
+     * 
+     * @param enable True to track, False (default) to leave it to you.
+     */
+    
+    void setStatusTracking(uint8_t enable) { setFlag(MP3_FLAG_STATUS_TRACKING, enable); statusPolledAt = millis() - MP3_STATUS_POLL_SLOW; }
+    
+    /** Set how many times getStatus() may ask the device, stopping once two 
+     *  of its answers agree, or one says stopped.  The answers are voted on
+     *  (see statusConfidence()), but only those to the one call.
+     * 
+     * @param checks 1 (default MP3_STATUS_CHECKS_IN_AGREEMENT) to trust the first answer.
+     */
+    
+    void setStatusChecks(uint8_t checks) { statusChecks = checks ? checks : 1; }
+    
+    /** How sure we are of the status, being the proportion of the recent
+     *  status responses (see MP3_STATUS_VOTE_WINDOW) which agree with it.
+     * 
+     * The status is that the majority of the recent responses agree on, so 
+     *  a single wrong response does not change it.  A command which changes 
+     *  the status (play() etc) starts the vote over.
+     * 
+     * @return 0 (the status is unknown) to 100 (the whole window agrees, or the 
+     *  status was inferred from the device's own reports).
+     */
+    
+    uint8_t statusConfidence() { return shadowValid(MP3_SHADOW_STATUS) ? (statusVoteCount[currentStatus] * 100) / MP3_STATUS_VOTE_WINDOW : 0; }
+    
+    ///@}
+    
+    /** @name Device Shadow
+     * 
+     * The library keeps a record ("shadow") of the device's state, from the 
+     *  commands it has sent and the responses it has received.  Each field
+     *  of the shadow is one of...
+     * 
+     *  * MP3_SHADOW_VOLUME    - see getVolume()
+     *  * MP3_SHADOW_EQ        - see getEqualizer()
+     *  * MP3_SHADOW_LOOP      - see getLoopMode()
+     *  * MP3_SHADOW_SOURCE    - see getSource()
+     *  * MP3_SHADOW_INDEX     - see currentFileIndexNumber()
+     *  * MP3_SHADOW_STATUS    - see getStatus()
+     *  * MP3_SHADOW_FILES     - see countFiles()
+     *  * MP3_SHADOW_POSITION  - see currentFilePositionInSeconds()
+     * 
+     * A field is valid once we have set or been told the value, and becomes 
+     *  invalid when a command makes it uncertain (eg, next() makes the index 
+     *  uncertain).
+     */
+    ///@{
+    
+    /** Is the given shadow field known?
+     * 
+     * @param field One of MP3_SHADOW_*
+     * @return bool
+     */
+    
+    uint8_t shadowValid(uint8_t field) { return field < MP3_SHADOW_FIELDS && (shadowValidBits & (1 << field)); }
+    
+    /** How long ago the given shadow field was last set or confirmed.
+     * 
+     * @param field One of MP3_SHADOW_*
+     * @return Milliseconds, or 0xFFFFFFFF if the field is not valid, always 
+     *   0 for a valid field other than the position if MP3_SHADOW_AGES is 0.
+     */
+    
+    uint32_t shadowAge(uint8_t field);
+    
+    /** The last known value of the given shadow field (see shadowValid()).
+     * 
+     * @param field One of MP3_SHADOW_*
+     * @return Value of that field
+     */
+    
+    uint16_t shadowValue(uint8_t field);
+    
+    /** Forget the given shadow field, so that it will be asked again, or 
+     *  sent even if the same when suppressing redundant commands.
+     * 
+     * @param field One of MP3_SHADOW_*, or MP3_SHADOW_ALL (default)
+     */
+    
+    void invalidateShadow(uint8_t field = MP3_SHADOW_ALL);
+    
+    /** Don't send setVolume(), setEqualizer(), setLoopMode(), setSource() if the 
+     *  device is already known to be in that state, nor volumeUp()/volumeDn() at 
+     *  the limits of volume.
+     * 
+     * Handy when driving the volume from a potentiometer for example.
+     * 
+     * @param enable True to suppress redundant commands, False (default) to always send.
+     */
+    
+    void setSuppressRedundant(uint8_t enable) { setFlag(MP3_FLAG_SUPPRESS_REDUNDANT, enable); }
+    
+    /** Reconcile the shadow with the device in one batch.
+     *  
+     * The volume, equalizer and loop mode we know are sent to the device (it can 
+     *  not be asked for them) and the source, current file index, 
+     *  status and file count are asked of it.
+     * 
+     * In asynchronous mode (see setAsync()) this is all queued and completes
+     *  through update(), otherwise it blocks until done.
+     */
+    
+    void sync();
+    
+    ///@}
     
     /** Start playing the current file, if paused the playing is resumed.
      * 
@@ -285,6 +1243,59 @@ class JQ8400_Serial
     
     void playInFolderNumber(uint16_t folderNumber);
     
+    /** Play a file by it's path, to any depth, the names need only be the 
+     *  start of the real names (the device matches them with wildcards).
+     *
+     * **Example**
+     * 
+     * The device contains the file...
+     * 
+     *     /ads/2026/014 Summer Sale.mp3
+     * 
+     * then the following code will play that file...
+     * 
+     *     mp3.playFileByPath("/ads/2026/014");
+     * 
+     * and a path ending in a slash plays the first (?) file in that folder
+     * 
+     *     mp3.playFileByPath("/ads/2026/");
+     * 
+     * To put numbers in a path use fixedDecimal() which adds zero padding.
+     * 
+     *     char path[] = "/ads/2026/???";
+     *     JQ8400_Serial::fixedDecimal(path + 10, 14, 3); // "/ads/2026/014"
+     *     mp3.playFileByPath(path);  
+     * 
+     * The frame carries it's length in a byte, so the path, with the wildcards
+     *  added (two for each slash, 5 more besides), can be at most 255 long.
+     * 
+     * @param path Slash separated path, starting with a slash.
+     * @return True if it was sent, false if the path was too long and nothing was.
+     */
+    
+    uint8_t playFileByPath(const char *path);
+    
+    /** As playFileByPath() with the path in flash.
+     * 
+     *     mp3.playFileByPath_P(PSTR("/ads/2026/014"));
+     * 
+     * @param path Slash separated path, starting with a slash (PROGMEM).
+     * @return True if it was sent, false if the path was too long and nothing was.
+     */
+    
+    uint8_t playFileByPath_P(const char *path);
+    
+    /** Write a number in decimal with a fixed number of digits, zero padded,
+     *  without division (and without a terminating null).
+     * 
+     * @param out    Where to write the digits
+     * @param value  The number, if it has more digits than width, only the last width are written
+     * @param width  Number of digits, 1 to 5
+     * @return Just after the last digit written.
+     */
+    
+    static char *fixedDecimal(char *out, uint16_t value, uint8_t width);
+    
     
     /** Seek to a specific file based on it's FAT index number.  
      * 
@@ -370,6 +1381,69 @@ class JQ8400_Serial
     
     void setVolume(byte volumeFrom0To30);
     
+    /** @name Fading
+     * 
+     * The volume is changed a step at a time by update(), which must be 
+     *  called frequently, nothing here waits.  The level for the time is 
+     *  worked out from the start and end, and sent only when it differs
+     *  from what was last sent, with at most one volume command queued at
+     *  a time; when the line is busy the steps in between are skipped,
+     *  rather than queued up behind, and a fade never takes longer than 
+     *  asked.
+     * 
+     * The fade begins from the volume we last set (see getVolume()), the
+     *  device is never asked.  setVolume(), volumeUp() and volumeDn() 
+     *  cancel a fade.
+     * 
+     * **Example**
+     * 
+     *     mp3.duck(5, 300);              // Music down...
+     *     mp3.interjectFileByIndexNumber(ANNOUNCEMENT);
+     *     ...
+     *     mp3.unduck(1000);              // ... and back up.
+     *     
+     *     mp3.fadeOut(3000);             // Closing time.
+     */
+    ///@{
+    
+    /** Fade to a volume.
+     * 
+     * @param volumeFrom0To30 Where to end.
+     * @param ms              How long to take, 0 to set it straight away.
+     */
+    
+    void fadeTo(uint8_t volumeFrom0To30, uint16_t ms);
+    
+    /** Fade to silence, stop, and put the volume back for what plays next.
+     * 
+     * @param ms How long to take.
+     */
+    
+    void fadeOut(uint16_t ms);
+    
+    /** Fade down, remembering the volume to return to with unduck().
+     * 
+     * Ducking again before unducking leaves the remembered volume as it was.
+     * 
+     * @param volumeFrom0To30 Where to duck to.
+     * @param ms              How long to take.
+     */
+    
+    void duck(uint8_t volumeFrom0To30, uint16_t ms);
+    
+    /** Fade back to the volume before duck().
+     * 
+     * @param ms How long to take.
+     */
+    
+    void unduck(uint16_t ms);
+    
+    /** @return True while a fade is in progress. */
+    
+    uint8_t fading() { return flag(MP3_FLAG_FADE_ACTIVE); }
+    
+    ///@}
+    
     /** Set the equalizer to one of 6 preset modes.
      * 
      * @param equalizerMode One of the following, 
@@ -421,6 +1495,11 @@ class JQ8400_Serial
     void setSource(byte source);
     
     /** Return the currently selected source.
+     * 
+     *  The source is remembered from `setSource()`, `reset()` and any response
+     *  from the device that reveals it, so usually this does not need to ask 
+     *  the device (only if it is not yet known).  Use `refreshSource()` to ask
+     *  the device regardless.
      * 
      *  @return One of the following...
      * 
@@ -430,6 +1509,16 @@ class JQ8400_Serial
      */
     
     uint8_t getSource();
+    
+    /** Ask the device for the currently selected source and remember it.
+     * 
+     *  Only needed if something other than this library may have changed it
+     *  (eg, the SD card was removed).
+     * 
+     *  @return One of MP3_SRC_BUILTIN, MP3_SRC_SDCARD, MP3_SRC_USB
+     */
+    
+    uint8_t refreshSource();
         
     /** Return boolean indicating if the given source is available (can be selected using `setSource()`)
      * 
@@ -454,6 +1543,10 @@ class JQ8400_Serial
      *  Note that the JQ8400 seems to automatically sleep when it 
      *  stops playing **except** when you seek to a track (or pause).
      * 
+     *  Once this returns nothing is expected from the device, you may
+     *  end() the serial port (and begin() it again before the next command)
+     *  if you want to power down the UART too.
+     * 
      */
     
     void sleep();
@@ -471,7 +1564,61 @@ class JQ8400_Serial
     
     void reset();
     
+    /** Start the device without waiting, a faster alternative to reset().
+     * 
+     * A cold start sends stop and reset once, then the volume, equalizer and
+     *  loop mode (those already set, or reset()'s defaults), then asks which
+     *  sources the device has until it answers with one, up to 
+     *  MP3_STARTUP_ATTEMPTS times, and then which source it is using.  It is
+     *  only ready once the source is known, if the second goes unanswered (a
+     *  timeout or bad checksum) and the first did not settle it, both are 
+     *  asked again within the same attempts.  That is usually done within a 
+     *  few tens of ms, where reset() can take seconds.
+     * 
+     * A warm attach first just asks, if the device answers it's left as it 
+     *  is (still playing, perhaps, across a reboot of ours) and only the 
+     *  source, status and index are read into the shadow.  The volume, 
+     *  equalizer and loop mode are not known then, so are always sent when
+     *  next set.  If it doesn't answer, a cold start follows.
+     * 
+     * Progress is made by update(), see startupState() and onReady().
+     * 
+     * **Example**
+     * 
+     *     void setup()
+     *     {
+     *       Serial2.begin(9600);
+     *       mp3.startup(true);
+     *     }
+     *     
+     *     void loop()
+     *     {
+     *       mp3.update();
+     *       if(mp3.startupState() == MP3_STARTUP_READY) { ... }
+     *     }
+     * 
+     * @param warm True to attach to a device that is already going, if it is.
+     */
+    
+    void startup(uint8_t warm = false);
+    
+    /** @return MP3_STARTUP_NONE, MP3_STARTUP_PENDING, MP3_STARTUP_READY or MP3_STARTUP_FAILED */
+    
+    uint8_t startupState() { return startupStatus; }
+    
+    /** Call a function when startup() has finished.
+     * 
+     * @param callback Given MP3_STARTUP_READY or MP3_STARTUP_FAILED, NULL to stop.
+     */
+    
+    void onReady(JQ8400_EventCallback callback) { readyCallback = callback; }
+    
     /** Get the status from the device.
+     * 
+     * When setStatusTracking() is on and the status is known, the tracked 
+     *  status is returned without asking.  Otherwise the device is asked, 
+     *  at most as many times as setStatusChecks() allows, and the responses 
+     *  voted on (see statusConfidence()).
      * 
      * @return One of MP3_STATUS_PAUSED, MP3_STATUS_PLAYING and MP3_STATUS_STOPPED
      */
@@ -558,20 +1705,47 @@ class JQ8400_Serial
      *  @return FAT index number of file.
      */
     
-    uint16_t   currentFileIndexNumber();
+    uint16_t   currentFileIndexNumber();
+    
+    /** For the currently playing or paused file, return the 
+     *  current position in seconds.
+     * 
+     * Normally this asks the device, which involves turning on and off again
+     *  the device's position reporting.  If `setPositionStreaming()` is on, 
+     *  the last reported position is returned immediately instead.
+     * 
+     * @return Number of seconds into the file currently played.
+     * 
+     */
+    
+    uint16_t   currentFilePositionInSeconds();
+    
+    /** As for `currentFilePositionInSeconds()` but in milliseconds.
+     * 
+     * When streaming (see `setPositionStreaming()`) and playing, the time since 
+     *  the last report (which come each second) is added, for a smooth progress bar.
+     * 
+     * @return Number of milliseconds into the file currently played.
+     */
+    
+    uint32_t   currentFilePositionInMilliseconds();
     
-    /** For the currently playing or paused file, return the 
-     *  current position in seconds.
+    /** Leave the device's once-per-second position reporting on.
      * 
-     * @return Number of seconds into the file currently played.
+     * The reports are consumed as they arrive (by `update()`, or before the
+     *  next command is sent) and `currentFilePositionInSeconds()` returns
+     *  the last of them without asking the device.
      * 
+     * @param enable True to start reporting, False to stop.
      */
     
-    uint16_t   currentFilePositionInSeconds();
+    void       setPositionStreaming(uint8_t enable);
     
     /** For the currently playing or paused file, return the 
      *  total length of the file in seconds.
      * 
+     * The length is kept as the name is, see currentFileName().
+     * 
      * @return Length of audio file in seconds.
      * 
      */
@@ -586,6 +1760,11 @@ class JQ8400_Serial
      * The current file is the one that is playing, paused, or if stopped then
      * could be next to play or last played, uncertain.
      * 
+     * The name is kept, along with the index of the file it belongs to, so 
+     *  asking again while the same file is current costs a query of the index.
+     *  With position streaming or status tracking on, which notice a track 
+     *  ending, not even that while the index is known (see shadowValid()).
+     * 
      * **Example**
      * 
      *     char buf[12];
@@ -593,11 +1772,36 @@ class JQ8400_Serial
      *     Serial.println(buf);
      *
      * @param buffer character buffer of 12 bytes or more (eg `char buf[12]`)
-     * @param bufferLength length of the buffer (eg 12)
+     * @param bufferLength length of the buffer (eg 12), a shorter buffer gets the start of the name
      * 
      */
     
     void           currentFileName(char *buffer, uint16_t bufferLength);    
+    
+    /** Get the name of the "current" file a byte at a time, as the bytes 
+     *  arrive, for example to draw it straight to a display.
+     * 
+     * If the name is already known, the callback is given it from there 
+     *  before returning.
+     * 
+     * The bytes are given before the checksum arrives, if the result is 
+     *  not MP3_REQUEST_DONE what was drawn should be discarded.
+     * 
+     * **Example**
+     * 
+     *     void drawName(JQ8400_Serial &, uint8_t position, char c)
+     *     {
+     *       lcd.setCursor(position, 0);
+     *       lcd.write(c);
+     *     }
+     *     
+     *     mp3.currentFileName(drawName);
+     * 
+     * @param callback Given each byte of the name in turn.
+     * @return MP3_REQUEST_DONE, or as lastResult() if the name could not be had.
+     */
+    
+    uint8_t        currentFileName(JQ8400_NameCallback callback);
         
     /** Play a sequence of files, which must all exist in a folder called "ZH" and be named 00.mp3 through 99.mp3
      * 
@@ -616,14 +1820,35 @@ class JQ8400_Serial
      *     uint8_t playList[] = { 3, 1, 2 };
      *     mp3.playSequenceByFileNumber(playList, sizeof(playList));
      * 
-     * pay attention that the file names are 2 digits, "`1.mp3`" is not valid.
+     * pay attention that the file names are 2 digits, "`1.mp3`" is not valid,
+     *  so the numbers go from 0 to 99.  A list with any number over 99 in it 
+     *  is refused as a whole, nothing is sent and what is playing carries on.
+     * 
+     * The sequence is sent straight from your list, without copying it, so it 
+     *  can be as long as you like.  Beyond MP3_PLAYLIST_SEGMENT files it is sent 
+     *  in segments, each once the last has finished, for which the end of tracks 
+     *  must be noticed (see onTrackEnd(), setPositionStreaming(), setStatusTracking())
+     *  and update() called frequently.
      * 
-     * @param playList An array of the numbers of files in the "ZH" folder.
+     * @param playList An array of the numbers of files in the "ZH" folder, 0 to 99.
      * @param listLength          Number of filenames in the list.
+     * @return True if the sequence was started, false if a number was over 99.
+     * 
+     */
+    
+    uint8_t playSequenceByFileNumber(uint8_t playList[], uint16_t listLength);
+    
+    /** As playSequenceByFileNumber() with the list in flash.
      * 
+     *     const uint8_t playList[] PROGMEM = { 3, 1, 2 };
+     *     mp3.playSequenceByFileNumber_P(playList, sizeof(playList));
+     * 
+     * @param playList An array (PROGMEM) of the numbers of files in the "ZH" folder, 0 to 99.
+     * @param listLength          Number of filenames in the list.
+     * @return True if the sequence was started, false if a number was over 99.
      */
     
-    void playSequenceByFileNumber(uint8_t playList[], uint8_t listLength);
+    uint8_t playSequenceByFileNumber_P(const uint8_t *playList, uint16_t listLength);
     
     /** Play a sequence of files, which must all exist in a folder called "ZH" and have 2 character names.
      * 
@@ -637,6 +1862,8 @@ class JQ8400_Serial
      *     /ZH/1B.mp3
      *     /ZH/AZ.mp3
      * 
+     * Numbered files, being 2 characters, are only 00.mp3 to 99.mp3 here too.
+     * 
      * then the following code will play them in the order 1B.mp3, A1.mp3, AZ.mp3
      *  
      *     const char * playList[] = { "1B", "A1", "AZ" };
@@ -647,7 +1874,46 @@ class JQ8400_Serial
      * 
      */
     
-    void playSequenceByFileName(const char *playList[], uint8_t listLength);
+    void playSequenceByFileName(const char *playList[], uint16_t listLength);
+    
+    /** As playSequenceByFileName() with the names packed together in a string in flash.
+     * 
+     *     const char playList[] PROGMEM = "1BA1AZ";
+     *     mp3.playSequenceByFileName_P(playList, 3);
+     * 
+     * @param playList   The two character names, one after the other (PROGMEM).
+     * @param listLength Number of filenames in the list.
+     */
+    
+    void playSequenceByFileName_P(const char *playList, uint16_t listLength);
+    
+    /** Play a sequence of files from the "ZH" folder, asking a function for
+     *  each name as it is needed, so the sequence need not exist in memory at all.
+     * 
+     *     void countdown(JQ8400_Serial &mp3, uint16_t position, char name[2])
+     *     {
+     *       name[0] = '0';
+     *       name[1] = '9' - position;
+     *     }
+     *     
+     *     mp3.playSequence(countdown, 10); // 09.mp3, 08.mp3 ... 00.mp3
+     * 
+     * The names are 2 characters, so numbered files go from 00 to 99, a 
+     *  generator has to keep to that itself.
+     * 
+     * @param generator  Function to give each name.
+     * @param listLength Number of files in the sequence.
+     */
+    
+    void playSequence(JQ8400_PlaylistGenerator generator, uint16_t listLength);
+    
+    /** Forget the rest of a sequence longer than MP3_PLAYLIST_SEGMENT, the current 
+     *  segment plays out but no more is sent.  
+     * 
+     *  Anything else which changes the track (play by index, stop etc) does this too.
+     */
+    
+    void cancelSequence() { playlistLength = playlistSent = 0; playlistSegmentLeft = 0; setFlag(MP3_FLAG_PLAYLIST_DUE, false); }
     
     
     
@@ -665,6 +1931,161 @@ class JQ8400_Serial
     
     void sendCommandData(uint8_t command, uint8_t *requestBuffer, uint8_t requestLength, uint8_t *responseBuffer, uint8_t bufferLength);
     
+    /** Send a constant frame to the JQ8400 module, as sendCommandData() but 
+     *  for a frame built at compile time.
+     * 
+     *     this->sendFrame(JQ8400_Frame<MP3_CMD_PLAY>::bytes);
+     * 
+     * @param frame          A JQ8400_Frame<...>::bytes (PROGMEM)
+     * @param responseBuffer Buffer to store a single line of response, if NULL, no response is read.
+     * @param bufferLength   Length of response buffer.
+     */
+    
+    void sendFrame(const uint8_t *frame, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0);
+    
+    /** Wait until a frame may be sent in blocking mode, that is once everything 
+     *  queued has gone (and been answered), garbage on the line has been cleared
+     *  and the inter frame gap has passed.
+     */
+    
+    void prepareToSend();
+    
+    /** Read the response to the command just sent, see sendCommandData()
+     * 
+     * @param command        The command which was sent (the response echoes it)
+     * @param responseBuffer Buffer to store the response data.
+     * @param bufferLength   Length of response buffer.
+     * @param timeout        Longest (ms) to wait for it.
+     * @return MP3_REQUEST_DONE, MP3_REQUEST_TIMEOUT, MP3_REQUEST_CHECKSUM_FAILED or MP3_REQUEST_UNEXPECTED
+     */
+    
+    uint8_t receiveResponse(uint8_t command, uint8_t *responseBuffer, uint8_t bufferLength, uint16_t timeout);
+    
+    /** Send a frame and, if a response is wanted, receive it, trying again according
+     *  to the response policy as needed.
+     * 
+     * @param command        Byte value of to send as from the datasheet.
+     * @param requestBuffer  Pointer to (or NULL) request data bytes.
+     * @param requestLength  Number of bytes in the request buffer.
+     * @param frame          Or a JQ8400_Frame<...>::bytes (PROGMEM) to send instead of assembling one
+     * @param responseBuffer Buffer to store the response, if NULL, no response is read.
+     * @param bufferLength   Length of response buffer.
+     */
+    
+    void transact(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, const uint8_t *frame, uint8_t *responseBuffer, uint8_t bufferLength);
+    
+    /** Which class of command (for it's response policy) a command is.
+     * 
+     * @param command One of MP3_CMD_*
+     * @return One of MP3_CLASS_*
+     */
+    
+    static uint8_t commandClass(uint8_t command) { return command == MP3_CMD_CURRENT_FILE_NAME ? MP3_CLASS_NAME : MP3_CLASS_QUERY; }
+    
+    /** How long (ms) to wait for the response to a command, the policy's 
+     *  allowance for the device plus the time on the wire for the command
+     *  and the longest response to it.
+     * 
+     * @param command       Command byte
+     * @param requestLength Number of data bytes sent with it
+     */
+    
+    uint16_t responseTimeout(uint8_t command, uint8_t requestLength)
+    {
+      uint8_t responseLength = commandClass(command) == MP3_CLASS_NAME ? MP3_NAME_LENGTH : 3;
+      return responsePolicy[commandClass(command)].timeout + ((8 + requestLength + responseLength) * (uint32_t)byteTime) / 1000 + 1;
+    }
+    
+    /** A queued request failed, try it again if the policy allows, otherwise
+     *  complete it with the failure.
+     * 
+     * @param slot   Index into requests
+     * @param result MP3_REQUEST_TIMEOUT, MP3_REQUEST_CHECKSUM_FAILED or MP3_REQUEST_UNEXPECTED
+     */
+    
+    void failRequest(uint8_t slot, uint8_t result);
+    
+    /** The first transmitted request which is waiting for a response to the given command.
+     * 
+     * @param command The command echoed in the response, or MP3_ANY_COMMAND
+     * @return Index into requests, or MP3_NO_SLOT
+     */
+    
+    uint8_t awaitingResponseTo(uint8_t command);
+    
+    /** Start playing a sequence, see playSequenceByFileNumber()
+     * 
+     * @param kind      One of MP3_PLAYLIST_* saying what list is
+     * @param list      The list, as given to the public method
+     * @param generator Or the function giving the list
+     * @param length    Number of files.
+     */
+    
+    void startSequence(uint8_t kind, const void *list, JQ8400_PlaylistGenerator generator, uint16_t length);
+    
+    /** Whether a list of file numbers can be played as a sequence, that is 
+     *  each is 2 digits (99 or less).
+     * 
+     * @param list    The numbers
+     * @param length  How many
+     * @param progmem True if list is in PROGMEM
+     */
+    
+    static uint8_t sequenceNumbersValid(const uint8_t *list, uint16_t length, uint8_t progmem);
+    
+    /** Write the next segment of the sequence to the device, computing the 
+     *  checksum as each name is fetched from the list, nothing is buffered.
+     */
+    
+    void writePlaylist();
+    
+    /** Write a play-by-path frame to the device, adding the wildcards the 
+     *  device requires as the path is read, a buffer full at a time.
+     * 
+     * @param path     See playFileByPath()
+     * @param progmem  True if path is in PROGMEM
+     * @return False if the path is too long for a frame, nothing is sent.
+     */
+    
+    uint8_t writePath(const char *path, uint8_t progmem);
+    
+    /** Get the name of one file of the sequence.
+     * 
+     * @param position Which file of the sequence.
+     * @param name     Where to put the 2 character name.
+     */
+    
+    void playlistEntry(uint16_t position, uint8_t name[2]);
+    
+    /** A stop is about to be sent, so the device will be stopped, where is no
+     *  longer known, and the rest of any sequence is abandoned.
+     */
+    
+    void stopping();
+    
+    /** The track is about to be changed by a command, so what is playing, and 
+     *  where, is no longer known and the rest of any sequence is abandoned.
+     */
+    
+    void trackChanging();
+    
+    /** Is the name in currentName that of the current file?  Asks for the index if that isn't known.
+     * 
+     * @return bool
+     */
+    
+    uint8_t currentNameKnown();
+    
+    /** Is the shadow index as good as asking?  Only if it is known and a change
+     *  of track would have been seen (and so invalidated it), which takes
+     *  position streaming or status tracking, otherwise the device may have
+     *  moved on to the next track without us.
+     * 
+     * @return bool
+     */
+    
+    uint8_t indexFollowed() { return shadowValid(MP3_SHADOW_INDEX) && flag(MP3_FLAG_POSITION_STREAMING | MP3_FLAG_STATUS_TRACKING); }
+    
     /** Send a command with no arguments and no response. 
      * 
      * @param command       Byte value of to send as from the datasheet.
@@ -709,6 +2130,17 @@ class JQ8400_Serial
      */
     
     uint16_t sendCommandWithUnsignedIntResponse(byte command);
+    
+#if MP3_STATS
+    /** Count one attempt of a command in the statistics.
+     * 
+     * @param command  The command sent.
+     * @param result   MP3_REQUEST_DONE or how it failed.
+     * @param latency  us from sending to the response (or to sent, if none).
+     */
+    
+    void recordStats(uint8_t command, uint8_t result, uint32_t latency);
+#endif
 
     /** Send a command to the JQ8400 module, and get an 8 bit integer response.
      * 
@@ -717,6 +2149,20 @@ class JQ8400_Serial
      */
     
     uint8_t sendCommandWithByteResponse(uint8_t command);
+    
+    /** As sendCommandWithUnsignedIntResponse() for a constant frame.
+     * 
+     * @param frame A JQ8400_Frame<...>::bytes (PROGMEM)
+     */
+    
+    uint16_t sendFrameWithUnsignedIntResponse(const uint8_t *frame);
+    
+    /** As sendCommandWithByteResponse() for a constant frame.
+     * 
+     * @param frame A JQ8400_Frame<...>::bytes (PROGMEM)
+     */
+    
+    uint8_t sendFrameWithByteResponse(const uint8_t *frame);
 
     
     /** Return a bitmask of the available sources.
@@ -738,10 +2184,361 @@ class JQ8400_Serial
     
     int    waitUntilAvailable(uint16_t maxWaitTime = 1000);
     
+    /** Let the wait strategy have the time, if there is one, see setWaitStrategy()
+     * 
+     * @param maxMicros   Longest it may take.
+     */
+    
+    void idle(uint32_t maxMicros) { if(waitStrategy) waitStrategy(*this, maxMicros); }
+    
+    /** Wait some milliseconds, through the wait strategy.
+     * 
+     * @param ms  How long.
+     */
+    
+    void idleFor(uint16_t ms);
+    
+    /** Write a complete command frame to the device.
+     * 
+     * @param command        Byte value of to send as from the datasheet.
+     * @param requestBuffer  Pointer to (or NULL) request data bytes.
+     * @param requestLength  Number of bytes in the request buffer.
+     */
+    
+    void writeFrame(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength);
+    
+    /** Write a constant frame to the device.
+     * 
+     * @param frame A JQ8400_Frame<...>::bytes (PROGMEM)
+     */
+    
+    void writeFrame(const uint8_t *frame);
+    
+    /** A frame has been written, note when the next may be.
+     * 
+     * @param length Total bytes in the frame.
+     */
+    
+    void frameWritten(uint16_t length);
+    
+    /** Consume (without waiting) whatever has already been received, complete 
+     *  frames are passed to the unsolicited handler.
+     */
+    
+    void drain();
+    
+    /** Update what we know about the device from a frame it sent us.
+     * 
+     *  Called for every valid frame received, responses and unsolicited alike.
+     * 
+     * @param command The command byte of the frame
+     * @param data    Data bytes
+     * @param length  Number of data bytes
+     */
+    
+    void observeFrame(uint8_t command, const uint8_t *data, uint8_t length);
+    
+    /** Pass the frame just parsed to the unsolicited handler (if any).
+     */
+    
+    void handleUnsolicitedFrame();
+    
+    /** The device has told us the source, record it and dispatch any change.
+     * 
+     * @param source One of MP3_SRC_*
+     */
+    
+    void sourceObserved(uint8_t source);
+    
+    /** The device has told us (or shown us) it's status, record it and dispatch any change.
+     * 
+     * @param status One of MP3_STATUS_*
+     */
+    
+    void statusObserved(uint8_t status);
+    
+    /** The playing track has finished by itself, dispatch that.
+     */
+    
+    void trackEnded();
+    
+    /** A status response has arrived, vote on it.
+     * 
+     * @param status One of MP3_STATUS_*
+     */
+    
+    void statusSampled(uint8_t status);
+    
+    /** Start the status vote over, with the whole window agreeing on status.
+     * 
+     * @param status One of MP3_STATUS_*, or 0xFF to leave it empty.
+     */
+    
+    void seedStatusVote(uint8_t status);
+    
+    /** Queue whatever tracking the status needs now, see setStatusTracking() */
+    
+    void trackStatus();
+    
+    /** Send the stop, reset and settings of a cold startup(), and ask if the device is ready. */
+    
+    void startupCold();
+    
+    /** Ask the device which sources it has, the startup() probe. */
+    
+    void startupProbe();
+    
+    /** A startup() query has completed, see JQ8400_RequestCallback */
+    
+    static void startupAnswered(JQ8400_Serial &mp3, uint8_t request, uint8_t result, uint8_t command, const uint8_t *data, uint8_t length);
+    
+    /** startup() has finished.
+     * 
+     * @param status MP3_STARTUP_READY or MP3_STARTUP_FAILED
+     */
+    
+    void startupFinished(uint8_t status);
+    
+    /** Send the next step of a fade if it's due, see fadeTo() */
+    
+    void advanceFade();
+    
+    /** Is a request for this command queued or in flight?
+     * 
+     * @param command One of MP3_CMD_*
+     */
+    
+    uint8_t commandPending(uint8_t command);
+    
+    /** Feed a single received byte to the response frame parser.
+     * 
+     * @param b Byte read from the device
+     * @return MP3_RX_INCOMPLETE, MP3_RX_FRAME (rxCommand, rxLength and rxData are valid) or MP3_RX_BAD_CHECKSUM
+     */
+    
+    uint8_t parseResponseByte(uint8_t b);
+    
+    /** Finish an asynchronous request, running it's callback (if any).
+     * 
+     * @param slot   Index into requests[]
+     * @param result MP3_REQUEST_DONE, MP3_REQUEST_TIMEOUT, MP3_REQUEST_CHECKSUM_FAILED or MP3_REQUEST_UNEXPECTED
+     */
+    
+    void completeRequest(uint8_t slot, uint8_t result);
+    
+    /** Find the oldest request in a given state.
+     * 
+     * @param state One of MP3_REQUEST_*
+     * @return Index into requests[], or MP3_NO_SLOT
+     */
+    
+    uint8_t oldestRequest(uint8_t state);
+    
+    /** Count the requests in a given state.
+     * 
+     * @param state One of MP3_REQUEST_*
+     * @return Number of requests
+     */
+    
+    uint8_t countRequests(uint8_t state);
+    
+    /** Has the inter frame gap after the last frame we sent passed?
+     * 
+     * @return bool
+     */
+    
+    uint8_t txReady() { return (int32_t)(micros() - txReadyAt) >= 0; }
+    
+    static const uint8_t MP3_RX_INCOMPLETE    = 0;
+    static const uint8_t MP3_RX_FRAME         = 1;
+    static const uint8_t MP3_RX_BAD_CHECKSUM  = 2;
+    static const uint8_t MP3_NO_SLOT          = 0xFF;
+    static const uint8_t MP3_ANY_COMMAND      = 0xFF; ///< For awaitingResponseTo()
+    
+    /** A command queued for the asynchronous engine.
+     * 
+     *  Once sent the data buffer is reused for the response.
+     */
+    
+    struct AsyncRequest
+    {
+      uint8_t id;              ///< Handle given to the caller, 0 when this slot is free
+      uint8_t state;           ///< One of MP3_REQUEST_*
+      uint8_t command;         ///< Command byte
+      uint8_t length;          ///< Number of bytes in data (request, then response)
+      uint8_t expectResponse;  ///< Whether to wait for a response after transmitting
+      uint8_t attempts;        ///< Number of failed attempts so far
+      uint8_t sentSequence;    ///< txSequence when transmitted, responses come in this order
+#if MP3_STATS
+      uint32_t sentMicros;     ///< micros() when transmitted
+#endif
+      uint16_t sentAt;         ///< millis() (truncated) when transmitted, or when the last attempt failed
+      uint8_t data[MP3_FRAME_DATA_LENGTH]; ///< Request data, then response data
+      JQ8400_RequestCallback callback; ///< Called on completion, may be NULL
+    };
+    
+    AsyncRequest requests[MP3_ASYNC_QUEUE_LENGTH] = { }; ///< Queued, in flight and completed asynchronous requests
+    uint8_t  nextRequestId   = 1;           ///< Handle for the next queued request
+    uint8_t  pipelineDepth   = 1;           ///< See setPipelineDepth()
+    uint8_t  lastRequestResult = MP3_REQUEST_UNKNOWN; ///< See lastResult()
+    uint8_t  txSequence      = 0;           ///< Count of requests transmitted which await a response
+
+    // Everything which is only on or off is a bit of flags, a byte each adds up
+    static const uint16_t MP3_FLAG_ASYNC              = 0x0001; ///< Queue commands that need no response, see setAsync()
+    static const uint16_t MP3_FLAG_ASYNC_BEFORE_BATCH = 0x0002; ///< MP3_FLAG_ASYNC to restore at endBatch()
+    static const uint16_t MP3_FLAG_RX_UNEXPECTED      = 0x0004; ///< A response to something we didn't ask came while awaiting one
+    static const uint16_t MP3_FLAG_STATUS_TRACKING    = 0x0008; ///< See setStatusTracking()
+    static const uint16_t MP3_FLAG_STARTUP_WARM       = 0x0010; ///< Attaching, nothing sent to the device but queries
+    static const uint16_t MP3_FLAG_STARTUP_PROBE_DUE  = 0x0020; ///< Probe at startupProbeAt
+    static const uint16_t MP3_FLAG_FADE_ACTIVE        = 0x0040; ///< See fading()
+    static const uint16_t MP3_FLAG_FADE_STOPS         = 0x0080; ///< Stop at the end of the fade, see fadeOut()
+    static const uint16_t MP3_FLAG_DUCKED             = 0x0100; ///< duck() has been called, and not unduck()
+    static const uint16_t MP3_FLAG_PLAYLIST_DUE       = 0x0200; ///< The next segment should be sent by update()
+    static const uint16_t MP3_FLAG_POSITION_STREAMING = 0x0400; ///< See setPositionStreaming()
+    static const uint16_t MP3_FLAG_SUPPRESS_REDUNDANT = 0x0800; ///< See setSuppressRedundant()
+
+    uint16_t flags           = 0;           ///< MP3_FLAG_* which are set
+
+    uint8_t flag(uint16_t mask) { return (flags & mask) != 0; }
+    void    setFlag(uint16_t mask, uint8_t on) { if(on) flags |= mask; else flags &= ~mask; }
+    
+#if MP3_STATS
+    JQ8400_Stats stats = { };               ///< See getStats()
+    uint32_t firstByteAt = 0;               ///< micros() the first byte of the last blocking response arrived, 0 if none did
+#endif
+    
+    struct ResponsePolicy
+    {
+      uint16_t timeout;        ///< ms to wait for each response
+      uint8_t  retries;        ///< Number of retries after the first attempt
+      uint8_t  backoff;        ///< ms to wait before the first retry, doubling after
+    };
+    
+    ResponsePolicy responsePolicy[MP3_CLASSES] = {
+      { MP3_QUERY_TIMEOUT, MP3_QUERY_RETRIES, MP3_RETRY_BACKOFF },
+      { MP3_NAME_TIMEOUT,  MP3_NAME_RETRIES,  MP3_RETRY_BACKOFF }
+    }; ///< See setResponsePolicy()
+    uint16_t interFrameGap   = MP3_INTER_FRAME_GAP; ///< See setInterFrameGap()
+    uint16_t byteTime        = MP3_BYTE_TIME;       ///< us per byte on the wire, see setBaudRate()
+    uint32_t txReadyAt       = 0;           ///< micros() after which the next frame may be sent
+    uint8_t  batchDepth      = 0;           ///< Nesting of beginBatch()
+    JQ8400_FrameCallback unsolicitedHandler = NULL; ///< See setUnsolicitedHandler()
+    uint8_t  statusChecks    = MP3_STATUS_CHECKS_IN_AGREEMENT; ///< See setStatusChecks()
+    
+#if MP3_TRACE
+    JQ8400_TraceSink traceSink    = NULL;       ///< See setTraceSink()
+    void            *traceContext = NULL;       ///< See setTraceSink()
+    
+    /** Pass something to the trace sink, if there is one, see JQ8400_TraceSink */
+    
+    void trace(uint8_t event, uint8_t command, const uint8_t *data, uint8_t length) { if(traceSink) traceSink(*this, traceContext, event, command, data, length); }
+#endif
+    void    *userData        = NULL;        ///< See setUserData()
+    JQ8400_WaitStrategy waitStrategy = NULL;  ///< See setWaitStrategy()
+    
+    JQ8400_EventCallback trackEndCallback     = NULL; ///< See onTrackEnd()
+    JQ8400_EventCallback positionCallback     = NULL; ///< See onPosition()
+    JQ8400_EventCallback sourceChangeCallback = NULL; ///< See onSourceChange()
+    JQ8400_EventCallback statusChangeCallback = NULL; ///< See onStatusChange()
+    
+    uint8_t  statusVotes[MP3_STATUS_VOTE_WINDOW];   ///< Recent status responses, a ring
+    uint8_t  statusVoteCount[3]    = { 0, 0, 0 };   ///< How many of statusVotes are each MP3_STATUS_*
+    uint8_t  statusVoteFill        = 0;             ///< How many of statusVotes are used
+    uint8_t  statusVoteHead        = 0;             ///< Where the next response goes in statusVotes
+    uint32_t statusPolledAt        = 0;             ///< millis() when the tracker last polled the status
+    
+    uint8_t  startupStatus         = MP3_STARTUP_NONE; ///< See startupState()
+    uint8_t  startupAttempts       = 0;             ///< Probes made
+    uint32_t startupProbeAt        = 0;             ///< millis() to probe again
+    JQ8400_EventCallback readyCallback = NULL;      ///< See onReady()
+    
+    uint8_t  fadeFrom              = 0;             ///< Volume the fade started at
+    uint8_t  fadeTarget            = 0;             ///< Volume the fade ends at
+    uint8_t  fadeRestore           = 0;             ///< Volume to put back after fadeOut() has stopped
+    uint8_t  duckRestore           = 0;             ///< Volume to return to, see unduck()
+    uint16_t fadeDuration          = 0;             ///< ms the fade takes
+    uint32_t fadeStartAt           = 0;             ///< millis() the fade started
+    uint16_t currentLength         = 0;             ///< Length (s) of the file lengthIndex
+    uint16_t lengthIndex           = 0;             ///< FAT index which currentLength is for, 0 if none
+    char     currentName[MP3_NAME_LENGTH];        ///< Name of the file nameIndex
+    uint8_t  nameLength            = 0;             ///< Bytes of currentName the device gave
+    uint16_t nameIndex             = 0;             ///< FAT index which currentName is for, 0 if none
+    JQ8400_NameCallback nameStream = NULL;          ///< Given the name bytes of the response being received, see currentFileName()
+    
+    static const uint8_t MP3_PLAYLIST_NUMBERS   = 0;
+    static const uint8_t MP3_PLAYLIST_NUMBERS_P = 1;
+    static const uint8_t MP3_PLAYLIST_NAMES     = 2;
+    static const uint8_t MP3_PLAYLIST_NAMES_P   = 3;
+    static const uint8_t MP3_PLAYLIST_GENERATOR = 4;
+    
+    const void *playlist            = NULL;  ///< The list of the sequence being played
+    JQ8400_PlaylistGenerator playlistGenerator = NULL; ///< Or the function giving it
+    uint8_t     playlistKind        = 0;     ///< One of MP3_PLAYLIST_*, what playlist is
+    uint16_t    playlistLength      = 0;     ///< Number of files in the sequence
+    uint16_t    playlistSent        = 0;     ///< Number of those sent to the device so far
+    uint8_t     playlistSegmentLeft = 0;     ///< Files of the last segment sent not yet finished
+    
+    uint8_t rxState    = 0; ///< State of the response frame parser (MP3_RX_STATE_*)
+    uint8_t rxCommand  = 0; ///< Command byte of the frame being received
+    uint8_t rxLength   = 0; ///< Number of data bytes in the frame being received
+    uint8_t rxCount    = 0; ///< Number of data bytes received so far
+    uint8_t rxChecksum = 0; ///< Running checksum of the frame being received
+    uint8_t rxData[MP3_FRAME_DATA_LENGTH]; ///< Data bytes of the frame being received (excess is discarded)
+    
+    static const uint8_t MP3_RX_STATE_BEGIN    = 0;
+    static const uint8_t MP3_RX_STATE_COMMAND  = 1;
+    static const uint8_t MP3_RX_STATE_LENGTH   = 2;
+    static const uint8_t MP3_RX_STATE_DATA     = 3;
+    static const uint8_t MP3_RX_STATE_CHECKSUM = 4;
+    
         
     uint8_t currentVolume = 20; ///< Record of current volume level (JQ8400 has no way to query)
     uint8_t currentEq     = 0;  ///< Record of current equalizer (JQ8400 has no way to query)
     uint8_t currentLoop   = 2;  ///< Record of current loop mode (JQ8400 has no way to query)
+    uint8_t  currentSource    = 0;  ///< Record of current source, see getSource()
+    uint8_t  currentStatus    = 0;  ///< Last status reported by the device
+    uint16_t currentIndex     = 0;  ///< Last known FAT index of the current file
+    uint16_t currentFileCount = 0;  ///< Last known number of files on the current source
+    uint16_t currentPosition  = 0;  ///< Last reported position (seconds) in the current file
+    
+    uint8_t  shadowValidBits  = 0;  ///< Bit per MP3_SHADOW_* field, set if that field is known
+    uint32_t shadowUpdatedAt[MP3_SHADOW_AGES ? MP3_SHADOW_FIELDS : 1];   ///< millis() when each field was last set or confirmed, or only the position, see MP3_SHADOW_AGES
+    
+    /** Record that a shadow field is now known.
+     * 
+     * @param field One of MP3_SHADOW_*
+     */
+    
+    void markShadow(uint8_t field) 
+    { 
+      shadowValidBits |= (1 << field); 
+      if(MP3_SHADOW_AGES || field == MP3_SHADOW_POSITION) shadowUpdatedAt[MP3_SHADOW_AGES ? field : 0] = millis(); 
+    }
+    
+    /** True if redundant commands are suppressed and the field is known to have this value already.
+     * 
+     * @param field One of MP3_SHADOW_*
+     * @param value The value about to be set
+     * @return bool
+     */
+    
+    uint8_t isRedundant(uint8_t field, uint16_t value) { return flag(MP3_FLAG_SUPPRESS_REDUNDANT) && shadowValid(field) && shadowValue(field) == value; }
+    
+    /** Queue a command, waiting for room in the queue if necessary, any response is discarded (but observed).
+     * 
+     * @param command        Byte value of to send as from the datasheet.
+     * @param requestBuffer  Pointer to (or NULL) request data bytes.
+     * @param requestLength  Number of bytes in the request buffer.
+     * @param expectResponse True if the device responds to this command
+     */
+    
+    void queueCommandWaiting(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, uint8_t expectResponse);
+    
+    /** A JQ8400_RequestCallback which does nothing. */
+    
+    static void discardResponse(JQ8400_Serial &, uint8_t, uint8_t, uint8_t, const uint8_t *, uint8_t) { }
+    
+  public:
     
     /** @name Command Byte Definitions
      *
@@ -0,0 +1,183 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "JQ8400_Trace.h"
+
+#if MP3_TRACE
+
+void JQ8400_Trace::record(JQ8400_Serial &mp3, void *context, uint8_t event, uint8_t command, const uint8_t *data, uint8_t length)
+{
+  (void) mp3;
+  ((JQ8400_Trace *)context)->add(event, command, data, length);
+}
+
+void JQ8400_Trace::add(uint8_t event, uint8_t command, const uint8_t *data, uint8_t length)
+{
+  uint32_t now = micros();
+  Record  &r   = next();
+  
+  r.delta  = now - lastAt;
+  lastAt   = now;
+  
+  // The top bit of the event says the data wasn't given
+  r.event   = data ? event : (event | 0x80);
+  r.command = command;
+  r.length  = length;
+  if(data) memcpy(r.data, data, length < MP3_TRACE_DATA ? length : MP3_TRACE_DATA);
+  else     memset(r.data, 0, MP3_TRACE_DATA);
+}
+
+JQ8400_Trace::Record &JQ8400_Trace::next()
+{
+  Record &r = records[head];
+  
+  if(++head == MP3_TRACE_RECORDS) head = 0;
+  if(count < MP3_TRACE_RECORDS) count++;
+  else                          lost++;
+  
+  return r;
+}
+
+void JQ8400_Trace::printHex(Print &out, uint8_t b)
+{
+  if(b < 16) out.print('0');
+  out.print(b, HEX);
+}
+
+void JQ8400_Trace::dump(Print &out)
+{
+  if(lost)
+  {
+    out.print(lost);
+    out.println(F(" frames overwritten"));
+  }
+  
+  uint8_t at = oldest();
+  for(; count; count--)
+  {
+    const Record &r      = records[at];
+    uint8_t       length = r.length;
+    uint8_t       kept   = (r.event & 0x80) ? 0 : (length < MP3_TRACE_DATA ? length : MP3_TRACE_DATA);
+    
+    // Right aligned in 8 digits, so the frames line up
+    for(uint32_t p = 10000000UL; p > 1 && r.delta < p; p /= 10) out.print(' ');
+    out.print(r.delta);
+    out.print(' ');
+    
+    switch(r.event & 0x7F)
+    {
+      case MP3_TRACE_TX:      out.print(F("> "));          break;
+      case MP3_TRACE_RX:      out.print(F("< "));          break;
+      case MP3_TRACE_RX_BAD:  out.print(F("< BAD "));      break;
+      default:                out.print(F("  TIMEOUT "));  break;
+    }
+    
+    printHex(out, r.command);
+    out.print(' ');
+    printHex(out, length);
+    
+    for(uint8_t x = 0; x < kept; x++)
+    {
+      out.print(' ');
+      printHex(out, r.data[x]);
+    }
+    if(kept < length) out.print(F(" .."));
+    
+    out.println();
+    
+    if(++at == MP3_TRACE_RECORDS) at = 0;
+  }
+  
+  lost = 0;
+}
+
+void JQ8400_Trace::save(Print &out)
+{
+  // Little endian throughout, whatever the board, so the host can read it
+  const uint8_t header[] = { 
+    MP3_TRACE_MAGIC & 0xFF, MP3_TRACE_MAGIC >> 8, MP3_TRACE_VERSION, MP3_TRACE_DATA, 
+    count, (uint8_t)(lost & 0xFF), (uint8_t)(lost >> 8) 
+  };
+  out.write(header, sizeof(header));
+  
+  uint8_t at = oldest();
+  for(; count; count--)
+  {
+    const Record &r = records[at];
+    uint8_t       bytes[7] = { 
+      (uint8_t)r.delta, (uint8_t)(r.delta >> 8), (uint8_t)(r.delta >> 16), (uint8_t)(r.delta >> 24),
+      r.event, r.command, r.length 
+    };
+    
+    out.write(bytes, sizeof(bytes));
+    out.write(r.data, MP3_TRACE_DATA);
+    
+    if(++at == MP3_TRACE_RECORDS) at = 0;
+  }
+  
+  lost = 0;
+}
+
+uint8_t JQ8400_Trace::load(Stream &in)
+{
+  uint8_t header[7];
+  
+  head = count = 0;
+  lost = 0;
+  
+  if(in.readBytes(header, sizeof(header)) != sizeof(header))                         return false;
+  if(header[0] != (MP3_TRACE_MAGIC & 0xFF) || header[1] != (MP3_TRACE_MAGIC >> 8))  return false;
+  if(header[2] != MP3_TRACE_VERSION || header[3] != MP3_TRACE_DATA)                 return false;
+  
+  // Any frames overwritten on the board, plus any we don't have room for
+  uint16_t overwritten = header[5] | (header[6] << 8);
+  
+  for(uint8_t x = header[4]; x; x--)
+  {
+    uint8_t bytes[7];
+    Record &r = next();
+    
+    if(in.readBytes(bytes, sizeof(bytes)) != sizeof(bytes)
+    || in.readBytes(r.data, MP3_TRACE_DATA) != MP3_TRACE_DATA)
+    {
+      clear();
+      return false;
+    }
+    
+    r.delta   = bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    r.event   = bytes[4];
+    r.command = bytes[5];
+    r.length  = bytes[6];
+  }
+  
+  lost += overwritten;
+  return true;
+}
+
+#endif
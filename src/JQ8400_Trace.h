@@ -0,0 +1,183 @@
+/** 
+ * Arduino Library for JQ8400 MP3 Module
+ * 
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a 
+ * copy of this software and associated documentation files (the "Software"), 
+ * to deal in the Software without restriction, including without limitation 
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the 
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE.
+ * 
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef JQ8400Trace_h
+#define JQ8400Trace_h
+
+#include "JQ8400_Serial.h"
+
+#if MP3_TRACE
+
+// Frames kept, the oldest is overwritten once full
+#ifndef MP3_TRACE_RECORDS
+#define MP3_TRACE_RECORDS 16
+#endif
+
+// Data bytes kept of each frame, the rest are counted but not kept
+#ifndef MP3_TRACE_DATA
+#define MP3_TRACE_DATA 4
+#endif
+
+// First bytes of what save() writes, and its version
+#define MP3_TRACE_MAGIC   0x4A51
+#define MP3_TRACE_VERSION 1
+
+class JQ8400_Replay;
+
+/** Record the frames a JQ8400_Serial sends and receives in a ring, each with
+ *  the microseconds since the one before, to be printed or saved later, only 
+ *  when MP3_TRACE is set to 1.
+ * 
+ * Recording a frame is a copy of a few bytes, so unlike the printing that 
+ *  MP3_DEBUG used to do it hardly changes the timing of what it records.
+ * 
+ * What is saved can be loaded again, on the board or in a host build, and
+ *  played against a JQ8400_Mock with JQ8400_Replay at the same timing.
+ * 
+ * **Example**
+ * 
+ *     // With MP3_TRACE set to 1 for the whole build, the library as well as
+ *     //  the sketch (-DMP3_TRACE=1), not with a #define here, see MP3_LAYOUT
+ *     #include <JQ8400_Serial.h>
+ *     #include <JQ8400_Trace.h>
+ *     
+ *     JQ8400_Serial mp3(Serial2);
+ *     JQ8400_Trace  trace;
+ *     
+ *     void setup()
+ *     {
+ *       trace.attach(mp3);
+ *       ...
+ *     }
+ *     
+ *     void loop()
+ *     {
+ *       ...
+ *       if(somethingWentWrong) trace.dump(Serial);
+ *     }
+ */
+
+class JQ8400_Trace
+{
+  friend class JQ8400_Replay;
+  
+  public:
+    
+    /** Start recording what a device sends and receives.
+     * 
+     * @param mp3 The device, it's trace sink is replaced.
+     */
+    
+    void attach(JQ8400_Serial &mp3) { lastAt = micros(); mp3.setTraceSink(record, this); }
+    
+    /** Print what has been recorded, oldest first, and forget it.
+     * 
+     * One line per frame, the microseconds since the frame before, "> " for 
+     *  sent and "< " for received, then the command and data in hex, ".." for 
+     *  data not kept.
+     * 
+     * @param out Where to print it.
+     */
+    
+    void dump(Print &out);
+    
+    /** Write what has been recorded, oldest first, in a compact binary form 
+     *  that load() can read back, and forget it.
+     * 
+     * @param out Where to write it, a File on an SD card, or Serial to be 
+     *  captured on a computer.
+     */
+    
+    void save(Print &out);
+    
+    /** Replace what has been recorded with what save() wrote.
+     * 
+     * Both must have been built with the same MP3_TRACE_DATA, and at most 
+     *  MP3_TRACE_RECORDS are loaded, the newest.
+     * 
+     * @param in Where to read it from.
+     * @return False if it isn't a trace, or was cut short (then nothing is loaded).
+     */
+    
+    uint8_t load(Stream &in);
+    
+    /** Forget what has been recorded. */
+    
+    void clear() { head = count = 0; lost = 0; lastAt = micros(); }
+    
+    /** @return Number of frames recorded (at most MP3_TRACE_RECORDS). */
+    
+    uint8_t  recorded() { return count; }
+    
+    /** @return Number of frames overwritten before being dumped. */
+    
+    uint16_t overwritten() { return lost; }
+    
+    /** The trace sink, see JQ8400_TraceSink */
+    
+    static void record(JQ8400_Serial &mp3, void *context, uint8_t event, uint8_t command, const uint8_t *data, uint8_t length);
+    
+  protected:
+    
+    /** One frame */
+    
+    struct Record
+    {
+      uint32_t delta;                 ///< Microseconds since the record before (or attach() or clear())
+      uint8_t  event;                 ///< MP3_TRACE_*, with the top bit set if the data wasn't given
+      uint8_t  command;               ///< Command byte
+      uint8_t  length;                ///< Number of data bytes in the frame
+      uint8_t  data[MP3_TRACE_DATA];  ///< The first of them
+    };
+    
+    /** Add a frame to the ring, see JQ8400_TraceSink for the parameters. */
+    
+    void add(uint8_t event, uint8_t command, const uint8_t *data, uint8_t length);
+    
+    /** @return The next record in the ring, overwriting the oldest if it is full. */
+    
+    Record &next();
+    
+    /** @return The oldest record's position in the ring. */
+    
+    uint8_t oldest() { return (head + MP3_TRACE_RECORDS - count) % MP3_TRACE_RECORDS; }
+    
+    /** Print a byte as 2 hex digits. */
+    
+    static void printHex(Print &out, uint8_t b);
+    
+    Record   records[MP3_TRACE_RECORDS];  ///< The ring
+    uint8_t  head   = 0;                  ///< Where the next record goes
+    uint8_t  count  = 0;                  ///< Number of records in the ring
+    uint16_t lost   = 0;                  ///< See overwritten()
+    uint32_t lastAt = 0;                  ///< micros() of the last record
+};
+
+#endif
+
+#endif